@@ -0,0 +1,13 @@
+# ----------------------------------------------------------------------------
+# Merge raw profiles of Clang after training load: PGO_DIR/*.profraw -> PGO_DIR/default.profdata
+#
+#   cmake -DLLVM_PROFDATA=llvm-profdata -DPGO_DIR=dir -P pgo_merge.cmake
+# ----------------------------------------------------------------------------
+file(GLOB raw_profiles ${PGO_DIR}/*.profraw)
+if(NOT raw_profiles)
+	message(FATAL_ERROR "There aren't raw profiles in ${PGO_DIR}")
+endif()
+execute_process(COMMAND ${LLVM_PROFDATA} merge -output=${PGO_DIR}/default.profdata ${raw_profiles} RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+	message(FATAL_ERROR "llvm-profdata merge failed: ${result}")
+endif()
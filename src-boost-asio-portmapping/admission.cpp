@@ -0,0 +1,149 @@
+/**
+ * @file   admission.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Overload protection: budgets of process, limits of connections and rate of accept
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "admission.hpp"
+#include "backend_pool.hpp"
+#include "buffer_pool.hpp"
+#include "log.hpp"
+
+#include <chrono>
+// ----------------------------------------------------------------------------
+
+///
+/// Create budgets
+///
+/// @param max_connections active connections of all port mappings, at which accept is paused
+/// @param max_buffer_bytes memory of the buffer pool, at which accept is paused (0 - unlimited)
+/// @param resume_percent accept is resumed, when usage of each budget falls to this percent
+///
+T_overload_guard::T_overload_guard(size_t max_connections, size_t max_buffer_bytes, unsigned int resume_percent)
+	: max_connections_(max_connections), resume_connections_(max_connections * resume_percent / 100),
+	  max_buffer_bytes_(max_buffer_bytes), resume_buffer_bytes_(max_buffer_bytes * resume_percent / 100),
+	  active_connections_(0), paused_(false)
+{
+	// free buffers are returned to the heap beyond half of the gap of hysteresis,
+	// else memory of the pool wouldn't fall to the resume level after the load is gone
+	if(max_buffer_bytes_ != 0)
+		T_buffer_pool::instance().set_max_free_bytes((max_buffer_bytes_ - resume_buffer_bytes_) / 2);
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Whether accept is paused: it's set when a budget is exhausted, and is cleared when usage is below resume level
+///
+/// @return true - don't accept new connections now
+///
+bool T_overload_guard::paused() {
+	const size_t connections = active_connections_.load(std::memory_order_relaxed);
+	const size_t buffer_bytes = (max_buffer_bytes_ != 0) ? T_buffer_pool::instance().allocated_bytes() : 0;
+	if(paused_.load(std::memory_order_relaxed)) {
+		if(connections > resume_connections_ || buffer_bytes > resume_buffer_bytes_) return true;
+		if(paused_.exchange(false, std::memory_order_relaxed))
+			PORTMAPPING_LOG(log_warning, "Accept is resumed: connections " << connections << ", buffers " << buffer_bytes << " bytes");
+		return false;
+	}
+	if(connections >= max_connections_ || (max_buffer_bytes_ != 0 && buffer_bytes >= max_buffer_bytes_)) {
+		if(!paused_.exchange(true, std::memory_order_relaxed))
+			PORTMAPPING_LOG(log_warning, "Accept is paused by overload: connections " << connections << " (max " << max_connections_ <<
+				"), buffers " << buffer_bytes << " bytes (max " << max_buffer_bytes_ << ")");
+		return true;
+	}
+	return false;
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Create admission of port mapping
+///
+/// @param overload_guard budgets of process
+/// @param limits limits of port mapping
+///
+T_admission::T_admission(T_overload_guard& overload_guard, const T_admission_limits& limits)
+	: overload_guard_(overload_guard), limits_(limits),
+	  emission_interval_us_((limits.accept_rate_ != 0) ? 1000000 / limits.accept_rate_ : 0),
+	  burst_tolerance_us_(emission_interval_us_ * ((limits.accept_burst_ > 1) ? limits.accept_burst_ - 1 : 0)),
+	  arrival_time_us_(0), active_connections_(0)
+{
+	if(limits_.max_connections_per_ip_ != 0) {
+		ip_connections_.reset(new std::atomic<uint32_t>[ip_slots]);
+		for(size_t i = 0; i < ip_slots; ++i) ip_connections_[i].store(0, std::memory_order_relaxed);
+	}
+}
+// ----------------------------------------------------------------------------
+
+/// Current time of steady clock in us
+int64_t T_admission::now_us() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Check budgets and limits before accept of next connection, and take a token of accept rate
+///
+/// @return 0 - accept now, else delay in ms before next check
+///
+unsigned int T_admission::accept_delay_ms() {
+	if(overload_guard_.paused()) return retry_ms;
+	if(limits_.max_connections_ != 0 && active_connections_.load(std::memory_order_relaxed) >= limits_.max_connections_)
+		return retry_ms;
+	if(emission_interval_us_ == 0) return 0;
+
+	// GCRA: each accept moves the theoretical arrival time by emission interval,
+	// accept is allowed while it isn't ahead of now more than burst tolerance
+	const int64_t now = now_us();
+	int64_t arrival_time = arrival_time_us_.load(std::memory_order_relaxed);
+	for(;;) {
+		const int64_t next_arrival_time = ((arrival_time > now) ? arrival_time : now) + emission_interval_us_;
+		const int64_t ahead_us = next_arrival_time - now - emission_interval_us_ - burst_tolerance_us_;
+		if(ahead_us > 0) return static_cast<unsigned int>((ahead_us + 999) / 1000);
+		if(arrival_time_us_.compare_exchange_weak(arrival_time, next_arrival_time, std::memory_order_relaxed, std::memory_order_relaxed))
+			return 0;
+	}
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Count accepted connection, if it's within limits of port mapping and of its client IP
+///
+/// @param client_address address of client
+/// @param ticket admission of the connection, it must be released at close
+///
+/// @return false - the connection must be closed at once
+///
+bool T_admission::admit(const ba::ip::address& client_address, T_admission_ticket& ticket) {
+	// many acceptors can pass accept_delay_ms() at once, so the limit of port mapping is checked again
+	const size_t connections = active_connections_.fetch_add(1, std::memory_order_relaxed);
+	if(limits_.max_connections_ != 0 && connections >= limits_.max_connections_) {
+		active_connections_.fetch_sub(1, std::memory_order_relaxed);
+		return false;
+	}
+	size_t ip_slot = 0;
+	if(ip_connections_) {
+		ip_slot = T_backend_pool::hash(client_address) & (ip_slots - 1);
+		if(ip_connections_[ip_slot].fetch_add(1, std::memory_order_relaxed) >= limits_.max_connections_per_ip_) {
+			ip_connections_[ip_slot].fetch_sub(1, std::memory_order_relaxed);
+			active_connections_.fetch_sub(1, std::memory_order_relaxed);
+			return false;
+		}
+	}
+	overload_guard_.acquire();
+	ticket.admission_ = this;
+	ticket.ip_slot_ = ip_slot;
+	return true;
+}
+// ----------------------------------------------------------------------------
+
+/// Release counters of the connection at its close
+void T_admission::release(const T_admission_ticket& ticket) {
+	if(ip_connections_) ip_connections_[ticket.ip_slot_].fetch_sub(1, std::memory_order_relaxed);
+	active_connections_.fetch_sub(1, std::memory_order_relaxed);
+	overload_guard_.release();
+}
+// ----------------------------------------------------------------------------
+
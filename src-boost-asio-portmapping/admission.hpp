@@ -0,0 +1,159 @@
+/**
+ * @file   admission.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Overload protection: budgets of process, limits of connections and rate of accept
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef ADMISSION_HPP
+#define ADMISSION_HPP
+// ----------------------------------------------------------------------------
+#include <boost/noncopyable.hpp>
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+// ----------------------------------------------------------------------------
+#include <atomic>
+#include <memory>
+#include <cstdint>
+// ----------------------------------------------------------------------------
+
+///
+/// Budgets of process, which are shared by all port mappings: connections and memory of the buffer pool.
+/// When any of them is exhausted, all listeners pause accept (connections wait in the listen queue),
+/// and resume it only when usage falls to resume_percent of each budget (hysteresis), so accept doesn't flap at the limit.
+///
+class T_overload_guard : private boost::noncopyable {
+public:
+	///
+	/// Create budgets
+	///
+	/// @param max_connections active connections of all port mappings, at which accept is paused
+	/// @param max_buffer_bytes memory of the buffer pool, at which accept is paused (0 - unlimited)
+	/// @param resume_percent accept is resumed, when usage of each budget falls to this percent
+	///
+	T_overload_guard(size_t max_connections, size_t max_buffer_bytes, unsigned int resume_percent);
+
+	///
+	/// Whether accept is paused: it's set when a budget is exhausted, and is cleared when usage is below resume level
+	///
+	/// @return true - don't accept new connections now
+	///
+	bool paused();
+
+	/// Count connection admitted by any port mapping
+	inline void acquire() { active_connections_.fetch_add(1, std::memory_order_relaxed); }
+
+	/// Count closed connection
+	inline void release() { active_connections_.fetch_sub(1, std::memory_order_relaxed); }
+
+	/// Active connections of all port mappings
+	inline size_t active_connections() const { return active_connections_.load(std::memory_order_relaxed); }
+
+private:
+	const size_t max_connections_;          ///< budget of connections
+	const size_t resume_connections_;       ///< accept is resumed at this number of connections
+	const size_t max_buffer_bytes_;         ///< budget of memory of the buffer pool, 0 - unlimited
+	const size_t resume_buffer_bytes_;      ///< accept is resumed at this memory of the buffer pool
+	std::atomic<size_t> active_connections_;///< active connections of all port mappings
+	std::atomic<bool> paused_;              ///< accept is paused until usage falls to resume level
+};
+// ----------------------------------------------------------------------------
+
+/// Limits of accept of one port mapping, 0 - unlimited
+struct T_admission_limits {
+	T_admission_limits() : max_connections_(0), max_connections_per_ip_(0), accept_rate_(0), accept_burst_(100) {}
+
+	size_t max_connections_;                ///< active connections of port mapping: accept is paused at this number
+	size_t max_connections_per_ip_;         ///< active connections from one client IP: more are closed at once after accept
+	unsigned int accept_rate_;              ///< accepted connections per second (token bucket)
+	unsigned int accept_burst_;             ///< connections, which can be accepted at once above accept_rate_ (size of bucket)
+};
+// ----------------------------------------------------------------------------
+
+class T_admission;
+
+/// Admission of one connection: counters of its port mapping and of its client IP, which are released at close
+struct T_admission_ticket {
+	T_admission_ticket() : admission_(NULL), ip_slot_(0) {}
+
+	/// Release counters of the connection, if it has been admitted
+	inline void release();
+
+	T_admission *admission_;                ///< admission of port mapping, NULL - the connection isn't admitted
+	size_t ip_slot_;                        ///< slot of client IP in the table of counters
+};
+// ----------------------------------------------------------------------------
+
+///
+/// Overload protection of one port mapping, without locks: all decisions are made by atomic counters.
+///
+/// Before each accept: accept is paused, while budgets of process are exhausted or the port mapping has max_connections_,
+/// and accept rate is limited by token bucket (GCRA - one atomic of theoretical arrival time),
+/// so surplus connections wait in the listen queue instead of taking memory.
+/// After accept: connections over the limit of client IP are closed at once. Client IPs are counted in the fixed table
+/// by hash of address: IPs with the same hash share the limit, that is rare and only stricter.
+///
+class T_admission : private boost::noncopyable {
+public:
+	enum { ip_slots = 1 << 16 };            ///< size of table of counters of client IPs
+	enum { retry_ms = 10 };                 ///< delay before next check, if accept is paused
+
+	///
+	/// Create admission of port mapping
+	///
+	/// @param overload_guard budgets of process
+	/// @param limits limits of port mapping
+	///
+	T_admission(T_overload_guard& overload_guard, const T_admission_limits& limits);
+
+	///
+	/// Check budgets and limits before accept of next connection, and take a token of accept rate
+	///
+	/// @return 0 - accept now, else delay in ms before next check
+	///
+	unsigned int accept_delay_ms();
+
+	///
+	/// Count accepted connection, if it's within limits of port mapping and of its client IP
+	///
+	/// @param client_address address of client
+	/// @param ticket admission of the connection, it must be released at close
+	///
+	/// @return false - the connection must be closed at once
+	///
+	bool admit(const ba::ip::address& client_address, T_admission_ticket& ticket);
+
+	/// Release counters of the connection at its close
+	void release(const T_admission_ticket& ticket);
+
+	/// Whether the limit of connections per client IP is enabled (the address of client is needed for admit())
+	inline bool limits_client_ip() const { return limits_.max_connections_per_ip_ != 0; }
+
+	/// Limits of port mapping
+	inline const T_admission_limits& limits() const { return limits_; }
+
+private:
+	/// Current time of steady clock in us
+	static int64_t now_us();
+
+	T_overload_guard& overload_guard_;      ///< budgets of process
+	const T_admission_limits limits_;       ///< limits of port mapping
+	const int64_t emission_interval_us_;    ///< interval between tokens of accept rate, 0 - unlimited
+	const int64_t burst_tolerance_us_;      ///< how far the theoretical arrival time can be ahead of now
+	std::atomic<int64_t> arrival_time_us_;  ///< theoretical arrival time of the next accept (GCRA)
+	std::atomic<size_t> active_connections_;///< active connections of port mapping
+	std::unique_ptr<std::atomic<uint32_t>[]> ip_connections_;  ///< active connections by hash of client IP (only if limit is enabled)
+};
+// ----------------------------------------------------------------------------
+
+/// Release counters of the connection, if it has been admitted
+inline void T_admission_ticket::release() {
+	if(admission_ != NULL) admission_->release(*this);
+	admission_ = NULL;
+}
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // ADMISSION_HPP
@@ -0,0 +1,296 @@
+/**
+ * @file   backend_pool.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Pool of remote servers (backends) with load balancing policies
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "backend_pool.hpp"
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+// ----------------------------------------------------------------------------
+
+T_backend::T_backend(ba::io_service& io_service, const std::string& remote_address, unsigned int remote_port, 
+					 unsigned int refresh_seconds)
+	: name_(remote_address + ":" + boost::lexical_cast<std::string>(remote_port)),
+	  endpoints_(io_service, remote_address, remote_port, refresh_seconds),
+	  active_connections_(0)
+{
+}
+
+/// Whether the backend has at least one healthy endpoint
+bool T_backend::healthy() const {
+	return endpoints_.healthy(T_endpoint_table::now_ms());
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Resolve all backends
+/// 
+/// @param io_service io_service, in which resolvers work
+/// @param remote_addresses list of backends: "address[:port],[ipv6]:port,..."
+/// @param default_remote_port port of backends, for which it isn't specified
+/// @param policy policy of selection of backend
+/// @param refresh_seconds period of re-resolve of backends addresses
+///
+T_backend_pool::T_backend_pool(ba::io_service& io_service, const std::string& remote_addresses, unsigned int default_remote_port,
+							   T_balance_policy policy, unsigned int refresh_seconds)
+	: io_service_(io_service), refresh_seconds_(refresh_seconds), policy_(policy), current_(NULL), next_backend_(0),
+	  upstream_io_service_(NULL), upstream_executors_(NULL), upstream_target_size_(0), upstream_max_idle_seconds_(0),
+	  upstream_socket_options_(NULL)
+{
+	sets_.push_back(make_set(remote_addresses, default_remote_port));
+	current_.store(sets_.back().get(), std::memory_order_release);
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Create set of backends from the list, reusing existing backends with the same name
+/// 
+/// @param remote_addresses list of backends: "address[:port],[ipv6]:port,..."
+/// @param default_remote_port port of backends, for which it isn't specified
+/// 
+/// @return new set, new backends are appended to backends_
+///
+std::unique_ptr<T_backend_pool::T_backend_set> T_backend_pool::make_set(const std::string& remote_addresses, 
+																		 const unsigned int default_remote_port) 
+{
+	const T_backend_set *const old_set = current_.load(std::memory_order_acquire);
+	std::unique_ptr<T_backend_set> set(new T_backend_set);
+	std::vector<std::unique_ptr<T_backend> > created;
+	for(auto &i : parse_backends(remote_addresses, default_remote_port)) {
+		const std::string name = i.first + ":" + boost::lexical_cast<std::string>(i.second);
+		T_backend *backend = NULL;
+		if(old_set != NULL)
+			for(auto &old_backend : old_set->backends_)
+				if(old_backend->name_ == name) backend = old_backend;
+		if(backend == NULL) {	// resolve of new backend throws, if its address isn't resolved
+			created.emplace_back(new T_backend(io_service_, i.first, i.second, refresh_seconds_));
+			backend = created.back().get();
+			if(upstream_executors_ != NULL)
+				backend->upstream_pool_.reset(new T_upstream_pool(*upstream_io_service_, *upstream_executors_, 
+																  backend->endpoints_, upstream_target_size_, upstream_max_idle_seconds_,
+																  *upstream_socket_options_));
+		}
+		set->backends_.push_back(backend);
+	}
+	if(set->backends_.empty()) throw std::invalid_argument("No remote address: " + remote_addresses);
+
+	// each backend has virtual_nodes points on the ring, so the load is spread evenly, 
+	// and removing of one backend moves only its clients
+	for(size_t i = 0; i < set->backends_.size(); ++i)
+		for(size_t v = 0; v < virtual_nodes; ++v)
+			set->ring_.push_back(std::make_pair(hash(set->backends_[i]->name_ + "#" + boost::lexical_cast<std::string>(v)), i));
+	std::sort(set->ring_.begin(), set->ring_.end());
+
+	for(auto &i : created) backends_.push_back(std::move(i));
+	return set;
+}
+// ----------------------------------------------------------------------------
+
+/// Stop refresh of all backends
+void T_backend_pool::stop() {
+	for(auto &i : backends_) {
+		i->endpoints_.stop();
+		if(i->upstream_pool_) i->upstream_pool_->stop();
+	}
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Replace the list of backends: backends with the same address:port are kept with their health, 
+/// load and pre-established connections, new ones are resolved, removed ones are stopped, 
+/// but their established connections go on. It must not be called from many threads at once.
+/// 
+/// @param remote_addresses new list of backends: "address[:port],[ipv6]:port,..."
+/// @param default_remote_port port of backends, for which it isn't specified
+/// 
+/// @return number of added backends
+///
+size_t T_backend_pool::reload(const std::string& remote_addresses, unsigned int default_remote_port) {
+	const size_t backends_before = backends_.size();
+	std::unique_ptr<T_backend_set> set = make_set(remote_addresses, default_remote_port);
+	const T_backend_set& old_set = current();
+
+	// connections, which are accepted after this, select only from the new set
+	sets_.push_back(std::move(set));
+	current_.store(sets_.back().get(), std::memory_order_release);
+
+	for(auto &backend : old_set.backends_) {
+		const std::vector<T_backend*>& backends = current().backends_;
+		if(std::find(backends.begin(), backends.end(), backend) != backends.end()) continue;
+		backend->endpoints_.stop();
+		if(backend->upstream_pool_) backend->upstream_pool_->stop();
+	}
+	return backends_.size() - backends_before;
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Create pools of pre-established connections to each backend
+/// 
+/// @param io_service io_service, in which timers of maintenance work
+/// @param executors thread pool of executors, for each io_service of which pools have own sockets
+/// @param target_size number of pre-established sockets to each backend for each io_service of executors
+/// @param max_idle_seconds max time of idle pre-established socket, then it is reconnected, 0 - unlimited
+/// @param socket_options options of server sockets, which are set before connect (it must live longer than the pool)
+///
+void T_backend_pool::start_upstream_pools(ba::io_service& io_service, T_executors& executors, const size_t target_size,
+										  const unsigned int max_idle_seconds, const T_socket_options& socket_options) 
+{
+	upstream_io_service_ = &io_service;
+	upstream_executors_ = &executors;
+	upstream_target_size_ = target_size;
+	upstream_max_idle_seconds_ = max_idle_seconds;
+	upstream_socket_options_ = &socket_options;
+	for(auto &i : backends_) 
+		i->upstream_pool_.reset(new T_upstream_pool(io_service, executors, i->endpoints_, target_size, max_idle_seconds, socket_options));
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Select backend for the new connection
+/// 
+/// @param client_address address of the client
+/// 
+/// @return reference to the backend
+///
+T_backend& T_backend_pool::select(const ba::ip::address& client_address) {
+	const T_backend_set& set = current();
+	const std::vector<T_backend*>& backends = set.backends_;
+	const size_t size = backends.size();
+	if(size == 1) return *backends[0];
+
+	switch(policy_) {
+	case balance_least_connections: {
+		size_t best = first_healthy(set, 0);
+		for(size_t i = best + 1; i < size; ++i)
+			if(backends[i]->active_connections_.load(std::memory_order_relaxed) < 
+			   backends[best]->active_connections_.load(std::memory_order_relaxed) && backends[i]->healthy()) 
+				best = i;
+		return *backends[best];
+	}
+	case balance_power_of_two: {
+		const size_t first = first_healthy(set, random() % size);
+		const size_t second = first_healthy(set, random() % size);
+		return (backends[second]->active_connections_.load(std::memory_order_relaxed) < 
+				backends[first]->active_connections_.load(std::memory_order_relaxed)) ? *backends[second] : *backends[first];
+	}
+	case balance_client_ip_hash: {
+		// the first virtual node clockwise from the hash of client, and next healthy backend if it isn't healthy
+		const std::pair<uint32_t, size_t> key(hash(client_address), 0);
+		auto it = std::lower_bound(set.ring_.begin(), set.ring_.end(), key);
+		if(it == set.ring_.end()) it = set.ring_.begin();
+		for(size_t i = 0; i < set.ring_.size(); ++i) {
+			if(backends[it->second]->healthy()) return *backends[it->second];
+			if(++it == set.ring_.end()) it = set.ring_.begin();
+		}
+		return *backends[it->second];
+	}
+	case balance_round_robin:
+	default:
+		return *backends[first_healthy(set, next_backend_.fetch_add(1, std::memory_order_relaxed) % size)];
+	}
+}
+// ----------------------------------------------------------------------------
+
+/// Index of the first healthy backend from i in turn, or i if all of them aren't healthy
+size_t T_backend_pool::first_healthy(const T_backend_set& set, const size_t i) {
+	const size_t size = set.backends_.size();
+	for(size_t k = 0; k < size; ++k)
+		if(set.backends_[(i + k) % size]->healthy()) return (i + k) % size;
+	return i;
+}
+// ----------------------------------------------------------------------------
+
+/// Random number, xorshift generator of current thread
+uint32_t T_backend_pool::random() {
+	static thread_local uint32_t state = 2463534242U ^ static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&state));
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+/// Hash of IP address (FNV-1a)
+uint32_t T_backend_pool::hash(const ba::ip::address& address) {
+	uint32_t h = 2166136261U;
+	if(address.is_v4()) {
+		const ba::ip::address_v4::bytes_type bytes = address.to_v4().to_bytes();
+		for(auto b : bytes) h = (h ^ b) * 16777619U;
+	} else {
+		const ba::ip::address_v6::bytes_type bytes = address.to_v6().to_bytes();
+		for(auto b : bytes) h = (h ^ b) * 16777619U;
+	}
+	return h;
+}
+
+/// Hash of string (FNV-1a)
+uint32_t T_backend_pool::hash(const std::string& str) {
+	uint32_t h = 2166136261U;
+	for(unsigned char c : str) h = (h ^ c) * 16777619U;
+	return h;
+}
+// ----------------------------------------------------------------------------
+
+/// Parse policy name: rr, least, p2c, hash
+T_balance_policy T_backend_pool::parse_policy(const std::string& name) {
+	if(name == "least") return balance_least_connections;
+	if(name == "p2c") return balance_power_of_two;
+	if(name == "hash") return balance_client_ip_hash;
+	if(name == "rr") return balance_round_robin;
+	throw std::invalid_argument("Unknown balance policy: " + name + " (rr, least, p2c, hash)");
+}
+
+/// Name of policy
+const char* T_backend_pool::policy_name(const T_balance_policy policy) {
+	switch(policy) {
+	case balance_least_connections: return "least";
+	case balance_power_of_two: return "p2c";
+	case balance_client_ip_hash: return "hash";
+	default: return "rr";
+	}
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Split list of backends "address[:port],[ipv6]:port,..." to pairs of address and port
+/// 
+/// @param remote_addresses list of backends
+/// @param default_remote_port port of backends, for which it isn't specified
+/// 
+/// @return vector of pairs: address, port
+///
+std::vector<std::pair<std::string, unsigned int> > T_backend_pool::parse_backends(const std::string& remote_addresses, 
+																				  const unsigned int default_remote_port) 
+{
+	std::vector<std::pair<std::string, unsigned int> > backends;
+	size_t begin = 0;
+	while(begin < remote_addresses.size()) {
+		size_t end = remote_addresses.find(',', begin);
+		if(end == std::string::npos) end = remote_addresses.size();
+		const std::string item = remote_addresses.substr(begin, end - begin);
+		begin = end + 1;
+		if(item.empty()) continue;
+
+		std::string address = item;
+		unsigned int port = default_remote_port;
+		if(item[0] == '[') {	// [ipv6]:port
+			const size_t bracket = item.find(']');
+			address = item.substr(1, bracket - 1);
+			if(bracket != std::string::npos && bracket + 1 < item.size() && item[bracket + 1] == ':')
+				port = boost::lexical_cast<unsigned int>(item.substr(bracket + 2));
+		} else if(item.find(':') != std::string::npos && item.find(':') == item.rfind(':')) {	// address:port, but not ipv6
+			address = item.substr(0, item.find(':'));
+			port = boost::lexical_cast<unsigned int>(item.substr(item.find(':') + 1));
+		}
+		backends.push_back(std::make_pair(address, port));
+	}
+	return backends;
+}
+// ----------------------------------------------------------------------------
@@ -0,0 +1,173 @@
+/**
+ * @file   backend_pool.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Pool of remote servers (backends) with load balancing policies
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef BACKEND_POOL_HPP
+#define BACKEND_POOL_HPP
+// ----------------------------------------------------------------------------
+#include "endpoint_table.hpp"
+#include "upstream_pool.hpp"
+// ----------------------------------------------------------------------------
+#include <boost/noncopyable.hpp>
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+// ----------------------------------------------------------------------------
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <string>
+#include <utility>
+#include <cstdint>
+// ----------------------------------------------------------------------------
+
+/// Policy of selection of backend for each accepted connection
+enum T_balance_policy {
+	balance_round_robin,        ///< backends in turn
+	balance_least_connections,  ///< backend with the least number of active connections
+	balance_power_of_two,       ///< the least loaded of two random backends
+	balance_client_ip_hash      ///< consistent hashing on client IP: the same client goes to the same backend
+};
+// ----------------------------------------------------------------------------
+
+/// Remote server: its endpoints and number of active connections to it
+struct T_backend : private boost::noncopyable {
+	T_backend(ba::io_service& io_service, const std::string& remote_address, unsigned int remote_port, 
+			  unsigned int refresh_seconds);
+
+	/// Whether the backend has at least one healthy endpoint
+	bool healthy() const;
+
+	const std::string name_;                ///< address:port of remote server
+	T_endpoint_table endpoints_;            ///< endpoints of remote server with their health
+	std::atomic<int> active_connections_;   ///< number of active connections to this backend
+	std::unique_ptr<T_upstream_pool> upstream_pool_;   ///< pre-established connections to this backend, or empty if disabled
+};
+// ----------------------------------------------------------------------------
+
+///
+/// Pool of backends, one of which is selected by the policy for each accepted connection.
+/// Backends without healthy endpoints are skipped, while there are healthy ones.
+///
+/// The list of backends can be replaced by reload() while connections are accepted: selection reads
+/// the current immutable set without locks, and removed backends (and old sets) aren't destroyed
+/// until the pool itself, because established connections still refer to them.
+///
+class T_backend_pool : private boost::noncopyable {
+public:
+	enum { virtual_nodes = 160 };           ///< points of each backend on the ring of consistent hashing
+
+	/// Immutable set of backends with the ring of consistent hashing, it is replaced entirely by reload()
+	struct T_backend_set {
+		std::vector<T_backend*> backends_;                  ///< backends
+		std::vector<std::pair<uint32_t, size_t> > ring_;    ///< ring of consistent hashing: sorted hashes of virtual nodes and indexes of backends
+	};
+
+	/// 
+	/// Resolve all backends
+	/// 
+	/// @param io_service io_service, in which resolvers work
+	/// @param remote_addresses list of backends: "address[:port],[ipv6]:port,..."
+	/// @param default_remote_port port of backends, for which it isn't specified
+	/// @param policy policy of selection of backend
+	/// @param refresh_seconds period of re-resolve of backends addresses
+	///
+	T_backend_pool(ba::io_service& io_service, const std::string& remote_addresses, unsigned int default_remote_port,
+				   T_balance_policy policy, unsigned int refresh_seconds);
+
+	/// Stop refresh of all backends
+	void stop();
+
+	/// 
+	/// Replace the list of backends: backends with the same address:port are kept with their health, 
+	/// load and pre-established connections, new ones are resolved, removed ones are stopped, 
+	/// but their established connections go on. It must not be called from many threads at once.
+	/// 
+	/// @param remote_addresses new list of backends: "address[:port],[ipv6]:port,..."
+	/// @param default_remote_port port of backends, for which it isn't specified
+	/// 
+	/// @return number of added backends
+	///
+	size_t reload(const std::string& remote_addresses, unsigned int default_remote_port);
+
+	/// 
+	/// Create pools of pre-established connections to each backend
+	/// 
+	/// @param io_service io_service, in which timers of maintenance work
+	/// @param executors thread pool of executors, for each io_service of which pools have own sockets
+	/// @param target_size number of pre-established sockets to each backend for each io_service of executors
+	/// @param max_idle_seconds max time of idle pre-established socket, then it is reconnected, 0 - unlimited
+	/// @param socket_options options of server sockets, which are set before connect (it must live longer than the pool)
+	///
+	void start_upstream_pools(ba::io_service& io_service, T_executors& executors, const size_t target_size,
+							  const unsigned int max_idle_seconds, const T_socket_options& socket_options);
+
+	/// 
+	/// Select backend for the new connection
+	/// 
+	/// @param client_address address of the client
+	/// 
+	/// @return reference to the backend
+	///
+	T_backend& select(const ba::ip::address& client_address);
+
+	/// Policy of selection of backend
+	inline T_balance_policy policy() const { return policy_; }
+
+	/// Current set of backends (it stays valid after reload)
+	inline const T_backend_set& current() const { return *current_.load(std::memory_order_acquire); }
+
+	/// Parse policy name: rr, least, p2c, hash
+	static T_balance_policy parse_policy(const std::string& name);
+
+	/// Name of policy
+	static const char* policy_name(const T_balance_policy policy);
+
+	/// Hash of IP address (FNV-1a): position of client on the ring, and slot of client IP in tables of admission and bandwidth
+	static uint32_t hash(const ba::ip::address& address);
+
+	/// 
+	/// Split list of backends "address[:port],[ipv6]:port,..." to pairs of address and port
+	/// 
+	/// @param remote_addresses list of backends
+	/// @param default_remote_port port of backends, for which it isn't specified
+	/// 
+	/// @return vector of pairs: address, port
+	///
+	static std::vector<std::pair<std::string, unsigned int> > parse_backends(const std::string& remote_addresses, 
+																			 const unsigned int default_remote_port);
+
+private:
+	/// Create set of backends from the list, reusing existing backends with the same name
+	std::unique_ptr<T_backend_set> make_set(const std::string& remote_addresses, const unsigned int default_remote_port);
+
+	/// Index of the first healthy backend from i in turn, or i if all of them aren't healthy
+	static size_t first_healthy(const T_backend_set& set, const size_t i);
+
+	/// Random number, xorshift generator of current thread
+	static uint32_t random();
+
+	/// Hash of string (FNV-1a)
+	static uint32_t hash(const std::string& str);
+
+	ba::io_service& io_service_;            ///< io_service, in which resolvers of backends work
+	const unsigned int refresh_seconds_;    ///< period of re-resolve of backends addresses
+	const T_balance_policy policy_;         ///< policy of selection of backend
+	std::vector<std::unique_ptr<T_backend> > backends_;     ///< all backends: current and removed by reload
+	std::vector<std::unique_ptr<T_backend_set> > sets_;     ///< all sets of backends: current and replaced by reload
+	std::atomic<const T_backend_set*> current_;             ///< current set of backends
+	std::atomic<size_t> next_backend_;      ///< index of next backend for round robin
+	ba::io_service *upstream_io_service_;   ///< io_service, in which timers of pools of pre-established connections work
+	T_executors *upstream_executors_;       ///< executors, for which pools of pre-established connections are created, or NULL
+	size_t upstream_target_size_;           ///< size of pools of pre-established connections of new backends
+	unsigned int upstream_max_idle_seconds_;///< max time of idle pre-established socket of new backends, 0 - unlimited
+	const T_socket_options *upstream_socket_options_;   ///< options of pre-established sockets of new backends
+};
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // BACKEND_POOL_HPP
@@ -0,0 +1,109 @@
+/**
+ * @file   bandwidth.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Bandwidth shaping: token buckets of connection, of client IP and of port mapping
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "bandwidth.hpp"
+#include "pacer.hpp"
+#include "backend_pool.hpp"
+// ----------------------------------------------------------------------------
+
+/// Shaper, which doesn't limit anything
+T_shaper::T_shaper()
+	: bandwidth_(NULL), client_ip_buckets_(NULL)
+{
+	for(size_t i = 0; i < directions; ++i) arrival_time_us_[i] = resume_at_us_[i] = 0;
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Charge bytes, which have been read, to all buckets of direction
+///
+/// @param direction direction of relay
+/// @param bytes number of bytes
+///
+void T_shaper::charge(const T_direction direction, const uint64_t bytes) {
+	const int64_t now = T_pacer::now_us();
+	int64_t resume_at_us = 0;
+	const T_bandwidth::T_rate& connection_rate = bandwidth_->connection_rate_;
+	if(connection_rate.rate_ != 0) {
+		int64_t& arrival_time = arrival_time_us_[direction];
+		arrival_time = ((arrival_time > now) ? arrival_time : now) + connection_rate.cost_us(bytes);
+		resume_at_us = arrival_time - connection_rate.tolerance_us_;
+	}
+	if(client_ip_buckets_ != NULL) {
+		const int64_t client_ip_resume = T_bandwidth::charge(client_ip_buckets_[direction], bandwidth_->client_ip_rate_, bytes, now);
+		if(client_ip_resume > resume_at_us) resume_at_us = client_ip_resume;
+	}
+	if(bandwidth_->mapping_rate_.rate_ != 0) {
+		const int64_t mapping_resume = T_bandwidth::charge(bandwidth_->mapping_buckets_[direction], bandwidth_->mapping_rate_, bytes, now);
+		if(mapping_resume > resume_at_us) resume_at_us = mapping_resume;
+	}
+	resume_at_us_[direction] = (resume_at_us > now) ? resume_at_us : 0;
+}
+// ----------------------------------------------------------------------------
+
+/// Bucket of one rate: cost of bytes and allowed burst
+T_bandwidth::T_rate::T_rate(const uint64_t rate, const uint64_t burst_bytes)
+	: rate_(rate), tolerance_us_((rate != 0) ? static_cast<int64_t>(burst_bytes * 1000000 / rate) : 0)
+{}
+// ----------------------------------------------------------------------------
+
+///
+/// Create buckets
+///
+/// @param limits limits of port mapping
+///
+T_bandwidth::T_bandwidth(const T_bandwidth_limits& limits)
+	: limits_(limits), connection_rate_(limits.connection_rate_, limits.burst_bytes_),
+	  client_ip_rate_(limits.client_ip_rate_, limits.burst_bytes_), mapping_rate_(limits.mapping_rate_, limits.burst_bytes_)
+{
+	for(auto &i : mapping_buckets_) i.store(0, std::memory_order_relaxed);
+	if(limits_.client_ip_rate_ != 0) {
+		client_ip_buckets_.reset(new std::atomic<int64_t>[ip_slots * T_shaper::directions]);
+		for(size_t i = 0; i < ip_slots * T_shaper::directions; ++i) client_ip_buckets_[i].store(0, std::memory_order_relaxed);
+	}
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Shaper for the new connection
+///
+/// @param client_address address of client
+///
+/// @return shaper, which doesn't limit anything, if limits are disabled
+///
+T_shaper T_bandwidth::shaper(const ba::ip::address& client_address) {
+	T_shaper shaper;
+	if(!enabled()) return shaper;
+	shaper.bandwidth_ = this;
+	if(client_ip_buckets_)
+		shaper.client_ip_buckets_ = &client_ip_buckets_[(T_backend_pool::hash(client_address) & (ip_slots - 1)) * T_shaper::directions];
+	return shaper;
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Charge cost of bytes to the shared bucket
+///
+/// @param arrival_time_us theoretical arrival time of bucket
+/// @param rate rate of bucket
+/// @param bytes number of bytes
+/// @param now current time, us
+///
+/// @return time, until which the next read must be deferred
+///
+int64_t T_bandwidth::charge(std::atomic<int64_t>& arrival_time_us, const T_rate& rate, const uint64_t bytes, const int64_t now) {
+	const int64_t cost_us = rate.cost_us(bytes);
+	int64_t arrival_time = arrival_time_us.load(std::memory_order_relaxed);
+	int64_t next_arrival_time;
+	do {
+		next_arrival_time = ((arrival_time > now) ? arrival_time : now) + cost_us;
+	} while(!arrival_time_us.compare_exchange_weak(arrival_time, next_arrival_time, std::memory_order_relaxed, std::memory_order_relaxed));
+	return next_arrival_time - rate.tolerance_us_;
+}
+// ----------------------------------------------------------------------------
@@ -0,0 +1,142 @@
+/**
+ * @file   bandwidth.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Bandwidth shaping: token buckets of connection, of client IP and of port mapping
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef BANDWIDTH_HPP
+#define BANDWIDTH_HPP
+// ----------------------------------------------------------------------------
+#include <boost/noncopyable.hpp>
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+// ----------------------------------------------------------------------------
+#include <atomic>
+#include <memory>
+#include <cstdint>
+// ----------------------------------------------------------------------------
+
+/// Limits of bandwidth of port mapping in bytes per second in each direction, 0 - unlimited
+struct T_bandwidth_limits {
+	T_bandwidth_limits() : connection_rate_(0), client_ip_rate_(0), mapping_rate_(0), burst_bytes_(256 * 1024) {}
+
+	uint64_t connection_rate_;              ///< of each connection
+	uint64_t client_ip_rate_;               ///< of all connections of one client IP
+	uint64_t mapping_rate_;                 ///< of all connections of port mapping
+	uint64_t burst_bytes_;                  ///< bytes, which can be relayed at once above the rate (size of each bucket)
+};
+// ----------------------------------------------------------------------------
+
+class T_bandwidth;
+
+///
+/// Shaping of one connection: its own buckets, bucket of its client IP and buckets of its port mapping.
+/// Bytes are charged after each read, and the next read of this direction is deferred until buckets allow it.
+/// Each direction is used only by its own handlers (one at a time), so buckets of connection aren't atomic.
+///
+class T_shaper {
+public:
+	/// Direction of relay
+	enum T_direction { client_to_server, server_to_client, directions };
+
+	/// Shaper, which doesn't limit anything
+	T_shaper();
+
+	/// Whether any of limits is enabled
+	inline bool enabled() const { return bandwidth_ != NULL; }
+
+	///
+	/// Charge bytes, which have been read, to all buckets of direction
+	///
+	/// @param direction direction of relay
+	/// @param bytes number of bytes
+	///
+	void charge(const T_direction direction, const uint64_t bytes);
+
+	///
+	/// Take time, until which the next read of direction must be deferred
+	///
+	/// @param direction direction of relay
+	///
+	/// @return time of resume (steady clock, us), 0 - read now
+	///
+	inline int64_t take_resume_time(const T_direction direction) {
+		const int64_t resume_at_us = resume_at_us_[direction];
+		resume_at_us_[direction] = 0;
+		return resume_at_us;
+	}
+
+private:
+	friend class T_bandwidth;
+	T_bandwidth *bandwidth_;                ///< limits and shared buckets of port mapping, NULL - unlimited
+	std::atomic<int64_t> *client_ip_buckets_;   ///< buckets of client IP for each direction, NULL - unlimited
+	int64_t arrival_time_us_[directions];   ///< theoretical arrival time of buckets of connection (GCRA)
+	int64_t resume_at_us_[directions];      ///< time, until which the next read is deferred, 0 - isn't deferred
+};
+// ----------------------------------------------------------------------------
+
+///
+/// Bandwidth limits of one port mapping: token buckets as GCRA (theoretical arrival time moves by cost of bytes),
+/// buckets of port mapping and of client IPs are one atomic each, without locks.
+/// Client IPs are counted in the fixed table by hash of address: IPs with the same hash share the limit.
+///
+class T_bandwidth : private boost::noncopyable {
+public:
+	enum { ip_slots = 1 << 14 };            ///< size of table of buckets of client IPs
+
+	///
+	/// Create buckets
+	///
+	/// @param limits limits of port mapping
+	///
+	explicit T_bandwidth(const T_bandwidth_limits& limits);
+
+	/// Whether any of limits is enabled
+	inline bool enabled() const { return limits_.connection_rate_ != 0 || limits_.client_ip_rate_ != 0 || limits_.mapping_rate_ != 0; }
+
+	/// Whether the limit of client IP is enabled (the address of client is needed for shaper())
+	inline bool limits_client_ip() const { return limits_.client_ip_rate_ != 0; }
+
+	/// Limits of port mapping
+	inline const T_bandwidth_limits& limits() const { return limits_; }
+
+	///
+	/// Shaper for the new connection
+	///
+	/// @param client_address address of client
+	///
+	/// @return shaper, which doesn't limit anything, if limits are disabled
+	///
+	T_shaper shaper(const ba::ip::address& client_address);
+
+private:
+	friend class T_shaper;
+
+	/// Bucket of one rate: cost of bytes and allowed burst
+	struct T_rate {
+		explicit T_rate(const uint64_t rate, const uint64_t burst_bytes);
+
+		/// Duration of bytes at this rate, us
+		inline int64_t cost_us(const uint64_t bytes) const { return static_cast<int64_t>(bytes * 1000000 / rate_); }
+
+		uint64_t rate_;                     ///< bytes per second, 0 - unlimited
+		int64_t tolerance_us_;              ///< how far the theoretical arrival time can be ahead of now
+	};
+
+	/// Charge cost to the shared bucket, return time of resume
+	static int64_t charge(std::atomic<int64_t>& arrival_time_us, const T_rate& rate, const uint64_t bytes, const int64_t now);
+
+	const T_bandwidth_limits limits_;       ///< limits of port mapping
+	const T_rate connection_rate_;          ///< rate of each connection
+	const T_rate client_ip_rate_;           ///< rate of each client IP
+	const T_rate mapping_rate_;             ///< rate of port mapping
+	std::atomic<int64_t> mapping_buckets_[T_shaper::directions];    ///< buckets of port mapping for each direction
+	std::unique_ptr<std::atomic<int64_t>[]> client_ip_buckets_;     ///< buckets of client IPs: directions per slot (only if limit is enabled)
+};
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // BANDWIDTH_HPP
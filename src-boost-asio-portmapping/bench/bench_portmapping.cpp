@@ -0,0 +1,511 @@
+/**
+ * @file   bench_portmapping.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Benchmark of port mapping: local echo/sink upstream, T_server in-process and load generator
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "../server.hpp"
+#include "../executors.hpp"
+#include "../config.hpp"
+#include "../log.hpp"
+#include "../handler_allocator.hpp"
+// ----------------------------------------------------------------------------
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/thread.hpp>
+namespace ba = boost::asio;
+namespace bs = boost::system;
+// ----------------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <csignal>
+#include <string>
+#include <vector>
+// ----------------------------------------------------------------------------
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+// ----------------------------------------------------------------------------
+
+typedef std::chrono::steady_clock T_clock;
+
+/// Microseconds since start of measurement
+static inline int64_t elapsed_us(const T_clock::time_point start) {
+	return std::chrono::duration_cast<std::chrono::microseconds>(T_clock::now() - start).count();
+}
+// ----------------------------------------------------------------------------
+
+/// Resident memory of process, bytes
+static size_t resident_bytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.WorkingSetSize;
+#else
+	std::ifstream statm("/proc/self/statm");
+	size_t total_pages = 0, resident_pages = 0;
+	statm >> total_pages >> resident_pages;
+	return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Raise limit of opened files to the hard limit
+///
+/// @return limit of opened files
+///
+static size_t raise_files_limit() {
+#ifndef _WIN32
+	struct rlimit limit;
+	if(getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+		if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) return static_cast<size_t>(limit.rlim_cur);
+	}
+#endif
+	return static_cast<size_t>(-1);
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Upstream server: echo - returns all data, sink - discards data and on EOF returns 8 bytes with their count.
+/// Session waits for readiness without buffer and reads into the buffer of the thread, so idle sessions
+/// take little memory and don't distort measurement of memory of the port mapping.
+///
+class T_upstream : private boost::noncopyable {
+public:
+	enum T_mode { echo, sink };
+
+	///
+	/// Start listener on free port of 127.0.0.1
+	///
+	/// @param mode echo or sink
+	/// @param thread_num number of threads
+	///
+	T_upstream(const T_mode mode, const unsigned int thread_num)
+		: mode_(mode), acceptor_(io_service_, ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), 0))
+	{
+		start_accept();
+		for(unsigned int i = 0; i < thread_num; ++i)
+			threads_.emplace_back(boost::bind(&ba::io_service::run, &io_service_));
+	}
+
+	~T_upstream() {
+		io_service_.stop();
+		for(auto &i : threads_) i.join();
+	}
+
+	/// Port of listener
+	inline unsigned short port() const { return acceptor_.local_endpoint().port(); }
+
+private:
+	struct T_session {
+		explicit T_session(ba::io_service& io_service) : socket_(io_service), bytes_(0) {}
+		ba::ip::tcp::socket socket_;
+		uint64_t bytes_;
+	};
+	typedef boost::shared_ptr<T_session> T_session_ptr;
+
+	void start_accept() {
+		const T_session_ptr session = boost::make_shared<T_session>(boost::ref(io_service_));
+		acceptor_.async_accept(session->socket_, boost::bind(&T_upstream::handle_accept, this, session, ba::placeholders::error));
+	}
+
+	void handle_accept(const T_session_ptr session, const bs::error_code& err) {
+		if(err == ba::error::operation_aborted) return;
+		if(!err) {
+			session->socket_.set_option(ba::ip::tcp::no_delay(true));
+			start_wait(session);
+		}
+		start_accept();
+	}
+
+	void start_wait(const T_session_ptr& session) {
+		session->socket_.async_read_some(ba::null_buffers(), boost::bind(&T_upstream::handle_ready, this, session, ba::placeholders::error));
+	}
+
+	void handle_ready(const T_session_ptr session, const bs::error_code& err) {
+		if(err) return;
+		static thread_local char buffer[65536];
+		bs::error_code ec;
+		const size_t len = session->socket_.read_some(ba::buffer(buffer), ec);
+		if(ec == ba::error::would_block) { start_wait(session); return; }
+		if(ec == ba::error::eof && mode_ == sink) {
+			const uint64_t bytes = session->bytes_;
+			ba::write(session->socket_, ba::buffer(&bytes, sizeof(bytes)), ec);
+		}
+		if(ec) { session->socket_.close(ec); return; }
+		session->bytes_ += len;
+		if(mode_ == echo) ba::write(session->socket_, ba::buffer(buffer, len), ec);
+		if(ec) { session->socket_.close(ec); return; }
+		start_wait(session);
+	}
+
+	const T_mode mode_;
+	ba::io_service io_service_;
+	ba::ip::tcp::acceptor acceptor_;
+	std::vector<boost::thread> threads_;
+};
+// ----------------------------------------------------------------------------
+
+///
+/// Port mapping in-process: listener on free port of 127.0.0.1 -> upstream
+///
+class T_portmapping : private boost::noncopyable {
+public:
+	///
+	/// @param upstream_port port of upstream on 127.0.0.1
+	/// @param local_port port to listen on
+	/// @param thread_num_executors number of threads for executors
+	/// @param relay_mode buffered, splice or uring
+	/// @param sharded mode of executors
+	/// @param busy_poll_us busy poll of executors, microseconds, 0 - disabled
+	///
+	T_portmapping(const unsigned short upstream_port, const unsigned short local_port,
+				  const unsigned int thread_num_executors, const T_relay_mode relay_mode, const bool sharded, const unsigned int busy_poll_us)
+		: overload_guard_(1000000, 0, 90), connection_slabs_(), 
+		  executors_(thread_num_executors, sharded, (relay_mode == relay_uring) ? uring_buffers : 0, std::vector<unsigned int>(), busy_poll_us)
+	{
+		connection_slabs_.reset(new T_connection_slabs(executors_, 128, 1000000));
+		T_mapping_config mapping;
+		mapping.name_ = "bench";
+		mapping.remote_address_ = "127.0.0.1";
+		mapping.remote_port_ = upstream_port;
+		mapping.local_interface_address_ = "127.0.0.1";
+		mapping.local_port_ = local_port;
+		mapping.relay_mode_ = relay_mode;
+		mapping.dns_refresh_seconds_ = 0;
+		server_.reset(new T_server(io_service_acceptors_, executors_, *connection_slabs_, overload_guard_, 
+											   thread_num_acceptors, mapping));
+		for(unsigned int i = 0; i < thread_num_acceptors; ++i)
+			threads_.emplace_back(boost::bind(&ba::io_service::run, &io_service_acceptors_));
+	}
+
+	~T_portmapping() {
+		// connections closed by the load generator are finished by the port mapping asynchronously
+		const T_clock::time_point start = T_clock::now();
+		while(active_connections() != 0 && elapsed_us(start) < max_close_wait_us)
+			boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+		io_service_acceptors_.stop();
+		executors_.stop();
+		for(auto &i : threads_) i.join();
+	}
+
+	/// Connections, which are connecting or relaying
+	uint64_t active_connections() const {
+		const T_metrics::T_snapshot snapshot = server_->metrics().snapshot();
+		return snapshot.counters_[T_metrics::connections_opened] - snapshot.counters_[T_metrics::connections_closed];
+	}
+
+private:
+	enum { thread_num_acceptors = 2 };
+	enum { uring_buffers = 1024 };
+	enum { max_close_wait_us = 5000000 };
+
+	// order of destruction: not run handlers of acceptors, then of executors, and only then memory of connections held by them
+	T_overload_guard overload_guard_;
+	std::unique_ptr<T_connection_slabs> connection_slabs_;
+	T_executors executors_;
+	ba::io_service io_service_acceptors_;
+	std::unique_ptr<T_server> server_;
+	std::vector<boost::thread> threads_;
+};
+// ----------------------------------------------------------------------------
+
+/// Settings of benchmark
+struct T_bench_config {
+	std::string scenario_;                  ///< all, rate, throughput, latency, idle
+	size_t idle_connections_;               ///< number of idle connections for measurement of memory
+	size_t files_limit_;                    ///< limit of opened files: each idle connection takes 4 sockets in this process
+	unsigned int client_threads_;           ///< threads of load generator
+	unsigned int seconds_;                  ///< duration of each measurement
+	T_relay_mode relay_mode_;               ///< relay engine of port mapping
+	bool sharded_;                          ///< executors mode of port mapping
+	unsigned int thread_num_executors_;     ///< threads of executors of port mapping
+	unsigned int busy_poll_us_;             ///< busy poll of executors, microseconds, 0 - disabled
+};
+// ----------------------------------------------------------------------------
+
+/// Connect to 127.0.0.1:port without Nagle delay
+static void connect_to(ba::ip::tcp::socket& socket, const unsigned short port) {
+	socket.connect(ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), port));
+	socket.set_option(ba::ip::tcp::no_delay(true));
+}
+// ----------------------------------------------------------------------------
+
+/// Close socket by RST: no TIME_WAIT on ports of load generator
+static void abort_close(ba::ip::tcp::socket& socket) {
+	bs::error_code ec;
+	socket.set_option(ba::socket_base::linger(true, 0), ec);
+	socket.close(ec);
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Connections per second: connect, exchange 1 byte with echo upstream, close
+///
+/// @param config settings of benchmark
+/// @param port port of port mapping
+///
+static void bench_rate(const T_bench_config& config, const unsigned short port) {
+	std::atomic<uint64_t> connections(0), errors(0);
+	std::atomic<bool> stop(false);
+	ba::io_service io_service;
+	std::vector<boost::thread> threads;
+	const T_clock::time_point start = T_clock::now();
+	for(unsigned int t = 0; t < config.client_threads_; ++t)
+		threads.emplace_back([&]() {
+			char byte = 'x';
+			while(!stop.load(std::memory_order_relaxed)) {
+				ba::ip::tcp::socket socket(io_service);
+				bs::error_code ec;
+				try {
+					connect_to(socket, port);
+					ba::write(socket, ba::buffer(&byte, 1));
+					ba::read(socket, ba::buffer(&byte, 1));
+					connections.fetch_add(1, std::memory_order_relaxed);
+				} catch(const bs::system_error&) {
+					errors.fetch_add(1, std::memory_order_relaxed);
+				}
+				abort_close(socket);
+			}
+		});
+	boost::this_thread::sleep(boost::posix_time::seconds(config.seconds_));
+	stop.store(true);
+	for(auto &i : threads) i.join();
+	const double seconds = elapsed_us(start) / 1e6;
+	std::cout << "rate: " << static_cast<uint64_t>(connections / seconds) << " connections/sec (" <<
+		connections << " in " << seconds << " sec, errors " << errors << ")" << std::endl;
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Throughput for each size of connection: connect, write data to sink upstream, half-close, read count of bytes
+///
+/// @param config settings of benchmark
+/// @param port port of port mapping
+///
+static void bench_throughput(const T_bench_config& config, const unsigned short port) {
+	const size_t sizes[] = { 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024 };
+	for(auto &size : sizes) {
+		std::atomic<uint64_t> connections(0), bytes(0), errors(0);
+		std::atomic<bool> stop(false);
+		ba::io_service io_service;
+		std::vector<boost::thread> threads;
+		const T_clock::time_point start = T_clock::now();
+		for(unsigned int t = 0; t < config.client_threads_; ++t)
+			threads.emplace_back([&]() {
+				const std::vector<char> data(std::min<size_t>(size, 256 * 1024), 'x');
+				while(!stop.load(std::memory_order_relaxed)) {
+					ba::ip::tcp::socket socket(io_service);
+					try {
+						connect_to(socket, port);
+						for(size_t sent = 0; sent < size; sent += data.size())
+							ba::write(socket, ba::buffer(data, size - sent));
+						socket.shutdown(ba::socket_base::shutdown_send);
+						uint64_t received = 0;
+						ba::read(socket, ba::buffer(&received, sizeof(received)));
+						if(received != size) throw bs::system_error(ba::error::message_size);
+						connections.fetch_add(1, std::memory_order_relaxed);
+						bytes.fetch_add(size, std::memory_order_relaxed);
+					} catch(const bs::system_error&) {
+						errors.fetch_add(1, std::memory_order_relaxed);
+					}
+					abort_close(socket);
+				}
+			});
+		boost::this_thread::sleep(boost::posix_time::seconds(config.seconds_));
+		stop.store(true);
+		for(auto &i : threads) i.join();
+		const double seconds = elapsed_us(start) / 1e6;
+		std::cout << "throughput " << std::setw(8) << size << " bytes/connection: " << std::fixed << std::setprecision(1) <<
+			(bytes / seconds / (1024 * 1024)) << " MB/sec, " << static_cast<uint64_t>(connections / seconds) <<
+			" connections/sec (errors " << errors << ")" << std::endl;
+		std::cout.unsetf(std::ios_base::floatfield);
+	}
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Round-trip latency of 64-byte messages: each thread has one connection and sends next message after reply
+///
+/// @param config settings of benchmark
+/// @param port port of port mapping or of upstream directly
+/// @param title name of measurement
+///
+static void bench_latency(const T_bench_config& config, const unsigned short port, const std::string& title) {
+	std::vector<std::vector<uint32_t> > latencies(config.client_threads_);
+	std::atomic<bool> stop(false);
+	ba::io_service io_service;
+	std::vector<boost::thread> threads;
+	for(unsigned int t = 0; t < config.client_threads_; ++t)
+		threads.emplace_back([&, t]() {
+			std::vector<uint32_t>& thread_latencies = latencies[t];
+			thread_latencies.reserve(1 << 20);
+			char message[64] = {};
+			ba::ip::tcp::socket socket(io_service);
+			try {
+				connect_to(socket, port);
+				while(!stop.load(std::memory_order_relaxed)) {
+					const T_clock::time_point start = T_clock::now();
+					ba::write(socket, ba::buffer(message));
+					ba::read(socket, ba::buffer(message));
+					thread_latencies.push_back(static_cast<uint32_t>(elapsed_us(start)));
+				}
+			} catch(const bs::system_error& e) {
+				std::cerr << title << ": " << e.what() << std::endl;
+			}
+			abort_close(socket);
+		});
+	boost::this_thread::sleep(boost::posix_time::seconds(config.seconds_));
+	stop.store(true);
+	for(auto &i : threads) i.join();
+
+	std::vector<uint32_t> all;
+	for(auto &i : latencies) all.insert(all.end(), i.begin(), i.end());
+	if(all.empty()) return;
+	std::sort(all.begin(), all.end());
+	const auto percentile = [&](const double p) { return all[std::min(all.size() - 1, static_cast<size_t>(all.size() * p))]; };
+	std::cout << title << ": p50 " << percentile(0.5) << " us, p99 " << percentile(0.99) << " us, p999 " << percentile(0.999) <<
+		" us, max " << all.back() << " us (" << all.size() << " round-trips)" << std::endl;
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Memory of idle connections: open connections, exchange 1 byte in each and hold them
+///
+/// @param config settings of benchmark
+/// @param port port of port mapping
+///
+static void bench_idle(const T_bench_config& config, const unsigned short port) {
+	enum { sockets_per_connection = 4, reserved_files = 64 };
+	size_t idle_connections = config.idle_connections_;
+	if(config.files_limit_ < reserved_files + idle_connections * sockets_per_connection) {
+		idle_connections = (config.files_limit_ > reserved_files) ? (config.files_limit_ - reserved_files) / sockets_per_connection : 0;
+		std::cout << "idle: limit of opened files " << config.files_limit_ << " allows only " << idle_connections << " connections" << std::endl;
+	}
+	ba::io_service io_service;
+	std::vector<std::unique_ptr<ba::ip::tcp::socket> > sockets;
+	sockets.reserve(idle_connections);
+	const size_t rss_before = resident_bytes();
+	char byte = 'x';
+	try {
+		for(size_t i = 0; i < idle_connections; ++i) {
+			sockets.emplace_back(new ba::ip::tcp::socket(io_service));
+			connect_to(*sockets.back(), port);
+			ba::write(*sockets.back(), ba::buffer(&byte, 1));
+			ba::read(*sockets.back(), ba::buffer(&byte, 1));
+		}
+	} catch(const bs::system_error& e) {
+		std::cerr << "idle: " << e.what() << " after " << sockets.size() << " connections" << std::endl;
+		sockets.pop_back();
+	}
+	boost::this_thread::sleep(boost::posix_time::milliseconds(500));	// buffers are returned to the pools
+	const size_t rss_after = resident_bytes();
+	const double per_10k = sockets.empty() ? 0 :
+		(static_cast<double>(rss_after) - static_cast<double>(rss_before)) / sockets.size() * 10000 / (1024 * 1024);
+	std::cout << "idle: " << sockets.size() << " connections, RSS " << (rss_before / 1024) << " KB -> " << (rss_after / 1024) <<
+		" KB, " << std::fixed << std::setprecision(2) << per_10k << " MB per 10k idle connections" << std::endl;
+	std::cout.unsetf(std::ios_base::floatfield);
+	for(auto &i : sockets) abort_close(*i);
+}
+// ----------------------------------------------------------------------------
+
+/// Free port on 127.0.0.1 for listener of port mapping
+static unsigned short free_port() {
+	ba::io_service io_service;
+	ba::ip::tcp::acceptor acceptor(io_service, ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), 0));
+	return acceptor.local_endpoint().port();
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Main routine
+///
+/// @param argc number of arguments
+/// @param argv pointers to arguments
+///
+/// @return error code
+///
+int main(int argc, char** argv) {
+	try {
+		T_bench_config config;
+		config.scenario_ = "all";
+		config.idle_connections_ = 10000;
+		config.client_threads_ = 4;
+		config.seconds_ = 3;
+		config.relay_mode_ = relay_buffered;
+		config.sharded_ = false;
+		config.thread_num_executors_ = boost::thread::hardware_concurrency();
+		config.busy_poll_us_ = 0;
+
+		std::cout << "Usage: bench_portmapping [scenario(all|rate|throughput|latency|idle) idle_connections client_threads seconds relay_mode(buffered|splice|uring) executors_mode(shared|sharded) number_executors busy_poll_us]" << std::endl;
+		std::cout << "(Default: bench_portmapping " << config.scenario_ << " " << config.idle_connections_ << " " << config.client_threads_ << " " <<
+			config.seconds_ << " buffered shared " << config.thread_num_executors_ << " " << config.busy_poll_us_ << ")" << std::endl << std::endl;
+
+		if(argc >= 2) config.scenario_ = argv[1];
+		if(argc >= 3) config.idle_connections_ = boost::lexical_cast<size_t>(argv[2]);
+		if(argc >= 4) config.client_threads_ = boost::lexical_cast<unsigned int>(argv[3]);
+		if(argc >= 5) config.seconds_ = boost::lexical_cast<unsigned int>(argv[4]);
+		if(argc >= 6) config.relay_mode_ = T_config::parse_relay_mode(argv[5]);
+		if(argc >= 7) config.sharded_ = (std::string(argv[6]) == "sharded");
+		if(argc >= 8) config.thread_num_executors_ = boost::lexical_cast<unsigned int>(argv[7]);
+		if(argc >= 9) config.busy_poll_us_ = boost::lexical_cast<unsigned int>(argv[8]);
+
+		T_log::instance().set_level(log_warning);
+#ifdef SIGPIPE
+		std::signal(SIGPIPE, SIG_IGN);
+#endif
+		config.files_limit_ = raise_files_limit();
+		const bool all = (config.scenario_ == "all");
+
+		// echo upstream: rate, latency, idle
+		{
+			T_upstream upstream(T_upstream::echo, 2);
+			const unsigned short port = free_port();
+			T_portmapping portmapping(upstream.port(), port, config.thread_num_executors_, config.relay_mode_, config.sharded_,
+										 config.busy_poll_us_);
+			if(all || config.scenario_ == "rate") bench_rate(config, port);
+			if(all || config.scenario_ == "latency") {
+				bench_latency(config, upstream.port(), "latency direct ");
+				bench_latency(config, port, "latency through");
+			}
+			if(all || config.scenario_ == "idle") bench_idle(config, port);
+		}
+
+		// sink upstream: throughput
+		if(all || config.scenario_ == "throughput") {
+			T_upstream upstream(T_upstream::sink, 2);
+			const unsigned short port = free_port();
+			T_portmapping portmapping(upstream.port(), port, config.thread_num_executors_, config.relay_mode_, config.sharded_,
+										 config.busy_poll_us_);
+			bench_throughput(config, port);
+		}
+
+		// relay path must not allocate handlers from the heap: only the first accepts/connects of threads warm caches
+		std::cout << "handlers out of arenas: " << T_handler_overflow::cache_allocations() << " from caches of threads, " <<
+			T_handler_overflow::heap_allocations() << " from heap" << std::endl;
+	} catch (std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
+// ----------------------------------------------------------------------------
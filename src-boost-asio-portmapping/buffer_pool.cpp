@@ -0,0 +1,174 @@
+/**
+ * @file   buffer_pool.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Shared pool of size-classed buffers with per-thread caches.
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "buffer_pool.hpp"
+#include "cpu_topology.hpp"
+
+#include <boost/thread/locks.hpp>
+
+#include <algorithm>
+// ----------------------------------------------------------------------------
+
+/// The pool shared by all connections of process
+T_buffer_pool& T_buffer_pool::instance() {
+	static T_buffer_pool pool;
+	return pool;
+}
+// ----------------------------------------------------------------------------
+
+T_buffer_pool::T_buffer_pool() 
+	: node_page_size_((T_cpu_topology::instance().nodes() > 1) ? node_page_size() : 0),
+	  allocated_bytes_(0), free_bytes_(0), max_free_bytes_(64 * 1024 * 1024)
+{
+}
+
+T_buffer_pool::~T_buffer_pool() {
+	for(auto &node : free_lists_)
+		for(size_t size_class = 0; size_class < size_classes; ++size_class) {
+			T_free_list& free_list = node[size_class];
+			for(char *buffer : free_list.buffers_) deallocate(buffer, size_class);
+			if(free_list.chunk_buffers_ != 0) 
+				deallocate_on_node(free_list.chunk_, free_list.chunk_buffers_ * buffer_size(size_class), 0);
+		}
+}
+// ----------------------------------------------------------------------------
+
+T_buffer_pool::T_thread_cache::T_thread_cache() 
+	: node_(0), memory_node_(0)
+{
+	for(auto &i : count_) i = 0;
+	// thread, which isn't pinned, uses the node, on which it runs at first use of the pool
+	memory_node_ = static_cast<int>(T_cpu_topology::instance().current_node());
+	node_ = static_cast<size_t>(memory_node_) % max_nodes;
+}
+
+/// Return all buffers of the thread to the global free lists, when thread exits
+T_buffer_pool::T_thread_cache::~T_thread_cache() {
+	for(size_t size_class = 0; size_class < size_classes; ++size_class)
+		T_buffer_pool::instance().flush(*this, size_class, count_[size_class]);
+}
+
+/// Cache of buffers of current thread
+T_buffer_pool::T_thread_cache& T_buffer_pool::thread_cache() {
+	static thread_local T_thread_cache cache;
+	return cache;
+}
+
+/// Set NUMA node of current thread (pinned to its CPU), free lists and memory of which it uses
+void T_buffer_pool::set_thread_node(const unsigned int node) {
+	T_thread_cache& cache = thread_cache();
+	cache.node_ = node % max_nodes;
+	cache.memory_node_ = static_cast<int>(node);
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Take buffer from the cache of current thread, from global free list, or allocate new one
+/// 
+/// @param size_class size class of buffer
+/// 
+/// @return pointer to buffer of size buffer_size(size_class)
+///
+char* T_buffer_pool::acquire(const size_t size_class) {
+	T_thread_cache& cache = thread_cache();
+	size_t& count = cache.count_[size_class];
+	if(count == 0) {
+		// refill half of the cache from the global free list by one lock
+		T_free_list& free_list = free_lists_[cache.node_][size_class];
+		boost::lock_guard<boost::mutex> lock(free_list.mutex_);
+		while(count < thread_cache_buffers / 2 && !free_list.buffers_.empty()) {
+			cache.buffers_[size_class][count++] = free_list.buffers_.back();
+			free_list.buffers_.pop_back();
+		}
+		free_bytes_.fetch_sub(count * buffer_size(size_class), std::memory_order_relaxed);
+		if(count == 0 && on_nodes(size_class)) carve(cache, free_list, size_class);
+	}
+	if(count != 0) return cache.buffers_[size_class][--count];
+
+	allocated_bytes_.fetch_add(buffer_size(size_class), std::memory_order_relaxed);
+	return new char[buffer_size(size_class)];
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Carve half of the cache of thread from chunks of its NUMA node, mutex of free list must be locked.
+/// Pages of chunk aren't touched here: they are placed on the node at first write.
+/// 
+/// @param cache empty cache of thread
+/// @param free_list free list of node of thread, which keeps the rest of the current chunk
+/// @param size_class size class of buffers
+///
+void T_buffer_pool::carve(T_thread_cache& cache, T_free_list& free_list, const size_t size_class) {
+	const size_t size = buffer_size(size_class);
+	size_t& count = cache.count_[size_class];
+	while(count < thread_cache_buffers / 2) {
+		if(free_list.chunk_buffers_ == 0) {
+			const size_t chunk_size = (std::max)(size_t(chunk_bytes), size);
+			free_list.chunk_ = static_cast<char*>(allocate_on_node(chunk_size, cache.memory_node_));
+			free_list.chunk_buffers_ = chunk_size / size;
+		}
+		cache.buffers_[size_class][count++] = free_list.chunk_;
+		free_list.chunk_ += size;
+		--free_list.chunk_buffers_;
+	}
+	allocated_bytes_.fetch_add(count * size, std::memory_order_relaxed);
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Free one buffer: unmap its pages (buffer of chunk of node), or return it to the heap
+/// 
+/// @param buffer pointer returned by acquire()
+/// @param size_class size class of buffer
+///
+void T_buffer_pool::deallocate(char *const buffer, const size_t size_class) {
+	if(on_nodes(size_class)) deallocate_on_node(buffer, buffer_size(size_class), 0);	// any node: pages are unmapped
+	else delete [] buffer;
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Return buffer to the cache of current thread
+/// 
+/// @param buffer pointer returned by acquire()
+/// @param size_class size class of buffer
+///
+void T_buffer_pool::release(char *const buffer, const size_t size_class) {
+	T_thread_cache& cache = thread_cache();
+	// if the cache is full, then move half of it to the global free list by one lock
+	if(cache.count_[size_class] == thread_cache_buffers) 
+		flush(cache, size_class, thread_cache_buffers / 2);
+	cache.buffers_[size_class][cache.count_[size_class]++] = buffer;
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Move buffers from the cache of thread to the global free list, or free them if the limit is reached
+/// 
+/// @param cache cache of thread
+/// @param size_class size class of buffers
+/// @param count number of buffers from the top of the cache
+///
+void T_buffer_pool::flush(T_thread_cache& cache, const size_t size_class, const size_t count) {
+	const size_t size = buffer_size(size_class);
+	size_t& cache_count = cache.count_[size_class];
+	T_free_list& free_list = free_lists_[cache.node_][size_class];
+	boost::lock_guard<boost::mutex> lock(free_list.mutex_);
+	for(size_t i = 0; i < count; ++i) {
+		char *const buffer = cache.buffers_[size_class][--cache_count];
+		if(free_bytes_.load(std::memory_order_relaxed) + size <= max_free_bytes_) {
+			free_list.buffers_.push_back(buffer);
+			free_bytes_.fetch_add(size, std::memory_order_relaxed);
+		} else {
+			deallocate(buffer, size_class);
+			allocated_bytes_.fetch_sub(size, std::memory_order_relaxed);
+		}
+	}
+}
+// ----------------------------------------------------------------------------
@@ -0,0 +1,135 @@
+/**
+ * @file   buffer_pool.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Shared pool of size-classed buffers with per-thread caches.
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+// ----------------------------------------------------------------------------
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+// ----------------------------------------------------------------------------
+#include <atomic>
+#include <vector>
+#include <cstddef>
+// ----------------------------------------------------------------------------
+
+///
+/// Pool of buffers for input/output data, shared by all connections.
+/// Connection takes buffer only when data are ready for read, and returns it after write,
+/// so idle connections don't hold any memory for data.
+/// 
+/// Buffers have size classes: 1 KB, 4 KB, 16 KB, 64 KB. 
+/// Each thread has own cache of buffers for each class, without locks,
+/// and exchanges by batches with the global free lists protected by mutex.
+/// Global free lists are kept per NUMA node of thread, so a buffer freed on one node isn't reused on another.
+/// On NUMA machines buffers (of size classes, which are multiple of page) are carved from chunks, 
+/// which are placed on the node of thread, and each buffer is freed separately (its pages are unmapped).
+/// Global free lists are limited by max_free_bytes, and surplus buffers are returned to the OS or the heap.
+///
+class T_buffer_pool : private boost::noncopyable {
+public:
+	enum { size_classes = 4 };              ///< number of size classes
+	enum { min_buffer_size = 1024 };        ///< size of buffer of the smallest class, each next class is 4 times bigger
+	enum { thread_cache_buffers = 16 };     ///< max buffers of each class in the cache of one thread
+	enum { max_nodes = 8 };                 ///< NUMA nodes with own free lists, bigger nodes share them (modulo)
+	enum { chunk_bytes = 1024 * 1024 };     ///< size of chunk of memory of NUMA node, from which buffers are carved
+
+	/// Size of buffer of the size class
+	static inline size_t buffer_size(const size_t size_class) { return size_t(min_buffer_size) << (2 * size_class); }
+
+	/// 
+	/// Adapt size class to the length of data, that have been read in the buffer of this class:
+	/// grow for bulk streams (buffer was filled completely), shrink for chatty ones (data fit in half of smaller buffer)
+	/// 
+	/// @param size_class current size class
+	/// @param len length of data in bytes, that have been read
+	/// 
+	/// @return size class for next read
+	///
+	static inline size_t adapt_size_class(const size_t size_class, const size_t len) {
+		if(len == buffer_size(size_class) && size_class + 1 < size_classes) return size_class + 1;
+		if(size_class > 0 && len <= buffer_size(size_class - 1) / 2) return size_class - 1;
+		return size_class;
+	}
+
+	/// The pool shared by all connections of process
+	static T_buffer_pool& instance();
+
+	/// 
+	/// Take buffer from the cache of current thread, from global free list, or allocate new one
+	/// 
+	/// @param size_class size class of buffer
+	/// 
+	/// @return pointer to buffer of size buffer_size(size_class)
+	///
+	char* acquire(const size_t size_class);
+
+	/// 
+	/// Return buffer to the cache of current thread
+	/// 
+	/// @param buffer pointer returned by acquire()
+	/// @param size_class size class of buffer
+	///
+	void release(char *const buffer, const size_t size_class);
+
+	/// Set NUMA node of current thread (pinned to its CPU), free lists and memory of which it uses
+	static void set_thread_node(const unsigned int node);
+
+	/// Set limit of bytes in free buffers in global free lists, surplus buffers are returned to the heap
+	inline void set_max_free_bytes(const size_t max_free_bytes) { max_free_bytes_ = max_free_bytes; }
+
+	/// Bytes allocated for all buffers (in use and free)
+	inline size_t allocated_bytes() const { return allocated_bytes_.load(std::memory_order_relaxed); }
+
+private:
+	T_buffer_pool();
+	~T_buffer_pool();
+
+	/// Cache of buffers of one thread
+	struct T_thread_cache {
+		T_thread_cache();
+		~T_thread_cache();
+		char *buffers_[size_classes][thread_cache_buffers];
+		size_t count_[size_classes];
+		size_t node_;                       ///< index of free lists of NUMA node of thread
+		int memory_node_;                   ///< NUMA node of thread, on which new chunks are placed
+	};
+	/// Cache of buffers of current thread
+	static T_thread_cache& thread_cache();
+
+	/// Global free list of buffers of one size class
+	struct T_free_list {
+		T_free_list() : chunk_(NULL), chunk_buffers_(0) {}
+		boost::mutex mutex_;
+		std::vector<char*> buffers_;
+		char *chunk_;                       ///< the rest of the current chunk of memory of node, which isn't carved yet
+		size_t chunk_buffers_;              ///< number of buffers in the rest of chunk_
+	};
+
+	/// Whether buffers of the size class are carved from chunks of NUMA nodes (else they are from the heap)
+	inline bool on_nodes(const size_t size_class) const { return node_page_size_ != 0 && buffer_size(size_class) % node_page_size_ == 0; }
+
+	/// Carve buffers from chunks of node to the empty cache of thread, mutex of free list must be locked
+	void carve(T_thread_cache& cache, T_free_list& free_list, const size_t size_class);
+
+	/// Free one buffer: unmap its pages, or return it to the heap
+	void deallocate(char *const buffer, const size_t size_class);
+
+	/// Move up to count buffers from the cache of thread to the global free list, or free them if the limit is reached
+	void flush(T_thread_cache& cache, const size_t size_class, const size_t count);
+
+	T_free_list free_lists_[max_nodes][size_classes];   ///< global free lists of each NUMA node for each size class
+	size_t node_page_size_;                 ///< size of page of chunks of nodes, 0 - buffers are from the heap (without NUMA)
+	std::atomic<size_t> allocated_bytes_;   ///< bytes allocated for buffers
+	std::atomic<size_t> free_bytes_;        ///< bytes in global free lists
+	size_t max_free_bytes_;                 ///< limit of bytes in global free lists
+};
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // BUFFER_POOL_HPP
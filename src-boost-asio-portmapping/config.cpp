@@ -0,0 +1,272 @@
+/**
+ * @file   config.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Settings of process and of port mappings: from command line or from config file
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "config.hpp"
+#include "cpu_topology.hpp"
+
+#include <boost/lexical_cast.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/ini_parser.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
+// ----------------------------------------------------------------------------
+
+/// Default settings of port mapping
+T_mapping_config::T_mapping_config()
+	: remote_port_(80), remote_address_("google.com"),
+	  local_port_(10001), local_interface_address_("0.0.0.0"), protocol_(protocol_tcp),
+	  relay_mode_(relay_buffered), dns_refresh_seconds_(30), balance_policy_(balance_round_robin),
+	  upstream_prewarm_(0), upstream_max_idle_seconds_(0), listen_backlog_(ba::socket_base::max_connections)
+{}
+// ----------------------------------------------------------------------------
+
+/// Default settings of process
+T_config::T_config()
+	: thread_num_acceptors_(2), thread_num_executors_(boost::thread::hardware_concurrency()),
+	  sharded_(false), connections_prealloc_(128), connections_max_(1000000), buffer_pool_max_bytes_(0), overload_resume_percent_(90),
+	  uring_buffers_(1024), busy_poll_us_(0), drain_seconds_(30),
+	  metrics_address_("127.0.0.1"), metrics_port_(0), log_level_(log_info)
+{}
+// ----------------------------------------------------------------------------
+
+///
+/// Read settings of one port mapping from positional arguments of command line
+///
+/// @param argc number of arguments
+/// @param argv pointers to arguments
+///
+/// @return settings
+///
+T_config T_config::from_command_line(int argc, char** argv) {
+	T_config config;
+	T_mapping_config mapping;
+
+	// read remote port number from command line, if provided
+	if(argc > 1)
+		mapping.remote_port_ = boost::lexical_cast<unsigned short>(argv[1]);
+	// read remote address from command line, if provided
+	if(argc > 2)
+		mapping.remote_address_ = argv[2];
+
+	// read local port number from command line, if provided
+	if(argc > 3)
+		mapping.local_port_ = boost::lexical_cast<unsigned short>(argv[3]);
+	// read local interface address from command line, if provided
+	if(argc > 4)
+		mapping.local_interface_address_ = argv[4];
+
+	// read number of threads in thread pool from command line, if provided
+	if(argc > 5)
+		config.thread_num_acceptors_ = boost::lexical_cast<unsigned int>(argv[5]);
+	if(argc > 6)
+		config.thread_num_executors_ = boost::lexical_cast<unsigned int>(argv[6]);
+
+	// read language locale from command line, if provided
+	if(argc > 7)
+		config.locale_ = argv[7];
+
+	// read relay mode from command line, if provided
+	if(argc > 8)
+		mapping.relay_mode_ = parse_relay_mode(argv[8]);
+
+	// read executors mode from command line, if provided
+	if(argc > 9)
+		config.sharded_ = (std::string(argv[9]) == "sharded");
+
+	// read limits of memory pool of connections from command line, if provided
+	if(argc > 10)
+		config.connections_prealloc_ = boost::lexical_cast<size_t>(argv[10]);
+	if(argc > 11)
+		config.connections_max_ = boost::lexical_cast<size_t>(argv[11]);
+
+	// read period of re-resolve from command line, if provided
+	if(argc > 12)
+		mapping.dns_refresh_seconds_ = boost::lexical_cast<unsigned int>(argv[12]);
+
+	// read balance policy from command line, if provided
+	if(argc > 13)
+		mapping.balance_policy_ = T_backend_pool::parse_policy(argv[13]);
+
+	// read number of pre-established connections from command line, if provided
+	if(argc > 14)
+		mapping.upstream_prewarm_ = boost::lexical_cast<size_t>(argv[14]);
+
+	// read timeouts in seconds from command line, if provided
+	if(argc > 15)
+		mapping.timeouts_.connect_seconds_ = boost::lexical_cast<unsigned int>(argv[15]);
+	if(argc > 16)
+		mapping.timeouts_.idle_seconds_ = boost::lexical_cast<unsigned int>(argv[16]);
+	if(argc > 17)
+		mapping.timeouts_.lifetime_seconds_ = boost::lexical_cast<unsigned int>(argv[17]);
+
+	// read port of HTTP listener of metrics from command line, if provided
+	if(argc > 18)
+		config.metrics_port_ = boost::lexical_cast<unsigned short>(argv[18]);
+
+	// read profile of socket options and length of listen queue from command line, if provided
+	if(argc > 19)
+		mapping.socket_options_ = T_socket_options::profile(argv[19]);
+	if(argc > 20)
+		mapping.listen_backlog_ = boost::lexical_cast<int>(argv[20]);
+
+	// read limits of connections and accept rate from command line, if provided
+	if(argc > 21)
+		mapping.admission_.max_connections_ = boost::lexical_cast<size_t>(argv[21]);
+	if(argc > 22)
+		mapping.admission_.max_connections_per_ip_ = boost::lexical_cast<size_t>(argv[22]);
+	if(argc > 23)
+		mapping.admission_.accept_rate_ = boost::lexical_cast<unsigned int>(argv[23]);
+
+	// read limits of bandwidth from command line, if provided
+	if(argc > 24)
+		mapping.bandwidth_.connection_rate_ = boost::lexical_cast<uint64_t>(argv[24]);
+	if(argc > 25)
+		mapping.bandwidth_.client_ip_rate_ = boost::lexical_cast<uint64_t>(argv[25]);
+	if(argc > 26)
+		mapping.bandwidth_.mapping_rate_ = boost::lexical_cast<uint64_t>(argv[26]);
+
+	// read protocol from command line, if provided
+	if(argc > 27)
+		mapping.protocol_ = parse_protocol(argv[27]);
+
+	config.mappings_.push_back(mapping);
+	return config;
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Read settings from INI-file: section [global] for the process and one section per port mapping
+///
+/// @param file_name name of config file
+///
+/// @return settings
+///
+T_config T_config::from_file(const std::string& file_name) {
+	boost::property_tree::ptree tree;
+	boost::property_tree::ini_parser::read_ini(file_name, tree);
+
+	T_config config;
+	const T_mapping_config defaults;
+	for(auto &section : tree) {
+		const boost::property_tree::ptree& keys = section.second;
+
+		if(section.first == "global") {
+			config.thread_num_acceptors_ = keys.get("acceptors", config.thread_num_acceptors_);
+			config.thread_num_executors_ = keys.get("executors", config.thread_num_executors_);
+			config.locale_ = keys.get("locale", config.locale_);
+			config.sharded_ = (keys.get<std::string>("executors_mode", "shared") == "sharded");
+			config.executor_cpus_ = T_cpu_topology::parse_list(keys.get<std::string>("executor_cpus", ""));
+			config.acceptor_cpus_ = T_cpu_topology::parse_list(keys.get<std::string>("acceptor_cpus", ""));
+			config.busy_poll_us_ = keys.get("busy_poll", config.busy_poll_us_);
+			config.connections_prealloc_ = keys.get("connections_prealloc", config.connections_prealloc_);
+			config.connections_max_ = keys.get("connections_max", config.connections_max_);
+			config.buffer_pool_max_bytes_ = keys.get("buffer_pool_max_bytes", config.buffer_pool_max_bytes_);
+			config.overload_resume_percent_ = keys.get("overload_resume_percent", config.overload_resume_percent_);
+			config.uring_buffers_ = keys.get("uring_buffers", config.uring_buffers_);
+			config.drain_seconds_ = keys.get("drain_timeout", config.drain_seconds_);
+			config.metrics_address_ = keys.get("metrics_address", config.metrics_address_);
+			config.metrics_port_ = keys.get("metrics_port", config.metrics_port_);
+			config.log_level_ = T_log::parse_level(keys.get<std::string>("log_level", "info"));
+			continue;
+		}
+		if(keys.empty())
+			throw std::runtime_error("Config " + file_name + ": key '" + section.first + "' outside of section");
+
+		T_mapping_config mapping;
+		mapping.name_ = section.first;
+		mapping.remote_address_ = keys.get<std::string>("remote_address");	// required
+		mapping.remote_port_ = keys.get("remote_port", defaults.remote_port_);
+		mapping.local_port_ = keys.get<unsigned int>("local_port");			// required
+		mapping.local_interface_address_ = keys.get("local_address", defaults.local_interface_address_);
+		mapping.protocol_ = parse_protocol(keys.get<std::string>("protocol", "tcp"));
+		mapping.relay_mode_ = parse_relay_mode(keys.get<std::string>("relay_mode", "buffered"));
+		mapping.dns_refresh_seconds_ = keys.get("dns_refresh_seconds", defaults.dns_refresh_seconds_);
+		mapping.balance_policy_ = T_backend_pool::parse_policy(
+			keys.get<std::string>("balance_policy", T_backend_pool::policy_name(defaults.balance_policy_)));
+		mapping.upstream_prewarm_ = keys.get("upstream_prewarm", defaults.upstream_prewarm_);
+		mapping.upstream_max_idle_seconds_ = keys.get("upstream_max_idle", defaults.upstream_max_idle_seconds_);
+		mapping.timeouts_.connect_seconds_ = keys.get("connect_timeout", defaults.timeouts_.connect_seconds_);
+		mapping.timeouts_.idle_seconds_ = keys.get("idle_timeout", defaults.timeouts_.idle_seconds_);
+		mapping.timeouts_.lifetime_seconds_ = keys.get("lifetime_timeout", defaults.timeouts_.lifetime_seconds_);
+		mapping.listen_backlog_ = keys.get("listen_backlog", defaults.listen_backlog_);
+		mapping.admission_.max_connections_ = keys.get("max_connections", defaults.admission_.max_connections_);
+		mapping.admission_.max_connections_per_ip_ = keys.get("max_connections_per_ip", defaults.admission_.max_connections_per_ip_);
+		mapping.admission_.accept_rate_ = keys.get("accept_rate", defaults.admission_.accept_rate_);
+		mapping.admission_.accept_burst_ = keys.get("accept_burst", defaults.admission_.accept_burst_);
+		mapping.bandwidth_.connection_rate_ = keys.get("bandwidth_connection", defaults.bandwidth_.connection_rate_);
+		mapping.bandwidth_.client_ip_rate_ = keys.get("bandwidth_client_ip", defaults.bandwidth_.client_ip_rate_);
+		mapping.bandwidth_.mapping_rate_ = keys.get("bandwidth_mapping", defaults.bandwidth_.mapping_rate_);
+		mapping.bandwidth_.burst_bytes_ = keys.get("bandwidth_burst", defaults.bandwidth_.burst_bytes_);
+		mapping.udp_.session_timeout_seconds_ = keys.get("udp_session_timeout", defaults.udp_.session_timeout_seconds_);
+		mapping.udp_.max_sessions_ = keys.get("udp_max_sessions", defaults.udp_.max_sessions_);
+		// options of profile, each of them can be overridden
+		T_socket_options& options = mapping.socket_options_;
+		options = T_socket_options::profile(keys.get<std::string>("socket_profile", defaults.socket_options_.profile_));
+		options.no_delay_ = keys.get("tcp_nodelay", options.no_delay_);
+		options.receive_buffer_ = keys.get("so_rcvbuf", options.receive_buffer_);
+		options.send_buffer_ = keys.get("so_sndbuf", options.send_buffer_);
+		options.quick_ack_ = keys.get("tcp_quickack", options.quick_ack_);
+		options.keep_alive_ = keys.get("keepalive", options.keep_alive_);
+		options.keep_alive_idle_ = keys.get("keepalive_idle", options.keep_alive_idle_);
+		options.keep_alive_interval_ = keys.get("keepalive_interval", options.keep_alive_interval_);
+		options.keep_alive_count_ = keys.get("keepalive_count", options.keep_alive_count_);
+		options.busy_poll_ = keys.get("so_busy_poll", options.busy_poll_);
+		config.mappings_.push_back(mapping);
+	}
+	if(config.mappings_.empty())
+		throw std::runtime_error("Config " + file_name + ": there are no port mappings");
+	if(config.overload_resume_percent_ > 100)
+		throw std::runtime_error("Config " + file_name + ": overload_resume_percent must be 0-100");
+	for(auto &i : config.mappings_)
+		if(i.protocol_ == protocol_udp && i.udp_.session_timeout_seconds_ == 0)
+			throw std::runtime_error("Config " + file_name + ": udp_session_timeout of " + i.name_ + " must be greater than 0");
+	// ids of CPUs are pinned as they are: CPU, which isn't online, is an error instead of other CPU (maybe of other node)
+	const std::vector<unsigned int>& online_cpus = T_cpu_topology::instance().online_cpus();
+	const std::pair<const char*, const std::vector<unsigned int>*> cpu_lists[] = 
+		{ std::make_pair("executor_cpus", &config.executor_cpus_), std::make_pair("acceptor_cpus", &config.acceptor_cpus_) };
+	for(auto &list : cpu_lists)
+		for(auto cpu : *list.second)
+			if(std::find(online_cpus.begin(), online_cpus.end(), cpu) == online_cpus.end())
+				throw std::runtime_error("Config " + file_name + ": CPU " + boost::lexical_cast<std::string>(cpu) + " of " + 
+					list.first + " isn't online (online CPUs: " + T_cpu_topology::format_list(online_cpus) + ")");
+	return config;
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Parse relay mode
+///
+/// @param name buffered, splice or uring
+///
+/// @return relay mode
+///
+T_relay_mode T_config::parse_relay_mode(const std::string& name) {
+	if(name == "splice") return relay_splice;
+	if(name == "uring") return relay_uring;
+	if(name == "buffered") return relay_buffered;
+	throw std::runtime_error("Unknown relay mode: " + name);
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Parse protocol
+///
+/// @param name tcp or udp
+///
+/// @return protocol
+///
+T_protocol T_config::parse_protocol(const std::string& name) {
+	if(name == "tcp") return protocol_tcp;
+	if(name == "udp") return protocol_udp;
+	throw std::runtime_error("Unknown protocol: " + name);
+}
+// ----------------------------------------------------------------------------
@@ -0,0 +1,109 @@
+/**
+ * @file   config.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Settings of process and of port mappings: from command line or from config file
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+// ----------------------------------------------------------------------------
+#include "connection.hpp"
+#include "backend_pool.hpp"
+#include "udp_mapping.hpp"
+#include "log.hpp"
+// ----------------------------------------------------------------------------
+#include <string>
+#include <vector>
+// ----------------------------------------------------------------------------
+
+/// Transport protocol of port mapping
+enum T_protocol {
+	protocol_tcp,	///< connections: listener, accept and relay of streams
+	protocol_udp 	///< datagrams: sessions by address of client
+};
+// ----------------------------------------------------------------------------
+
+/// Settings of one port mapping: listener -> remote servers
+struct T_mapping_config {
+	T_mapping_config();
+
+	std::string name_;                      ///< name of mapping (section of config file)
+	unsigned int remote_port_;              ///< port of remote servers, for which it isn't specified in remote_address_
+	std::string remote_address_;            ///< remote address, or list of them: "address[:port],[ipv6]:port,..."
+	unsigned int local_port_;               ///< port to listen on
+	std::string local_interface_address_;   ///< local interface address to listen on
+	T_protocol protocol_;                   ///< tcp or udp
+	T_relay_mode relay_mode_;               ///< relay engine: buffered (any OS) or zero-copy splice (only Linux)
+	unsigned int dns_refresh_seconds_;      ///< period of re-resolve of remote address in background (0 - resolve only once)
+	T_balance_policy balance_policy_;       ///< policy of selection of remote server, if there are many of them
+	size_t upstream_prewarm_;               ///< pre-established connections to each remote server for each io_service of executors (0 - disabled)
+	unsigned int upstream_max_idle_seconds_;///< max time of idle pre-established connection, then it is reconnected (0 - unlimited)
+	T_connection_timeouts timeouts_;        ///< timeouts of connect, idle and lifetime of connections
+	T_socket_options socket_options_;       ///< options of client and server sockets: profile with overrides
+	int listen_backlog_;                    ///< max length of queue of connections, which aren't accepted yet (capped by OS)
+	T_admission_limits admission_;          ///< limits of connections of mapping and of each client IP, and accept rate
+	T_bandwidth_limits bandwidth_;          ///< limits of bandwidth of each connection, of each client IP and of mapping
+	T_udp_settings udp_;                    ///< timeout and limit of sessions of UDP port mapping
+};
+// ----------------------------------------------------------------------------
+
+///
+/// Settings of process: threads and memory pools, which are shared by all port mappings, and list of mappings
+///
+struct T_config {
+	T_config();
+
+	///
+	/// Read settings of one port mapping from positional arguments of command line:
+	/// remote_port remote_address local_port local_address number_acceptors numer_executors language_locale
+	/// relay_mode executors_mode connections_prealloc connections_max dns_refresh_seconds balance_policy upstream_prewarm
+	/// connect_timeout idle_timeout lifetime_timeout metrics_port socket_profile listen_backlog
+	/// max_connections max_connections_per_ip accept_rate bandwidth_connection bandwidth_client_ip bandwidth_mapping protocol
+	///
+	/// @param argc number of arguments
+	/// @param argv pointers to arguments
+	///
+	/// @return settings
+	///
+	static T_config from_command_line(int argc, char** argv);
+
+	///
+	/// Read settings from INI-file: section [global] for the process and one section per port mapping
+	///
+	/// @param file_name name of config file
+	///
+	/// @return settings
+	///
+	static T_config from_file(const std::string& file_name);
+
+	/// Parse relay mode: buffered, splice, uring
+	static T_relay_mode parse_relay_mode(const std::string& name);
+
+	/// Parse protocol: tcp, udp
+	static T_protocol parse_protocol(const std::string& name);
+
+	unsigned int thread_num_acceptors_;     ///< number of threads for acceptors
+	unsigned int thread_num_executors_;     ///< number of threads for executors
+	std::string locale_;                    ///< language locale, empty - don't change
+	bool sharded_;                          ///< executors: shared - one io_service for all threads, sharded - one io_service per thread pinned to core
+	std::vector<unsigned int> executor_cpus_;   ///< CPUs, to which threads of executors are pinned in turn, empty - default
+	std::vector<unsigned int> acceptor_cpus_;   ///< CPUs, to which threads of acceptors are pinned in turn, empty - not pinned
+	size_t connections_prealloc_;           ///< number of preallocated connections (for all mappings)
+	size_t connections_max_;                ///< hard cap of simultaneous connections (for all mappings), accept is paused at it
+	size_t buffer_pool_max_bytes_;          ///< memory of the buffer pool, at which accept is paused (0 - unlimited)
+	unsigned int overload_resume_percent_;  ///< paused accept is resumed, when connections and buffers fall to this percent of limits
+	unsigned int uring_buffers_;            ///< provided buffers (16 KB) of the ring of io_uring of each io_service of executors
+	unsigned int busy_poll_us_;             ///< executors spin on idle io_service up to this time before block, microseconds, 0 - disabled
+	unsigned int drain_seconds_;            ///< on SIGTERM listeners are closed, and established connections are waited up to this time
+	std::string metrics_address_;           ///< local address of HTTP listener of metrics
+	unsigned int metrics_port_;             ///< port of HTTP listener of metrics, 0 - disabled
+	T_log_level log_level_;                 ///< min level of log records, which are written
+	std::vector<T_mapping_config> mappings_;    ///< port mappings
+};
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // CONFIG_HPP
@@ -12,168 +12,785 @@
 // ----------------------------------------------------------------------------
 #include <boost/move/move.hpp>
 #include <boost/bind.hpp>
+#include <boost/array.hpp>
+// ----------------------------------------------------------------------------
+#ifdef PORTMAPPING_SPLICE
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+// ----------------------------------------------------------------------------
+
+/// Lock of spinlock for the scope
+class T_spin_lock_guard {
+	std::atomic_flag& flag_;
+public:
+	explicit T_spin_lock_guard(std::atomic_flag& flag) : flag_(flag) { while(flag_.test_and_set(std::memory_order_acquire)) ; }
+	~T_spin_lock_guard() { flag_.clear(std::memory_order_release); }
+};
 // ----------------------------------------------------------------------------
 
 	/// 
 	/// Constructor for class, initilize socket for this connection
 	/// 
+	/// @param slab memory pool, to which the slot of this connection is returned at close
 	/// @param io_service reference to io_service of executors in which this connection will work
+	/// @param timing_wheel reference to timing wheel of this io_service
+	/// @param pacer reference to pacer of deferred reads of this io_service
+	/// @param uring ring of io_uring of this io_service, NULL - relay through io_uring isn't available
 	/// @param T_hide_me() temporary object that made a constructor private 
 	/// 
 	/// @return nothing
 	///
-	T_connection::T_connection(ba::io_service& io_service, T_hide_me) :
-		io_service_(io_service), client_socket_(io_service), server_socket_(io_service), count_of_events_loops_(1)
+	T_connection::T_connection(T_connection_slab& slab, ba::io_service& io_service, T_timing_wheel& timing_wheel, T_pacer& pacer, 
+							   T_uring *const uring, T_hide_me) :
+		count_of_events_loops_(1), slab_(slab), io_service_(io_service), timing_wheel_(timing_wheel), pacer_(pacer), uring_(uring), 
+		client_socket_(io_service), server_socket_(io_service), relay_mode_(relay_buffered),
+		client_deferred_read_(*this, T_shaper::client_to_server), server_deferred_read_(*this, T_shaper::server_to_client),
+		timeouts_enabled_(false), connect_ticks_(0), idle_ticks_(0), lifetime_deadline_(0), connect_deadline_(0), last_activity_(0), expired_(false), next_accepted_(NULL), client_ring_relay_(client_socket_, server_socket_, T_shaper::client_to_server),
+		server_ring_relay_(server_socket_, client_socket_, T_shaper::server_to_client)
+#ifdef PORTMAPPING_URING
+		, client_uring_relay_(*this, T_shaper::client_to_server), server_uring_relay_(*this, T_shaper::server_to_client)
+#endif
 	{
-		std::cout << "T_connection() \n";
+		server_socket_lock_.clear();
+#ifdef PORTMAPPING_SPLICE
+		client_pipe_[0] = client_pipe_[1] = server_pipe_[0] = server_pipe_[1] = -1;
+		client_pipe_bytes_ = server_pipe_bytes_ = 0;
+#endif
+		PORTMAPPING_LOG(log_trace, "T_connection()");
 	}
 
-	T_connection::~T_connection() { std::cout << "~T_connection() \n"; }
+	T_connection::~T_connection() { 
+		release_ring(client_ring_relay_);
+		release_ring(server_ring_relay_);
+#ifdef PORTMAPPING_SPLICE
+		close_pipes();
+#endif
+		PORTMAPPING_LOG(log_trace, "~T_connection()");
+	}
 	// ----------------------------------------------------------------------------
 
 	/// 
 	/// Perform all input/output operations in async mode:
-	/// for a start try to connect to endpoint by endpoint_iterator
+	/// for a start try to connect to the best of endpoints
 	/// 
-	/// @param shared_this shared pointer of this (current connection)
-	/// @param endpoint_iterator forward iterable object, that points to the connection endpoints of remote server
+	/// @param backend remote server selected for this connection
+	/// @param metrics counters of port mapping
+	/// @param admission_ticket admission of this connection, it's released when the connection is closed
+	/// @param shaper limits of bandwidth of this connection
+	/// @param socket_options options of client socket and of server socket (it must live longer than connection)
+	/// @param relay_mode relay engine, that will be used after connect to the server
+	/// @param timeouts timeouts of connect, idle and lifetime
 	///
-	void T_connection::run(T_shared_this shared_this, const ba::ip::tcp::resolver::iterator endpoint_iterator) {
+	void T_connection::run(T_backend& backend, T_metrics& metrics, const T_admission_ticket& admission_ticket,
+		const T_shaper& shaper, const T_socket_options& socket_options, const T_relay_mode relay_mode, const T_connection_timeouts& timeouts) 
+	{
+		backend_ = &backend;
+		backend_->active_connections_.fetch_add(1, std::memory_order_relaxed);
+		metrics_ = &metrics;
+		metrics_->add(T_metrics::connections_opened);
+		admission_ticket_ = admission_ticket;
 		// try/catch and then output to std::cerr exception message .what()
 		if (!try_catch_to_cerr(THROW_PLACE, [&]() {
-			memorypool_shared_this_ = boost::move(shared_this);
-			const bool first_time = true;
-			handle_connect(boost::system::error_code(), endpoint_iterator, first_time);
+			shaper_ = shaper;
+			socket_options_ = &socket_options;
+			socket_options.apply(client_socket_);
+			remote_endpoints_ = backend.endpoints_.endpoints();
+			relay_mode_ = relay_mode;
+			tried_endpoints_ = 0;
+			// deadlines in ticks of the timing wheel
+			const uint64_t now = timing_wheel_.now();
+			connect_ticks_ = T_timing_wheel::ticks(timeouts.connect_seconds_);
+			idle_ticks_ = T_timing_wheel::ticks(timeouts.idle_seconds_);
+			lifetime_deadline_ = (timeouts.lifetime_seconds_ != 0) ? now + T_timing_wheel::ticks(timeouts.lifetime_seconds_) : 0;
+			timeouts_enabled_ = (connect_ticks_ != 0 || idle_ticks_ != 0 || lifetime_deadline_ != 0);
+			last_activity_.store(now, std::memory_order_relaxed);
+			// adopt pre-established connection to the server, if there is it in the pool
+			if(backend.upstream_pool_ && backend.upstream_pool_->take(io_service_, server_socket_)) {
+				remote_endpoints_.reset();	// options of the socket are set by the pool before its connect
+				metrics_->add(T_metrics::upstream_pool_hits);
+				start_relay();
+				return;
+			}
+			const int first_time = -1;
+			handle_connect(boost::system::error_code(), first_time);
 		} )	)
-			shutdown(boost::system::error_code(), "");
+			shutdown(boost::system::error_code(), THROW_PLACE);
 	}
 	// ----------------------------------------------------------------------------
 
 	/// 
-	/// Try to connect to the server
+	/// Try to connect to the server: healthy endpoints first, unhealthy as last resort
 	/// 
 	/// @param err reference to error code returned by async_connect
-	/// @param endpoint_iterator forward iterable object, that points to the connection endpoints of remote server
-	/// @param first_time flag that show that function launched at first time or no
+	/// @param i_endpoint index of endpoint of previous connect attempt, -1 if function launched at first time
 	///
-	void T_connection::handle_connect(const boost::system::error_code& err,
-									ba::ip::tcp::resolver::iterator endpoint_iterator, const bool first_time) {
+	void T_connection::handle_connect(const boost::system::error_code& err, const int i_endpoint) {
 	//	std::cout << "handle_connect. Error: " << err << "\n";
-		if (!err && !first_time) {
-			// no one instruction after that expression will not executed before the atomic variable will not incremented by 1
-			count_of_events_loops_.fetch_add(1, std::memory_order_acquire);	
-			handle_write_to_client(bs::error_code(), 0);
-			handle_write_to_server(bs::error_code(), 0);
-		} else if (endpoint_iterator != ba::ip::tcp::resolver::iterator()) {
-			//ssocket_.close();
-			ba::ip::tcp::endpoint endpoint = *endpoint_iterator;
-			//std::cout << std::string("Endpoint: " + endpoint.address().to_string() + ":" + boost::lexical_cast<std::string>(endpoint.port()) + ", " + 
-				//boost::lexical_cast<std::string>(first_time) + "\n");
-			server_socket_.async_connect(endpoint,
-								   client_bind(boost::bind(&T_connection::handle_connect, this,
-														   boost::asio::placeholders::error,
-														   ++endpoint_iterator, false)) );
+		if(i_endpoint >= 0) {
+			T_endpoint_table::T_endpoint& endpoint = *(*remote_endpoints_)[i_endpoint];
+			if(!err) {
+				const int64_t latency_us = T_endpoint_table::now_us() - connect_start_us_;
+				T_endpoint_table::report_success(endpoint, static_cast<unsigned int>(latency_us));
+				metrics_->add_connect_latency(static_cast<uint64_t>(latency_us));
+				connect_deadline_.store(0, std::memory_order_relaxed);
+				remote_endpoints_.reset();
+				start_relay();
+				return;
+			}
+			if(expired_.load(std::memory_order_acquire)) {
+				// the attempt is aborted by idle or lifetime timeout: the endpoint isn't guilty, and there is no next attempt
+				abort_connect(err);
+				return;
+			}
+			T_endpoint_table::report_failure(endpoint);	// also if the attempt has been interrupted by connect timeout
+			metrics_->add(T_metrics::connect_failures);
+		}
+
+		const int i_next_endpoint = T_endpoint_table::select(*remote_endpoints_, tried_endpoints_);
+		if (i_next_endpoint >= 0) {
+			tried_endpoints_ |= uint64_t(1) << i_next_endpoint;
+			connect_start_us_ = T_endpoint_table::now_us();
+			bool expired;
+			{
+				// the timing wheel can interrupt the attempt from other thread only before close or after start of connect
+				T_spin_lock_guard lock(server_socket_lock_);
+				bs::error_code ec;
+				server_socket_.close(ec);	// socket after failed connect can't be used for the next connect
+				// timeout, which has expired before this lock, doesn't see the new attempt: the connection is aborted below
+				expired = expired_.load(std::memory_order_acquire);
+				if(!expired) {
+					// options (buffers for window scale, keepalive...) are set before SYN, async_connect opens the socket only if it's closed
+					const ba::ip::tcp::endpoint& endpoint = (*remote_endpoints_)[i_next_endpoint]->endpoint_;
+					if(!server_socket_.open(endpoint.protocol(), ec)) socket_options_->apply(server_socket_);
+					if(connect_ticks_ != 0) 
+						connect_deadline_.store(timing_wheel_.now() + connect_ticks_, std::memory_order_relaxed);
+					server_socket_.async_connect(endpoint,
+										   arena_bind(boost::bind(&T_connection::handle_connect, this,
+																   boost::asio::placeholders::error,
+																   i_next_endpoint)) );
+				}
+			}
+			if(expired) abort_connect(err);
+			else schedule_timeouts();
 		} else {
+			connect_deadline_.store(0, std::memory_order_relaxed);
+			remote_endpoints_.reset();
+			metrics_->add(T_metrics::upstream_unavailable);
 			shutdown(err, THROW_PLACE);
 		}
 	}
 	// ----------------------------------------------------------------------------
 
 	/// 
-	/// Writing data to the client
-	/// after read them from a server to server_buffer_
+	/// Stop connect after idle or lifetime timeout without report of failure of endpoint and without next attempt
+	/// 
+	/// @param err error of the last attempt
+	///
+	void T_connection::abort_connect(const boost::system::error_code& err) {
+		connect_deadline_.store(0, std::memory_order_relaxed);
+		remote_endpoints_.reset();
+		shutdown(err, THROW_PLACE);
+	}
+	// ----------------------------------------------------------------------------
+
 	/// 
+	/// Start relay in both directions after connect to the server
+	///
+	void T_connection::start_relay() {
+#ifdef PORTMAPPING_URING
+		const bool uring = (relay_mode_ == relay_uring && uring_ != NULL);
+#else
+		const bool uring = false;
+#endif
+		// sockets in non-blocking mode: data are read by read_some() only after readiness of socket,
+		// and io_uring waits for readiness itself (its operations on blocking sockets don't block threads)
+		bs::error_code ec;
+		if(client_socket_.non_blocking(!uring, ec) || server_socket_.non_blocking(!uring, ec)) {
+			shutdown(ec, THROW_PLACE);
+			return;
+		}
+		// the second event loop is taken by the first one, which holds the connection alive, so order isn't needed
+		count_of_events_loops_.fetch_add(1, std::memory_order_relaxed);
+		touch();
+		schedule_timeouts();
+#ifdef PORTMAPPING_URING
+		if(uring) {
+			start_uring();
+			return;
+		}
+#endif
+#ifdef PORTMAPPING_SPLICE
+		if(relay_mode_ == relay_splice && start_splice()) return;
+#endif
+		client_ring_relay_.reading_ = server_ring_relay_.reading_ = true;
+		start_ring_read(client_ring_relay_);
+		start_ring_read(server_ring_relay_);
+	}
+	// ----------------------------------------------------------------------------
+
+	/// 
+	/// Wait for readiness of the socket, from which data of direction are read, without holding a buffer
+	/// 
+	/// @param relay direction of relay
+	///
+	void T_connection::start_ring_read(T_ring_relay& relay) {
+		relay.from_.async_read_some(ba::null_buffers(),
+			arena_bind(boost::bind(&T_connection::handle_ring_readable, this, boost::ref(relay), ba::placeholders::error)) );
+	}
+
+	/// 
+	/// Read data to free buffers of the ring after readiness of socket, while the socket has data
+	/// and the ring isn't full, and start gathered write, if it isn't in progress
+	/// 
+	/// @param relay direction of relay
 	/// @param err 
-	/// @param len length of data in bytes, that have been read
 	///
-	void T_connection::handle_read_from_server(const bs::error_code& err, const size_t len) {
-		//std::cout << "handle_read_from_server, len= " << len << ", eof is: " << (err == ba::error::eof) << std::endl;
-		if(!err)
-		{
-			ba::async_write(client_socket_, ba::buffer(server_buffer_, len),
-							server_bind(boost::bind(&T_connection::handle_write_to_client, this,
-													ba::placeholders::error,
-													ba::placeholders::bytes_transferred)) );
-		} else {
-			shutdown(err, THROW_PLACE);
+	void T_connection::handle_ring_readable(T_ring_relay& relay, const bs::error_code& err) {
+		if(err) {
+			finish_ring_read(relay, err);
+			return;
 		}
+		for(;;) {
+			size_t slot;
+			{
+				T_spin_lock_guard lock(relay.lock_);
+				slot = (relay.head_ + relay.count_) % T_ring_relay::max_chunks;
+			}
+			// the slot is free: the writer doesn't touch it until count_ is incremented
+			T_ring_relay::T_chunk& chunk = relay.chunks_[slot];
+			chunk.size_class_ = relay.size_class_;
+			chunk.buffer_ = T_buffer_pool::instance().acquire(chunk.size_class_);
+			const size_t capacity = T_buffer_pool::buffer_size(chunk.size_class_);
+			bs::error_code ec;
+			const size_t len = relay.from_.read_some(ba::buffer(chunk.buffer_, capacity), ec);
+			if(ec == ba::error::would_block || ec == ba::error::try_again) {
+				release_buffer(chunk.buffer_, chunk.size_class_);	// all data are read: return buffer and wait again
+				break;
+			}
+			if(ec) {
+				release_buffer(chunk.buffer_, chunk.size_class_);
+				finish_ring_read(relay, ec);
+				return;
+			}
+			chunk.length_ = len;
+			touch();
+			metrics_->add((relay.direction_ == T_shaper::client_to_server) ? T_metrics::bytes_client_to_server : T_metrics::bytes_server_to_client, len);
+			if(shaper_.enabled()) shaper_.charge(relay.direction_, len);
+			relay.size_class_ = T_buffer_pool::adapt_size_class(relay.size_class_, len);	// next buffer fits to the flow
+
+			bool start_write, full, write_failed;
+			{
+				T_spin_lock_guard lock(relay.lock_);
+				++relay.count_;
+				write_failed = relay.err_ && !relay.writing_;	// the writer has stopped by error: nobody will write the data
+				start_write = !relay.writing_ && !write_failed;
+				full = (relay.count_ == T_ring_relay::max_chunks);
+				if(start_write) relay.writing_ = true;
+				if(write_failed) relay.read_end_ = true;
+				if(full || write_failed) relay.reading_ = false;	// backpressure: the writer will resume read
+			}
+			if(write_failed) {
+				end_ring(relay);
+				return;
+			}
+			if(start_write) start_ring_write(relay);
+			if(full) return;
+			if(len < capacity) break;	// socket has no more data: don't spend a syscall on would_block
+		}
+		if(defer_read(relay.direction_)) return;	// limits of bandwidth: the pacer will call resume_read()
+		start_ring_read(relay);
 	}
 
 	/// 
-	/// Reading data from a server to server_buffer_
-	/// after yet another write data to the client
+	/// Gathered write of all filled buffers of the ring
+	/// 
+	/// @param relay direction of relay
 	///
+	void T_connection::start_ring_write(T_ring_relay& relay) {
+		size_t count;
+		{
+			T_spin_lock_guard lock(relay.lock_);
+			count = relay.count_;
+		}
+		// unused entries stay empty, writev() skips them
+		boost::array<ba::const_buffer, T_ring_relay::max_chunks> buffers;
+		for(size_t i = 0; i < count; ++i) {
+			const T_ring_relay::T_chunk& chunk = relay.chunks_[(relay.head_ + i) % T_ring_relay::max_chunks];
+			const size_t offset = (i == 0) ? relay.offset_ : 0;
+			buffers[i] = ba::const_buffer(chunk.buffer_ + offset, chunk.length_ - offset);
+		}
+		relay.to_.async_write_some(buffers,
+			arena_bind(boost::bind(&T_connection::handle_ring_write, this, boost::ref(relay), 
+								   ba::placeholders::error, ba::placeholders::bytes_transferred)) );
+	}
+
+	/// 
+	/// Return written buffers to the buffer pool, continue write of the rest, resume read stopped by full ring,
+	/// or end direction after eof or error
+	/// 
+	/// @param relay direction of relay
 	/// @param err 
-	/// @param len length of data in bytes, that have been writen
-	///
-	void T_connection::handle_write_to_client(const bs::error_code& err, const size_t len) {
-		//std::cout << "handle_write_to_client, len= " << len << ", eof is: " << (err == ba::error::eof) << std::endl;
-		if(!err) {
-			server_socket_.async_read_some(ba::buffer(server_buffer_),
-					   server_bind(boost::bind(&T_connection::handle_read_from_server, this,
-											   ba::placeholders::error,
-											   ba::placeholders::bytes_transferred)) );
-		} else {
-			shutdown(err, THROW_PLACE);
+	/// @param len length of data in bytes, that have been written
+	///
+	void T_connection::handle_ring_write(T_ring_relay& relay, const bs::error_code& err, size_t len) {
+		if(err) {
+			bool finish;
+			{
+				T_spin_lock_guard lock(relay.lock_);
+				if(!relay.err_ || relay.err_ == ba::error::eof) relay.err_ = err;
+				relay.writing_ = false;
+				finish = !relay.reading_;
+				if(finish) relay.read_end_ = true;
+			}
+			if(finish) {
+				end_ring(relay);
+			} else {
+				bs::error_code ec;
+				relay.from_.shutdown(ba::socket_base::shutdown_receive, ec);	// pending wait of the reader is completed with eof
+			}
+			return;
+		}
+
+		// written buffers are returned at once, they can be taken by the reader again
+		size_t head = relay.head_, written = 0;
+		while(len != 0) {
+			T_ring_relay::T_chunk& chunk = relay.chunks_[head];
+			const size_t rest = chunk.length_ - relay.offset_;
+			if(len < rest) {
+				relay.offset_ += len;
+				break;
+			}
+			len -= rest;
+			relay.offset_ = 0;
+			release_buffer(chunk.buffer_, chunk.size_class_);
+			head = (head + 1) % T_ring_relay::max_chunks;
+			++written;
+		}
+
+		bool write_more, resume_read, finish;
+		{
+			T_spin_lock_guard lock(relay.lock_);
+			relay.head_ = head;
+			relay.count_ -= written;
+			write_more = (relay.count_ != 0);
+			relay.writing_ = write_more;
+			resume_read = !relay.reading_ && !relay.read_end_ && relay.count_ < T_ring_relay::max_chunks;
+			if(resume_read) relay.reading_ = true;
+			finish = !write_more && relay.read_end_;
+		}
+		if(write_more) start_ring_write(relay);
+		if(resume_read && !defer_read(relay.direction_)) start_ring_read(relay);
+		if(finish) end_ring(relay);
+	}
+
+	/// 
+	/// Read is finished by eof or error: end direction, if write isn't in progress, 
+	/// else it will be ended by write (after the rest of data, if it's eof)
+	/// 
+	/// @param relay direction of relay
+	/// @param err eof or error of read
+	///
+	void T_connection::finish_ring_read(T_ring_relay& relay, const bs::error_code& err) {
+		bool finish;
+		{
+			T_spin_lock_guard lock(relay.lock_);
+			if(!relay.err_) relay.err_ = err;
+			relay.reading_ = false;
+			relay.read_end_ = true;
+			finish = !relay.writing_;
+		}
+		if(finish) {
+			end_ring(relay);
+		} else if(err != ba::error::eof) {
+			bs::error_code ec;
+			relay.to_.shutdown(ba::socket_base::shutdown_both, ec);	// pending write is completed with error
+		}
+	}
+
+	/// 
+	/// Both reader and writer of direction are stopped: return buffers and end direction
+	/// 
+	/// @param relay direction of relay
+	///
+	void T_connection::end_ring(T_ring_relay& relay) {
+		release_ring(relay);
+		end_direction(relay.to_, relay.err_, THROW_PLACE);
+	}
+
+	/// 
+	/// Return all buffers of the ring to the buffer pool
+	/// 
+	/// @param relay direction of relay
+	///
+	void T_connection::release_ring(T_ring_relay& relay) {
+		for(auto &i : relay.chunks_) release_buffer(i.buffer_, i.size_class_);
+	}
+	// ----------------------------------------------------------------------------
+
+	/// 
+	/// Return buffer to the buffer pool, if it is taken
+	/// 
+	/// @param buffer reference to pointer to the buffer, it will be set to NULL
+	/// @param size_class size class of the buffer
+	///
+	inline void T_connection::release_buffer(char *&buffer, const size_t size_class) {
+		if(buffer != NULL) {
+			T_buffer_pool::instance().release(buffer, size_class);
+			buffer = NULL;
+		}
+	}
+	// ----------------------------------------------------------------------------
+
+	/// 
+	/// Defer the next read of direction in the pacer, if limits of bandwidth require it
+	/// 
+	/// @param direction direction of relay
+	/// 
+	/// @return true - the read is deferred, and it will be started by resume_read()
+	///
+	inline bool T_connection::defer_read(const T_shaper::T_direction direction) {
+		if(!shaper_.enabled()) return false;
+		const int64_t resume_at_us = shaper_.take_resume_time(direction);
+		if(resume_at_us == 0) return false;
+		metrics_->add(T_metrics::reads_deferred);
+		pacer_.defer((direction == T_shaper::client_to_server) ? client_deferred_read_ : server_deferred_read_, resume_at_us);
+		return true;
+	}
+
+	/// 
+	/// Start the deferred read of direction: wait for readiness of the socket, from which data are read
+	/// 
+	/// @param direction direction of relay
+	///
+	void T_connection::resume_read(const T_shaper::T_direction direction) {
+	#ifdef PORTMAPPING_URING
+		if(client_uring_relay_.from_fd_ != -1) {
+			continue_uring((direction == T_shaper::client_to_server) ? client_uring_relay_ : server_uring_relay_);
+			return;
+		}
+	#endif
+	#ifdef PORTMAPPING_SPLICE
+		if(client_pipe_[0] != -1) {
+			if(direction == T_shaper::client_to_server) handle_splice_client_to_server(bs::error_code());
+			else handle_splice_server_to_client(bs::error_code());
+			return;
 		}
+	#endif
+		start_ring_read((direction == T_shaper::client_to_server) ? client_ring_relay_ : server_ring_relay_);
 	}
 	// ----------------------------------------------------------------------------
 
+#ifdef PORTMAPPING_SPLICE
 	/// 
-	/// Writing data to the server
-	/// after read them from a client to client_buffer_
+	/// Create pipes and start relay in both directions through splice()
+	/// 
+	/// @return true if pipes have been created, false - if need to use buffered relay
+	///
+	bool T_connection::start_splice() {
+		if(::pipe2(client_pipe_, O_NONBLOCK | O_CLOEXEC) != 0 || ::pipe2(server_pipe_, O_NONBLOCK | O_CLOEXEC) != 0) {
+			close_pipes();
+			return false;	// e.g. EMFILE - limit of file descriptors: fallback to the buffered relay
+		}
+		// increase pipes to pipe_size (by default 16 pages), if the limit /proc/sys/fs/pipe-max-size allows it
+		::fcntl(client_pipe_[1], F_SETPIPE_SZ, static_cast<int>(pipe_size));
+		::fcntl(server_pipe_[1], F_SETPIPE_SZ, static_cast<int>(pipe_size));
+
+		handle_splice_client_to_server(bs::error_code());
+		handle_splice_server_to_client(bs::error_code());
+		return true;
+	}
+	// ----------------------------------------------------------------------------
+
+	/// 
+	/// Moving data from the client to the server through client_pipe_
+	/// after readiness of client socket for read or server socket for write
 	/// 
 	/// @param err 
-	/// @param len length of data in bytes, that have been read
 	///
-	void T_connection::handle_read_from_client(const bs::error_code& err, const size_t len) {
-		//std::cout << "handle_read_from_client, len= " << len << ", eof is: " << (err == ba::error::eof) << std::endl;
-		if(!err)
-		{
-			ba::async_write(server_socket_, ba::buffer(client_buffer_, len),
-							client_bind(boost::bind(&T_connection::handle_write_to_server, this,
-													ba::placeholders::error,
-													ba::placeholders::bytes_transferred)) );
+	void T_connection::handle_splice_client_to_server(const bs::error_code& err) {
+		const bs::error_code relay_err = (!err) ? 
+			splice_relay(client_socket_, server_socket_, client_pipe_, client_pipe_bytes_, T_metrics::bytes_client_to_server,
+						 arena_bind(boost::bind(&T_connection::handle_splice_client_to_server, this,
+												 ba::placeholders::error)) ) : err;
+		if(relay_err) end_direction(server_socket_, relay_err, THROW_PLACE);
+	}
+
+	/// 
+	/// Moving data from the server to the client through server_pipe_
+	/// after readiness of server socket for read or client socket for write
+	/// 
+	/// @param err 
+	///
+	void T_connection::handle_splice_server_to_client(const bs::error_code& err) {
+		const bs::error_code relay_err = (!err) ? 
+			splice_relay(server_socket_, client_socket_, server_pipe_, server_pipe_bytes_, T_metrics::bytes_server_to_client,
+						 arena_bind(boost::bind(&T_connection::handle_splice_server_to_client, this,
+												 ba::placeholders::error)) ) : err;
+		if(relay_err) end_direction(client_socket_, relay_err, THROW_PLACE);
+	}
+	// ----------------------------------------------------------------------------
+
+	/// 
+	/// Move data from socket to the pipe and from the pipe to another socket, until one of them would block
+	/// 
+	/// @param from socket from which data are read
+	/// @param to socket to which data are written
+	/// @param pipe pipe through which data are moved: [0] - read end, [1] - write end
+	/// @param pipe_bytes number of bytes which are in the pipe, but not yet written to the socket
+	/// @param bytes_counter counter of bytes of this direction
+	/// @param handler completion handler for readiness wait of socket
+	/// 
+	/// @return error code: eof if the socket from which data are read was closed
+	///
+	template<typename T_handler>
+	bs::error_code T_connection::splice_relay(ba::ip::tcp::socket& from, ba::ip::tcp::socket& to, const int (&pipe)[2], 
+		size_t& pipe_bytes, const T_metrics::T_counter bytes_counter, T_handler handler) 
+	{
+		const T_shaper::T_direction direction = (bytes_counter == T_metrics::bytes_client_to_server) ? 
+			T_shaper::client_to_server : T_shaper::server_to_client;
+		for(size_t i_chunk = 0; i_chunk < splice_chunks_per_event; ) {
+			if(pipe_bytes > 0) {
+				// write data from the pipe to the socket
+				const ssize_t len = ::splice(pipe[0], NULL, to.native_handle(), NULL, pipe_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+				if(len > 0) {
+					pipe_bytes -= len;
+				} else if(len < 0 && errno == EINTR) {
+					continue;
+				} else if(len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					to.async_write_some(ba::null_buffers(), handler);	// wait until the socket will be ready for write
+					return bs::error_code();
+				} else {
+					return bs::error_code(len < 0 ? errno : EPIPE, bs::system_category());
+				}
+			} else {
+				if(defer_read(direction)) return bs::error_code();	// limits of bandwidth: the pacer will call resume_read()
+				// read data from the socket to the pipe
+				const ssize_t len = ::splice(from.native_handle(), NULL, pipe[1], NULL, pipe_size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+				if(len > 0) {
+					pipe_bytes += len;
+					++i_chunk;
+					touch();
+					metrics_->add(bytes_counter, static_cast<uint64_t>(len));
+					if(shaper_.enabled()) shaper_.charge(direction, static_cast<uint64_t>(len));
+				} else if(len == 0) {
+					return ba::error::eof;
+				} else if(errno == EINTR) {
+					continue;
+				} else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+					from.async_read_some(ba::null_buffers(), handler);	// wait until the socket will be ready for read
+					return bs::error_code();
+				} else {
+					return bs::error_code(errno, bs::system_category());
+				}
+			}
+		}
+		// the limit of chunks per one event has been reached - return to the reactor, to give a chance to other connections
+		if(pipe_bytes > 0) 
+			to.async_write_some(ba::null_buffers(), handler);
+		else 
+			from.async_read_some(ba::null_buffers(), handler);
+		return bs::error_code();
+	}
+	// ----------------------------------------------------------------------------
+
+	/// Close both pipes if they have been opened
+	void T_connection::close_pipes() {
+		for(int *fd : {&client_pipe_[0], &client_pipe_[1], &server_pipe_[0], &server_pipe_[1]})
+			if(*fd != -1) ::close(*fd), *fd = -1;
+	}
+	// ----------------------------------------------------------------------------
+#endif
+
+#ifdef PORTMAPPING_URING
+	/// 
+	/// Start relay in both directions through io_uring
+	///
+	void T_connection::start_uring() {
+		client_uring_relay_.from_fd_ = server_uring_relay_.to_fd_ = client_socket_.native_handle();
+		server_uring_relay_.from_fd_ = client_uring_relay_.to_fd_ = server_socket_.native_handle();
+		continue_uring(client_uring_relay_);
+		continue_uring(server_uring_relay_);
+	}
+	// ----------------------------------------------------------------------------
+
+	/// 
+	/// Update state of direction by completion of its operation, and continue relay when all of them are completed
+	/// 
+	/// @param relay direction of relay
+	/// @param tag tag of operation
+	/// @param result result of operation: bytes, or -errno
+	/// @param buffer index of provided buffer, which has been taken by receive, or -1
+	///
+	void T_connection::handle_uring(T_uring_relay& relay, const unsigned int tag, const int result, const int buffer) {
+		--relay.pending_;
+		if(tag == T_uring_relay::tag_recv) {
+			if(result > 0) {
+				relay.buffer_ = buffer;
+				relay.offset_ = 0;
+				relay.length_ = static_cast<size_t>(result);
+				touch();
+				metrics_->add((relay.direction_ == T_shaper::client_to_server) ? 
+					T_metrics::bytes_client_to_server : T_metrics::bytes_server_to_client, relay.length_);
+				if(shaper_.enabled()) shaper_.charge(relay.direction_, relay.length_);
+			} else if(result == 0) {
+				relay.eof_ = true;
+			} else if(result == -ENOBUFS) {
+				relay.no_buffer_ = true;
+			} else if(result != -ECANCELED && !relay.err_) {
+				relay.err_ = bs::error_code(-result, bs::system_category());
+			}
+			// -ECANCELED: the linked write has failed or is incomplete, it's handled by its own completion
 		} else {
-			shutdown(err, THROW_PLACE);
+			if(result > 0) {
+				relay.offset_ += static_cast<size_t>(result);
+				if(relay.offset_ == relay.length_) {
+					uring_->release_buffer(relay.buffer_);
+					relay.buffer_ = -1;
+				}
+			} else if(!relay.err_) {
+				relay.err_ = bs::error_code((result < 0) ? -result : EPIPE, bs::system_category());
+			}
 		}
+		if(relay.pending_ == 0) continue_uring(relay);
 	}
+	// ----------------------------------------------------------------------------
 
 	/// 
-	/// Reading data from a client to client_buffer_
-	/// after yet another write data to the server
+	/// Next step of direction, which hasn't operations in progress: end of relay, write of the rest of data,
+	/// or receive (it's linked to write, if bandwidth isn't limited; else it can be deferred)
+	/// 
+	/// @param relay direction of relay
 	///
-	/// @param err 
-	/// @param len length of data in bytes, that have been writen
-	///
-	void T_connection::handle_write_to_server(const bs::error_code& err, const size_t len) {
-		//std::cout << "handle_write_to_server, len= " << len << ", eof is: " << (err == ba::error::eof) << std::endl;
-		if(!err) {
-			client_socket_.async_read_some(ba::buffer(client_buffer_),
-					   client_bind(boost::bind(&T_connection::handle_read_from_client, this,
-											   ba::placeholders::error,
-											   ba::placeholders::bytes_transferred)) );
+	void T_connection::continue_uring(T_uring_relay& relay) {
+		if(relay.err_ || relay.eof_) {
+			if(relay.buffer_ != -1) uring_->release_buffer(relay.buffer_);
+			relay.buffer_ = -1;
+			end_direction((relay.direction_ == T_shaper::client_to_server) ? server_socket_ : client_socket_, 
+						  relay.err_ ? relay.err_ : bs::error_code(ba::error::eof), THROW_PLACE);
+		} else if(relay.buffer_ != -1) {
+			const char *const data = uring_->buffer(relay.buffer_) + relay.offset_;
+			const size_t len = relay.length_ - relay.offset_;
+			if(shaper_.enabled()) {
+				relay.pending_ = 1;	// the next receive can be deferred by the pacer
+				uring_->write(relay, T_uring_relay::tag_write, relay.to_fd_, data, len);
+			} else {
+				relay.pending_ = 2;
+				uring_->write_then_recv(relay, T_uring_relay::tag_write, relay.to_fd_, data, len, 
+										T_uring_relay::tag_recv, relay.from_fd_);
+			}
+		} else if(relay.no_buffer_) {
+			// all provided buffers of the ring are in use: retry on the next tick of the pacer
+			relay.no_buffer_ = false;
+			metrics_->add(T_metrics::uring_buffer_waits);
+			pacer_.defer((relay.direction_ == T_shaper::client_to_server) ? client_deferred_read_ : server_deferred_read_, 
+						 T_pacer::now_us());
+		} else if(!defer_read(relay.direction_)) {
+			relay.pending_ = 1;
+			uring_->recv(relay, T_uring_relay::tag_recv, relay.from_fd_);
+		}
+	}
+	// ----------------------------------------------------------------------------
+#endif
+
+	/// 
+	/// Run by the timing wheel at the nearest deadline: interrupt connect attempt or shutdown both sockets,
+	/// if one of timeouts is expired
+	/// 
+	/// @param now current tick of the timing wheel
+	/// 
+	/// @return tick of the next deadline, or 0 if there are no deadlines
+	///
+	uint64_t T_connection::on_timer(const uint64_t now) {
+		bs::error_code ec;
+		const uint64_t idle_deadline = last_activity_.load(std::memory_order_relaxed) + idle_ticks_;
+		const bool lifetime_expired = (lifetime_deadline_ != 0 && now >= lifetime_deadline_);
+		if(lifetime_expired || (idle_ticks_ != 0 && now >= idle_deadline)) {
+			metrics_->add(lifetime_expired ? T_metrics::lifetime_timeouts : T_metrics::idle_timeouts);
+			expired_.store(true, std::memory_order_release);
+			// pending and next operations of both directions are completed with eof or error, and connection is closed
+			client_socket_.shutdown(ba::socket_base::shutdown_both, ec);
+			T_spin_lock_guard lock(server_socket_lock_);
+			server_socket_.shutdown(ba::socket_base::shutdown_both, ec);
+			return 0;
+		}
+		uint64_t connect_deadline = connect_deadline_.load(std::memory_order_relaxed);
+		if(connect_deadline != 0 && now >= connect_deadline) {
+			// abort current attempt: handle_connect() will try the next endpoint
+			T_spin_lock_guard lock(server_socket_lock_);
+			if(connect_deadline_.compare_exchange_strong(connect_deadline, 0, std::memory_order_relaxed)) {
+				server_socket_.cancel(ec);
+				metrics_->add(T_metrics::connect_timeouts);
+			}
+		}
+		return next_deadline();
+	}
+
+	/// Tick of the nearest deadline of timeouts, 0 - there are no deadlines
+	uint64_t T_connection::next_deadline() const {
+		uint64_t deadline = lifetime_deadline_;
+		const uint64_t candidates[] = { connect_deadline_.load(std::memory_order_relaxed),
+			(idle_ticks_ != 0) ? last_activity_.load(std::memory_order_relaxed) + idle_ticks_ : 0 };
+		for(const uint64_t candidate : candidates)
+			if(candidate != 0 && (deadline == 0 || candidate < deadline)) deadline = candidate;
+		return deadline;
+	}
+
+	/// Schedule connection in the timing wheel for the nearest deadline, if any of timeouts is enabled
+	void T_connection::schedule_timeouts() {
+		if(!timeouts_enabled_) return;
+		const uint64_t deadline = next_deadline();
+		if(deadline != 0) timing_wheel_.schedule(*this, deadline);
+		else timing_wheel_.cancel(*this);
+	}
+	// ----------------------------------------------------------------------------
+
+	/// 
+	/// End of relay in one direction: EOF is forwarded as shutdown of sending to the socket of this direction,
+	/// so the peer can finish its half of connection, while data go in the other direction;
+	/// on error both directions are aborted
+	/// 
+	/// @param to socket to which data of this direction were written
+	/// @param err eof - the socket from which data were read is closed for sending, else error of relay
+	/// @param throw_place filename, line number in file and function name which call this function
+	///
+	inline void T_connection::end_direction(ba::ip::tcp::socket& to, const bs::error_code& err, const T_source_location& throw_place) {
+		bs::error_code ec;
+		if(err == ba::error::eof) {
+			to.shutdown(ba::socket_base::shutdown_send, ec);	// all data have been written before
 		} else {
-			shutdown(err, THROW_PLACE);
+			metrics_->add(T_metrics::relay_errors);
+			// pending and next operations of the other direction are completed with eof or error
+			client_socket_.shutdown(ba::socket_base::shutdown_both, ec);
+			server_socket_.shutdown(ba::socket_base::shutdown_both, ec);
 		}
+		shutdown(err, throw_place);
 	}
 	// ----------------------------------------------------------------------------
 
 	/// 
-	/// Close both sockets: for client and server
+	/// Close both sockets: for client and server, when both directions are ended
 	/// 
-	/// @param err 
-	/// @param throw_place string with filename, its datetime, line number in file and function name which call this shutdown() function 
+	/// @param err error, which ended the direction of relay (it is logged at debug level)
+	/// @param throw_place filename, line number in file and function name which call this shutdown() function
 	///
-	inline void T_connection::shutdown(const bs::error_code& err, const std::string& throw_place) {
+	inline void T_connection::shutdown(const bs::error_code& err, const T_source_location& throw_place) {
 		// try/catch and then output to std::cerr exception message .what()
 		try_catch_to_cerr(THROW_PLACE, [&]() {
-			//if(!!err && err != ba::error::eof) std::cerr << "Boost error_code: " << err.message() << "\n ->throw place: " << throw_place << std::endl;
+			if(err && err != ba::error::eof) PORTMAPPING_LOG_AT(log_debug, throw_place, "Boost error_code: " << err.message());
 			if(count_of_events_loops_.fetch_sub(1, std::memory_order_acq_rel)-1 == 0)	// if(--count_of_events_loops_ == 0)
 			{
+				if(timeouts_enabled_) timing_wheel_.cancel(*this);	// after that the wheel doesn't access to sockets
 				client_socket_.close();
 				server_socket_.close();
-				memorypool_shared_this_.reset();
+#ifdef PORTMAPPING_SPLICE
+				close_pipes();
+#endif
+				backend_->active_connections_.fetch_sub(1, std::memory_order_relaxed);
+				admission_ticket_.release();
+				metrics_->add(T_metrics::connections_closed);
+				slab_.destroy(this);	// the last access to this connection
 			}
 		} );
 	}
@@ -11,63 +11,112 @@
 #define CONNECTION_HPP
 // ----------------------------------------------------------------------------
 #include "handler_allocator.hpp"
+#include "buffer_pool.hpp"
+#include "backend_pool.hpp"
+#include "timing_wheel.hpp"
+#include "metrics.hpp"
+#include "socket_options.hpp"
+#include "admission.hpp"
+#include "bandwidth.hpp"
+#include "pacer.hpp"
+#include "uring.hpp"
+#include "slab_pool.hpp"
 #include "try_catch_to_cerr.hpp"
 // ----------------------------------------------------------------------------
 #include <boost/asio.hpp>
-#include <boost/array.hpp>
-#include <boost/shared_ptr.hpp>
 
 namespace ba = boost::asio;
 namespace bs = boost::system;
 // ----------------------------------------------------------------------------
 #include <atomic>
 // ----------------------------------------------------------------------------
+#if defined(__linux__)
+	#define PORTMAPPING_SPLICE	///< zero-copy relay through the pipe by splice() is available
+#endif
+// ----------------------------------------------------------------------------
+
+/// Relay engine, that moves data between client and server sockets
+enum T_relay_mode {
+	relay_buffered,	///< read_some() to the ring of buffers of connection + gathered async_write_some() from it (any OS)
+	relay_splice,	///< splice() socket->pipe->socket by readiness of reactor, without copy to user-space (only Linux, else relay_buffered)
+	relay_uring 	///< receive and write by io_uring to provided buffers (only Linux with io_uring, else relay_buffered)
+};
+// ----------------------------------------------------------------------------
+
+/// Timeouts of connection in seconds, 0 - disabled
+struct T_connection_timeouts {
+	T_connection_timeouts() : connect_seconds_(10), idle_seconds_(600), lifetime_seconds_(0) {}
+
+	unsigned int connect_seconds_;          ///< max duration of each attempt of connect to the server
+	unsigned int idle_seconds_;             ///< max duration without data in both directions
+	unsigned int lifetime_seconds_;         ///< max duration of connection since accept
+};
+// ----------------------------------------------------------------------------
+
+class T_connection;
+
+enum { connections_in_slab = 64 };              ///< number of connections in one slab of memory pool
+
+/// type of memory pool for objects of connections: slots are reused one by one, when connection is closed
+typedef T_slab_pool<T_connection, connections_in_slab> T_connection_slab;
+// ----------------------------------------------------------------------------
 
 
 ///
 /// Class for handling connection in sync mode
 /// 
+/// Timeouts are checked by the timing wheel of its io_service, in which the connection is scheduled once
+/// for the nearest deadline: activity only updates last_activity_ without access to the wheel.
+/// Limits of bandwidth are enforced by deferral of the next read of direction in the pacer of its io_service.
+/// Relay through io_uring uses the ring of its io_service, if the kernel supports it.
+/// Lifetime is intrusive: one counter of event loops of directions in own cache line,
+/// the last loop destroys the connection and returns its slot to the slab pool.
 ///
-class T_connection {
+class T_connection : private T_timing_wheel::T_timer {
 	struct T_hide_me {};	/// Instead of having to make friend boost::make_shared<connection>()
 public:
-	typedef boost::shared_ptr<T_connection> T_shared_this;
-		
-	/// bind for clients handler with optimized memory allocation
-	template<typename T_handler>
-	inline T_custom_alloc_handler<T_handler> client_bind(T_handler binded_handler) {
-		return make_custom_alloc_handler(client_allocator_, binded_handler);
-	}
+	enum { handler_slot_size = 256 };       ///< size of slot of the arena of handlers for storage boost::bind() and operation of asio
+	enum { handler_slots = 4 };             ///< slots of the arena: reads and writes of both directions at once (accept and connect precede them)
+	typedef T_handler_arena<handler_slot_size, handler_slots> T_arena;
 
-	/// bind for servers handler with optimized memory allocation
+	/// bind for handler with memory allocation from the arena of connection
 	template<typename T_handler>
-	inline T_custom_alloc_handler<T_handler> server_bind(T_handler binded_handler) {
-		return make_custom_alloc_handler(server_allocator_, binded_handler);
+	inline T_custom_alloc_handler<T_handler, T_arena> arena_bind(T_handler binded_handler) {
+		return make_custom_alloc_handler(handler_arena_, binded_handler);
 	}
 	
 	/// 
 	/// Constructor for class, initilize socket for this connection
 	/// 
+	/// @param slab memory pool, to which the slot of this connection is returned at close
 	/// @param io_service reference to io_service of executors in which this connection will work
+	/// @param timing_wheel reference to timing wheel of this io_service
+	/// @param pacer reference to pacer of deferred reads of this io_service
+	/// @param uring ring of io_uring of this io_service, NULL - relay through io_uring isn't available
 	/// @param T_hide_me() temporary object that made a constructor private 
 	/// 
 	/// @return nothing
 	///
-	T_connection(ba::io_service& io_service, T_hide_me);
+	T_connection(T_connection_slab& slab, ba::io_service& io_service, T_timing_wheel& timing_wheel, T_pacer& pacer, 
+				 T_uring *const uring, T_hide_me);
 
 	~T_connection();
 
 	/// 
 	/// Create new connection, throught placement new 
 	/// 
-	/// @param memory_pool_ptr shared pointer to the allocated memory poll for connections
-	/// @param i_connect index of current connection in memory pool 
+	/// @param slab memory pool of connections, from which memory is taken
+	/// @param memory raw memory for connection (slot of slab)
 	/// @param io_service io_service in which this connection will work
+	/// @param timing_wheel timing wheel of this io_service
+	/// @param pacer pacer of deferred reads of this io_service
+	/// @param uring ring of io_uring of this io_service, NULL - relay through io_uring isn't available
 	/// 
 	/// @return pointer to newly allocated object
 	///
-	static inline T_connection *const T_connection::create(T_connection *const memory_pool_raw_ptr, const size_t i_connect, ba::io_service& io_service) {
-		return new (&memory_pool_raw_ptr[i_connect]) T_connection(io_service, T_hide_me());
+	static inline T_connection *create(T_connection_slab& slab, void *const memory, ba::io_service& io_service, 
+											 T_timing_wheel& timing_wheel, T_pacer& pacer, T_uring *const uring) {
+		return new (memory) T_connection(slab, io_service, timing_wheel, pacer, uring, T_hide_me());
 	}
 
 	/// 
@@ -76,86 +125,352 @@ public:
 	/// 
 	/// @return reference to socket
 	///
-	inline ba::ip::tcp::socket& T_connection::socket() {
+	inline ba::ip::tcp::socket& socket() {
 		return client_socket_;
 	}
 
+	/// Next connection in the batch of accepted connections, which is handed to io_service of executors by one post()
+	inline T_connection*& next_accepted() { return next_accepted_; }
+
 	/// 
 	/// Perform all input/output operations in async mode:
-	/// for a start try to connect to endpoint by endpoint_iterator
+	/// for a start try to connect to the best of endpoints
 	/// 
-	/// @param shared_this shared pointer of this (current connection)
-	/// @param endpoint_iterator forward iterable object, that points to the connection endpoints of remote server
+	/// @param backend remote server selected for this connection
+	/// @param metrics counters of port mapping
+	/// @param admission_ticket admission of this connection, it's released when the connection is closed
+	/// @param shaper limits of bandwidth of this connection
+	/// @param socket_options options of client socket and of server socket (it must live longer than connection)
+	/// @param relay_mode relay engine, that will be used after connect to the server
+	/// @param timeouts timeouts of connect, idle and lifetime
 	///
-	void T_connection::run(T_shared_this shared_this, const ba::ip::tcp::resolver::iterator endpoint_iterator);
+	void run(T_backend& backend, T_metrics& metrics, const T_admission_ticket& admission_ticket,
+		const T_shaper& shaper, const T_socket_options& socket_options, const T_relay_mode relay_mode = relay_buffered, 
+		const T_connection_timeouts& timeouts = T_connection_timeouts());
 
 private:
+	/// Deferred read of one direction of relay, it's resumed by the pacer
+	class T_deferred_read : public T_pacer::T_task {
+	public:
+		T_deferred_read(T_connection& connection, const T_shaper::T_direction direction) 
+			: connection_(connection), direction_(direction) {}
+		virtual void on_resume() { connection_.resume_read(direction_); }
+	private:
+		T_connection& connection_;
+		const T_shaper::T_direction direction_;
+	};
+
 	/// 
-	/// Try to connect to the server
+	/// State of one direction of buffered relay: ring of buffers from the buffer pool, to which data are read 
+	/// from one socket, while earlier data are written to other socket by one gathered write of all filled buffers.
+	/// Read stops only when the ring is full (backpressure). Read and write handlers of direction can run
+	/// in different threads, so the state is changed under spinlock, but syscalls are made without it
+	///
+	struct T_ring_relay {
+		enum { max_chunks = 4 };            ///< buffers in the ring
+
+		/// Buffer of the ring
+		struct T_chunk {
+			char *buffer_;                  ///< buffer from the buffer pool, NULL - it isn't taken
+			size_t size_class_;             ///< size class of buffer_
+			size_t length_;                 ///< bytes of data in buffer_
+		};
+
+		T_ring_relay(ba::ip::tcp::socket& from, ba::ip::tcp::socket& to, const T_shaper::T_direction direction) 
+			: from_(from), to_(to), direction_(direction), head_(0), count_(0), offset_(0), 
+			  size_class_(initial_size_class), reading_(false), writing_(false), read_end_(false)
+		{
+			for(auto &i : chunks_) i.buffer_ = NULL, i.size_class_ = 0, i.length_ = 0;
+			lock_.clear();
+		}
+
+		ba::ip::tcp::socket& from_;         ///< socket, from which data are read
+		ba::ip::tcp::socket& to_;           ///< socket, to which data are written
+		const T_shaper::T_direction direction_;
+		T_chunk chunks_[max_chunks];        ///< ring of buffers
+		size_t head_;                       ///< index of the first buffer with data, which aren't written (only writer changes it)
+		size_t count_;                      ///< number of buffers with data: reader increments, writer decrements
+		size_t offset_;                     ///< bytes of the first buffer, which have been written
+		size_t size_class_;                 ///< size class of buffer for next read
+		bool reading_;                      ///< read is in progress: wait of readiness, or deferred by the pacer
+		bool writing_;                      ///< gathered write is in progress
+		bool read_end_;                     ///< read is finished by eof or error
+		bs::error_code err_;                ///< eof or the first error of relay of this direction
+		std::atomic_flag lock_;             ///< spinlock of state
+	};
+
+#ifdef PORTMAPPING_URING
+	/// State of one direction of relay through io_uring: receive to provided buffer, then write of it to other socket
+	struct T_uring_relay : public T_uring::T_operation {
+		enum { tag_recv, tag_write };       ///< tags of completions
+
+		T_uring_relay(T_connection& connection, const T_shaper::T_direction direction) 
+			: connection_(connection), direction_(direction), from_fd_(-1), to_fd_(-1), pending_(0), buffer_(-1), 
+			  offset_(0), length_(0), eof_(false), no_buffer_(false) {}
+		virtual void on_complete(const unsigned int tag, const int result, const int buffer) { 
+			connection_.handle_uring(*this, tag, result, buffer); 
+		}
+
+		T_connection& connection_;
+		const T_shaper::T_direction direction_;
+		int from_fd_;                       ///< socket, from which data are received, -1 - relay through io_uring isn't started
+		int to_fd_;                         ///< socket, to which data are written
+		unsigned int pending_;              ///< submitted operations, which aren't completed yet
+		int buffer_;                        ///< provided buffer with data, which aren't written yet, -1 - there isn't it
+		size_t offset_;                     ///< bytes of buffer_, which have been written
+		size_t length_;                     ///< bytes of data in buffer_
+		bs::error_code err_;                ///< the first error of relay of this direction
+		bool eof_;                          ///< the socket, from which data are received, is closed for sending
+		bool no_buffer_;                    ///< receive has failed, because all provided buffers are in use
+	};
+#endif
+
+	/// 
+	/// Try to connect to the server: healthy endpoints first, unhealthy as last resort
 	/// 
 	/// @param err reference to error code returned by async_connect
-	/// @param endpoint_iterator forward iterable object, that points to the connection endpoints of remote server
-	/// @param first_time flag that show that function launched at first time or no
+	/// @param i_endpoint index of endpoint of previous connect attempt, -1 if function launched at first time
+	///
+	void handle_connect(const boost::system::error_code& err, const int i_endpoint);
+
+	/// Stop connect after idle or lifetime timeout without report of failure of endpoint and without next attempt
+	void abort_connect(const boost::system::error_code& err);
+
+	/// 
+	/// Start relay in both directions after connect to the server
+	///
+	void start_relay();
+
+	/// 
+	/// Wait for readiness of the socket, from which data of direction are read, without holding a buffer
+	/// 
+	/// @param relay direction of relay
 	///
-	void T_connection::handle_connect(const boost::system::error_code& err,
-									ba::ip::tcp::resolver::iterator endpoint_iterator, const bool first_time);
+	void start_ring_read(T_ring_relay& relay);
 
 	/// 
-	/// Writing data to the client
-	/// after read them from a server to server_buffer_
+	/// Read data to free buffers of the ring after readiness of socket, while the socket has data
+	/// and the ring isn't full, and start gathered write, if it isn't in progress
 	/// 
+	/// @param relay direction of relay
 	/// @param err 
-	/// @param len length of data in bytes, that have been read
 	///
-	void T_connection::handle_read_from_server(const bs::error_code& err, const size_t len);
+	void handle_ring_readable(T_ring_relay& relay, const bs::error_code& err);
 
 	/// 
-	/// Reading data from a server to server_buffer_
-	/// after yet another write data to the client
+	/// Gathered write of all filled buffers of the ring
+	/// 
+	/// @param relay direction of relay
 	///
+	void start_ring_write(T_ring_relay& relay);
+
+	/// 
+	/// Return written buffers to the buffer pool, continue write of the rest, resume read stopped by full ring,
+	/// or end direction after eof or error
+	/// 
+	/// @param relay direction of relay
 	/// @param err 
-	/// @param len length of data in bytes, that have been writen
+	/// @param len length of data in bytes, that have been written
 	///
-	void T_connection::handle_write_to_client(const bs::error_code& err, const size_t len);
+	void handle_ring_write(T_ring_relay& relay, const bs::error_code& err, const size_t len);
 
 	/// 
-	/// Writing data to the server
-	/// after read them from a client to client_buffer_
+	/// Read is finished by eof or error: end direction, if write isn't in progress, 
+	/// else it will be ended by write (after the rest of data, if it's eof)
 	/// 
-	/// @param err 
-	/// @param len length of data in bytes, that have been read
+	/// @param relay direction of relay
+	/// @param err eof or error of read
+	///
+	void finish_ring_read(T_ring_relay& relay, const bs::error_code& err);
+
+	/// 
+	/// Both reader and writer of direction are stopped: return buffers and end direction
+	/// 
+	/// @param relay direction of relay
+	///
+	void end_ring(T_ring_relay& relay);
+
+	/// Return all buffers of the ring to the buffer pool
+	void release_ring(T_ring_relay& relay);
+
+	/// 
+	/// Return buffer to the buffer pool, if it is taken
+	/// 
+	/// @param buffer reference to pointer to the buffer, it will be set to NULL
+	/// @param size_class size class of the buffer
 	///
-	void T_connection::handle_read_from_client(const bs::error_code& err, const size_t len);
+	inline void release_buffer(char *&buffer, const size_t size_class);
 
 	/// 
-	/// Reading data from a client to client_buffer_
-	/// after yet another write data to the server
+	/// Defer the next read of direction in the pacer, if limits of bandwidth require it
+	/// 
+	/// @param direction direction of relay
+	/// 
+	/// @return true - the read is deferred, and it will be started by resume_read()
+	///
+	inline bool defer_read(const T_shaper::T_direction direction);
+
+	/// 
+	/// Start the deferred read of direction: wait for readiness of the socket, from which data are read
+	/// 
+	/// @param direction direction of relay
 	///
+	void resume_read(const T_shaper::T_direction direction);
+
+#ifdef PORTMAPPING_SPLICE
+	/// 
+	/// Create pipes and start relay in both directions through splice()
+	/// 
+	/// @return true if pipes have been created, false - if need to use buffered relay
+	///
+	bool start_splice();
+
+	/// 
+	/// Moving data from the client to the server through client_pipe_
+	/// after readiness of client socket for read or server socket for write
+	/// 
 	/// @param err 
-	/// @param len length of data in bytes, that have been writen
 	///
-	void T_connection::handle_write_to_server(const bs::error_code& err, const size_t len);
+	void handle_splice_client_to_server(const bs::error_code& err);
 
 	/// 
-	/// Close both sockets: for client and server
+	/// Moving data from the server to the client through server_pipe_
+	/// after readiness of server socket for read or client socket for write
 	/// 
 	/// @param err 
-	/// @param throw_place string with filename, its datetime, line number in file and function name which call this shutdown() function 
 	///
-	inline void T_connection::shutdown(const bs::error_code& err, const std::string& throw_place);
+	void handle_splice_server_to_client(const bs::error_code& err);
+
+	/// 
+	/// Move data from socket to the pipe and from the pipe to another socket, until one of them would block
+	/// 
+	/// @param from socket from which data are read
+	/// @param to socket to which data are written
+	/// @param pipe pipe through which data are moved: [0] - read end, [1] - write end
+	/// @param pipe_bytes number of bytes which are in the pipe, but not yet written to the socket
+	/// @param bytes_counter counter of bytes of this direction
+	/// @param handler completion handler for readiness wait of socket
+	/// 
+	/// @return error code: eof if the socket from which data are read was closed
+	///
+	template<typename T_handler>
+	bs::error_code splice_relay(ba::ip::tcp::socket& from, ba::ip::tcp::socket& to, const int (&pipe)[2], 
+		size_t& pipe_bytes, const T_metrics::T_counter bytes_counter, T_handler handler);
+
+	/// Close both pipes if they have been opened
+	void close_pipes();
+#endif
+
+#ifdef PORTMAPPING_URING
+	/// 
+	/// Start relay in both directions through io_uring
+	///
+	void start_uring();
+
+	/// 
+	/// Update state of direction by completion of its operation, and continue relay when all of them are completed
+	/// 
+	/// @param relay direction of relay
+	/// @param tag tag of operation
+	/// @param result result of operation: bytes, or -errno
+	/// @param buffer index of provided buffer, which has been taken by receive, or -1
+	///
+	void handle_uring(T_uring_relay& relay, const unsigned int tag, const int result, const int buffer);
+
+	/// 
+	/// Next step of direction, which hasn't operations in progress: end of relay, write of the rest of data,
+	/// or receive (it's linked to write, if bandwidth isn't limited; else it can be deferred)
+	/// 
+	/// @param relay direction of relay
+	///
+	void continue_uring(T_uring_relay& relay);
+#endif
+
+	/// 
+	/// Run by the timing wheel at the nearest deadline: interrupt connect attempt or shutdown both sockets,
+	/// if one of timeouts is expired
+	/// 
+	/// @param now current tick of the timing wheel
+	/// 
+	/// @return tick of the next deadline, or 0 if there are no deadlines
+	///
+	virtual uint64_t on_timer(const uint64_t now);
+
+	/// Tick of the nearest deadline of timeouts, 0 - there are no deadlines
+	uint64_t next_deadline() const;
+
+	/// Schedule connection in the timing wheel for the nearest deadline, if any of timeouts is enabled
+	void schedule_timeouts();
+
+	/// Remember time of the last activity for idle timeout
+	inline void touch() { last_activity_.store(timing_wheel_.now(), std::memory_order_relaxed); }
+
+	/// 
+	/// End of relay in one direction: EOF is forwarded as shutdown of sending to the socket of this direction,
+	/// on error both directions are aborted
+	/// 
+	/// @param to socket to which data of this direction were written
+	/// @param err eof - the socket from which data were read is closed for sending, else error of relay
+	/// @param throw_place filename, line number in file and function name which call this function
+	///
+	inline void end_direction(ba::ip::tcp::socket& to, const bs::error_code& err, const T_source_location& throw_place);
+
+	/// 
+	/// Close both sockets: for client and server, when both directions are ended
+	/// 
+	/// @param err error, which ended the direction of relay (it is logged at debug level)
+	/// @param throw_place filename, line number in file and function name which call this shutdown() function
+	///
+	inline void shutdown(const bs::error_code& err, const T_source_location& throw_place);
 
-	enum { buffer_size = 16384 };           ///< size of buffer for storage input/output data
-	enum { allocator_size = 1024 };         ///< size of buffer for handler allocator for storage boost::bind()
+	enum { initial_size_class = 1 };        ///< size class of buffers from T_buffer_pool for the first read (4 KB)
+	enum { pipe_size = 65536 };             ///< size of pipe for splice(), and max size of data moved per one call
+	enum { splice_chunks_per_event = 16 };  ///< max number of chunks moved per one readiness event, then wait for reactor again
+	enum { cache_line_size = 64 };          ///< padding of the counter of event loops
 
-	std::atomic<int> count_of_events_loops_;///< atomic counter of event loops (client/server)
-	T_shared_this memorypool_shared_this_;  ///< shared pointer of this with memory-pool counter
+	char padding_before_loops_[cache_line_size];
+	std::atomic<int> count_of_events_loops_;///< intrusive counter of lifetime: event loops (client/server), at 0 the connection is destroyed
+	char padding_after_loops_[cache_line_size - sizeof(std::atomic<int>)];
+	T_connection_slab& slab_;               ///< memory pool, to which the slot of this connection is returned
 	ba::io_service& io_service_;            ///< reference to io_service, in which work this connection
+	T_timing_wheel& timing_wheel_;          ///< reference to timing wheel of io_service_
+	T_pacer& pacer_;                        ///< reference to pacer of deferred reads of io_service_
+	T_uring *const uring_;                  ///< ring of io_uring of io_service_, NULL - it isn't available
 	ba::ip::tcp::socket client_socket_;     ///< socket, associated with client
 	ba::ip::tcp::socket server_socket_;     ///< socket, associated with server
-	boost::array<char, buffer_size> client_buffer_;        ///< buffer, associated with client
-	boost::array<char, buffer_size> server_buffer_;        ///< buffer, associated with server
-	T_handler_allocator<allocator_size> client_allocator_; ///< allocator, to use for handler-based custom memory allocation for clients handlers
-	T_handler_allocator<allocator_size> server_allocator_; ///< allocator, to use for handler-based custom memory allocation for servers handlers
+	T_arena handler_arena_;                 ///< arena, to use for handler-based custom memory allocation for all handlers of connection
+	T_relay_mode relay_mode_;               ///< relay engine requested for this connection
+	T_backend *backend_;                    ///< remote server, to which this connection is counted as active
+	T_metrics *metrics_;                    ///< counters of port mapping
+	T_admission_ticket admission_ticket_;   ///< counters of limits of connections, which are released at close
+	T_shaper shaper_;                       ///< buckets of limits of bandwidth
+	T_deferred_read client_deferred_read_;  ///< deferred read from client
+	T_deferred_read server_deferred_read_;  ///< deferred read from server
+	const T_socket_options *socket_options_;///< options of server socket, which are set before each connect attempt
+	T_endpoint_table::T_endpoints_ptr remote_endpoints_;   ///< endpoints of remote server (only while connect is in progress)
+	uint64_t tried_endpoints_;              ///< bit mask of indexes of endpoints, connect to which has been tried
+	int64_t connect_start_us_;              ///< time of start of current connect attempt (steady clock, us)
+	bool timeouts_enabled_;                 ///< whether any of timeouts is enabled (else the wheel isn't used)
+	uint64_t connect_ticks_;                ///< timeout of connect attempt in ticks of the wheel, 0 - disabled
+	uint64_t idle_ticks_;                   ///< idle timeout in ticks of the wheel, 0 - disabled
+	uint64_t lifetime_deadline_;            ///< tick of the end of lifetime, 0 - unlimited
+	std::atomic<uint64_t> connect_deadline_;///< tick of the end of current connect attempt, 0 - there isn't attempt or it is interrupted
+	std::atomic<uint64_t> last_activity_;   ///< tick of the last read of data from any side
+	std::atomic<bool> expired_;             ///< idle or lifetime timeout is expired: connection is aborted, also during connect
+	std::atomic_flag server_socket_lock_;   ///< spinlock for reopen of server_socket_ between connect attempts vs. its interrupt by timeout
+	T_connection *next_accepted_;           ///< next connection in the batch of accepted connections, NULL - the last one
+	T_ring_relay client_ring_relay_;        ///< buffered relay from client to server
+	T_ring_relay server_ring_relay_;        ///< buffered relay from server to client
+#ifdef PORTMAPPING_SPLICE
+	int client_pipe_[2];                    ///< pipe for data from client to server: [0] - read end, [1] - write end
+	int server_pipe_[2];                    ///< pipe for data from server to client: [0] - read end, [1] - write end
+	size_t client_pipe_bytes_;              ///< bytes in client_pipe_, that not yet written to the server
+	size_t server_pipe_bytes_;              ///< bytes in server_pipe_, that not yet written to the client
+#endif
+#ifdef PORTMAPPING_URING
+	T_uring_relay client_uring_relay_;      ///< relay through io_uring from client to server
+	T_uring_relay server_uring_relay_;      ///< relay through io_uring from server to client
+#endif
 };
 // ----------------------------------------------------------------------------
 
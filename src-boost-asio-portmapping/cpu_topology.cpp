@@ -0,0 +1,252 @@
+/**
+ * @file   cpu_topology.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief CPUs and NUMA nodes: placement of threads, memory of pools and new connections
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "cpu_topology.hpp"
+
+#include <boost/thread/thread.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <new>
+#include <cstdint>
+// ----------------------------------------------------------------------------
+#ifdef PORTMAPPING_NUMA
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+// ----------------------------------------------------------------------------
+
+/// Topology of this machine
+const T_cpu_topology& T_cpu_topology::instance() {
+	static const T_cpu_topology topology;
+	return topology;
+}
+// ----------------------------------------------------------------------------
+
+#ifdef PORTMAPPING_NUMA
+/// Content of file of sysfs, empty if there isn't it
+static std::string read_sysfs(const std::string& file_name) {
+	std::string value;
+	std::ifstream(file_name.c_str()) >> value;
+	return value;
+}
+#endif
+
+T_cpu_topology::T_cpu_topology()
+	: nodes_(1)
+{
+#ifdef PORTMAPPING_NUMA
+	try {
+		online_cpus_ = parse_list(read_sysfs("/sys/devices/system/cpu/online"));
+		const std::vector<unsigned int> nodes = parse_list(read_sysfs("/sys/devices/system/node/online"));
+		if(!nodes.empty()) nodes_ = nodes.size();
+		for(auto node : nodes) {
+			const std::vector<unsigned int> cpus = parse_list(read_sysfs("/sys/devices/system/node/node" +
+				boost::lexical_cast<std::string>(node) + "/cpulist"));
+			for(auto cpu : cpus) {
+				if(cpu >= node_of_cpu_.size()) node_of_cpu_.resize(cpu + 1, 0);
+				node_of_cpu_[cpu] = node;
+			}
+		}
+	} catch(const std::exception&) {
+		online_cpus_.clear(), node_of_cpu_.clear(), nodes_ = 1;	// sysfs isn't mounted: without NUMA
+	}
+
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	if(::sched_getaffinity(0, sizeof(cpuset), &cpuset) == 0) {
+		for(unsigned int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+			if(CPU_ISSET(cpu, &cpuset)) allowed_cpus_.push_back(cpu);
+		// threads pinned in order of allowed CPUs fill one node before the next one
+		std::stable_sort(allowed_cpus_.begin(), allowed_cpus_.end(),
+			[this](const unsigned int a, const unsigned int b) { return node_of_cpu(a) < node_of_cpu(b); });
+	}
+#endif
+	if(allowed_cpus_.empty())
+		for(unsigned int cpu = 0; cpu < boost::thread::hardware_concurrency(); ++cpu) allowed_cpus_.push_back(cpu);
+	if(online_cpus_.empty()) online_cpus_ = allowed_cpus_;
+}
+// ----------------------------------------------------------------------------
+
+/// NUMA node of CPU, on which current thread runs now, 0 if it's unknown
+unsigned int T_cpu_topology::current_node() const {
+#ifdef PORTMAPPING_NUMA
+	const int cpu = ::sched_getcpu();
+	if(cpu >= 0) return node_of_cpu(static_cast<unsigned int>(cpu));
+#endif
+	return 0;
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Parse list of numbers with ranges, as in sysfs and taskset: "0-3,8,10-11"
+///
+/// @param list list, empty - no numbers
+///
+/// @return numbers in order of the list, exception std::runtime_error if the list is wrong
+///
+std::vector<unsigned int> T_cpu_topology::parse_list(const std::string& list) {
+	std::vector<unsigned int> numbers;
+	std::istringstream items(list);
+	std::string item;
+	while(std::getline(items, item, ',')) {
+		item.erase(std::remove(item.begin(), item.end(), ' '), item.end());
+		if(item.empty()) continue;
+		try {
+			const size_t dash = item.find('-');
+			const unsigned int first = boost::lexical_cast<unsigned int>(item.substr(0, dash));
+			const unsigned int last = (dash == std::string::npos) ? first : boost::lexical_cast<unsigned int>(item.substr(dash + 1));
+			if(last < first) throw std::runtime_error("range is reversed");
+			for(unsigned int i = first; i <= last; ++i) numbers.push_back(i);
+		} catch(const std::exception&) {
+			throw std::runtime_error("Wrong list of CPUs: " + list);
+		}
+	}
+	return numbers;
+}
+// ----------------------------------------------------------------------------
+
+/// Format numbers as list with ranges: "0-3,8,10-11"
+std::string T_cpu_topology::format_list(const std::vector<unsigned int>& numbers) {
+	std::ostringstream list;
+	for(size_t first = 0; first < numbers.size(); ) {
+		size_t last = first;
+		while(last + 1 < numbers.size() && numbers[last + 1] == numbers[last] + 1) ++last;
+		list << (first ? "," : "") << numbers[first];
+		if(last != first) list << "-" << numbers[last];
+		first = last + 1;
+	}
+	return list.str();
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Allocate memory, pages of which are taken preferably from NUMA node
+///
+/// @param size size of memory in bytes
+/// @param node NUMA node, -1 - any node (memory from the heap)
+///
+/// @return pointer to memory, exception std::bad_alloc if there isn't memory
+///
+void* allocate_on_node(const size_t size, const int node) {
+#if defined(PORTMAPPING_NUMA) && defined(SYS_mbind)
+	if(node >= 0) {
+		void *const memory = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(memory == MAP_FAILED) throw std::bad_alloc();
+		if(node < T_cpu_topology::max_node_ids) {
+			enum { mpol_preferred = 1 };	// MPOL_PREFERRED: other nodes are used, when this one is full
+			const size_t bits = 8 * sizeof(unsigned long);
+			unsigned long mask[T_cpu_topology::max_node_ids / bits] = {};
+			mask[node / bits] = 1UL << (node % bits);
+			// pages aren't touched yet: they will be taken from the node at first access, in any thread
+			::syscall(SYS_mbind, memory, size, mpol_preferred, mask, T_cpu_topology::max_node_ids + 1, 0);	// failure is not fatal
+		}
+		return memory;
+	}
+#endif
+	return ::operator new(size);
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Free memory from allocate_on_node()
+///
+/// @param pointer pointer to memory
+/// @param size size of memory in bytes, the same as in allocate_on_node()
+/// @param node NUMA node, the same as in allocate_on_node()
+///
+void deallocate_on_node(void *const pointer, const size_t size, const int node) {
+#if defined(PORTMAPPING_NUMA) && defined(SYS_mbind)
+	if(node >= 0) {
+		::munmap(pointer, size);
+		return;
+	}
+#endif
+	::operator delete(pointer);
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Size of page of memory from allocate_on_node() for a node: any part of it, which is aligned to pages,
+/// can be freed separately by deallocate_on_node() (munmap)
+///
+/// @return size of page in bytes, 0 if memory isn't placed on nodes
+///
+size_t node_page_size() {
+#if defined(PORTMAPPING_NUMA) && defined(SYS_mbind)
+	const long page_size = ::sysconf(_SC_PAGESIZE);
+	return (page_size > 0) ? static_cast<size_t>(page_size) : 0;
+#else
+	return 0;
+#endif
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Steer new connections (or datagrams) of the group of SO_REUSEPORT sockets to the socket,
+/// which thread runs on the CPU, that has received their packets from NIC, or else on the same NUMA node.
+/// Classic BPF program of the group: A = CPU of packet, then one comparison per online CPU;
+/// index of socket out of the group (for CPUs of nodes without threads) means selection by hash.
+///
+/// @param fd any socket of the group
+/// @param socket_cpus CPU of thread of each socket of the group, in order in which they were bound
+///
+/// @return true if the program of steering is attached to the group (Linux >= 4.5, CPUs of sockets are different)
+///
+bool steer_reuseport_by_cpu(const int fd, const std::vector<unsigned int>& socket_cpus) {
+#if defined(PORTMAPPING_NUMA) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	const T_cpu_topology& topology = T_cpu_topology::instance();
+	enum { max_cpus = (BPF_MAXINSNS - 2) / 2 };
+	enum { by_hash = 0xFFFFFFFF };
+	for(size_t i = 0; i < socket_cpus.size(); ++i)
+		for(size_t j = i + 1; j < socket_cpus.size(); ++j)
+			if(socket_cpus[i] == socket_cpus[j]) return false;	// more threads than CPUs: only hash balances them
+
+	std::vector<size_t> node_next(T_cpu_topology::max_node_ids, 0);	// round robin of sockets of each node
+	std::vector<struct sock_filter> code;
+	const struct sock_filter load_cpu = BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU));
+	code.push_back(load_cpu);
+	for(auto cpu : topology.online_cpus()) {
+		if(code.size() >= 1 + 2 * max_cpus) break;
+		uint32_t index = by_hash;
+		for(size_t i = 0; i < socket_cpus.size() && index == by_hash; ++i)
+			if(socket_cpus[i] == cpu) index = static_cast<uint32_t>(i);
+		if(index == by_hash) {
+			// CPU without thread: the next socket of its node
+			const unsigned int node = topology.node_of_cpu(cpu);
+			std::vector<size_t> node_sockets;
+			for(size_t i = 0; i < socket_cpus.size(); ++i)
+				if(topology.node_of_cpu(socket_cpus[i]) == node) node_sockets.push_back(i);
+			if(node_sockets.empty()) continue;
+			index = static_cast<uint32_t>(node_sockets[node_next[node % node_next.size()]++ % node_sockets.size()]);
+		}
+		const struct sock_filter compare = BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cpu, 0, 1);
+		const struct sock_filter ret_index = BPF_STMT(BPF_RET | BPF_K, index);
+		code.push_back(compare);
+		code.push_back(ret_index);
+	}
+	const struct sock_filter ret_hash = BPF_STMT(BPF_RET | BPF_K, by_hash);
+	code.push_back(ret_hash);
+
+	struct sock_fprog program;
+	program.len = static_cast<unsigned short>(code.size());
+	program.filter = &code[0];
+	return ::setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == 0;
+#else
+	return false;
+#endif
+}
+// ----------------------------------------------------------------------------
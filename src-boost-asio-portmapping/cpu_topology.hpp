@@ -0,0 +1,116 @@
+/**
+ * @file   cpu_topology.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief CPUs and NUMA nodes: placement of threads, memory of pools and new connections
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef CPU_TOPOLOGY_HPP
+#define CPU_TOPOLOGY_HPP
+// ----------------------------------------------------------------------------
+#include <boost/noncopyable.hpp>
+// ----------------------------------------------------------------------------
+#include <vector>
+#include <string>
+#include <cstddef>
+// ----------------------------------------------------------------------------
+#if defined(__linux__)
+	#define PORTMAPPING_NUMA	///< NUMA nodes from sysfs, memory of pools is placed on node by mbind() (without libnuma)
+#endif
+// ----------------------------------------------------------------------------
+
+///
+/// CPUs, on which the process is allowed to run, and their NUMA nodes.
+/// On Linux they are read once from /sys/devices/system (cpu/online, node/online, node/nodeN/cpulist)
+/// and from affinity of the process, on other OS all CPUs are on node 0.
+///
+class T_cpu_topology : private boost::noncopyable {
+public:
+	enum { max_node_ids = 64 };             ///< memory is placed only on nodes with smaller id
+
+	/// Topology of this machine
+	static const T_cpu_topology& instance();
+
+	///
+	/// Parse list of numbers with ranges, as in sysfs and taskset: "0-3,8,10-11"
+	///
+	/// @param list list, empty - no numbers
+	///
+	/// @return numbers in order of the list, exception std::runtime_error if the list is wrong
+	///
+	static std::vector<unsigned int> parse_list(const std::string& list);
+
+	/// Format numbers as list with ranges: "0-3,8,10-11"
+	static std::string format_list(const std::vector<unsigned int>& numbers);
+
+	/// CPUs, on which the process is allowed to run, grouped by NUMA nodes
+	inline const std::vector<unsigned int>& allowed_cpus() const { return allowed_cpus_; }
+
+	/// All online CPUs of machine (also outside of affinity of the process, e.g. CPUs of interrupts of NIC)
+	inline const std::vector<unsigned int>& online_cpus() const { return online_cpus_; }
+
+	/// NUMA node of CPU, 0 if it's unknown
+	inline unsigned int node_of_cpu(const unsigned int cpu) const { return (cpu < node_of_cpu_.size()) ? node_of_cpu_[cpu] : 0; }
+
+	/// Number of online NUMA nodes, 1 on machines without NUMA
+	inline size_t nodes() const { return nodes_; }
+
+	/// NUMA node of CPU, on which current thread runs now, 0 if it's unknown
+	unsigned int current_node() const;
+
+private:
+	T_cpu_topology();
+
+	std::vector<unsigned int> allowed_cpus_;    ///< CPUs of affinity of the process, grouped by nodes
+	std::vector<unsigned int> online_cpus_;     ///< all online CPUs
+	std::vector<unsigned int> node_of_cpu_;     ///< NUMA node by id of CPU
+	size_t nodes_;                              ///< number of online NUMA nodes
+};
+// ----------------------------------------------------------------------------
+
+///
+/// Allocate memory, pages of which are taken preferably from NUMA node (by mbind() on Linux),
+/// so pools of executors are local to their threads, even if they grow in other threads
+///
+/// @param size size of memory in bytes
+/// @param node NUMA node, -1 - any node (memory from the heap)
+///
+/// @return pointer to memory, exception std::bad_alloc if there isn't memory
+///
+void* allocate_on_node(const size_t size, const int node);
+
+///
+/// Free memory from allocate_on_node()
+///
+/// @param pointer pointer to memory
+/// @param size size of memory in bytes, the same as in allocate_on_node()
+/// @param node NUMA node, the same as in allocate_on_node()
+///
+void deallocate_on_node(void *const pointer, const size_t size, const int node);
+
+///
+/// Size of page of memory from allocate_on_node() for a node: any part of it, which is aligned to pages,
+/// can be freed separately by deallocate_on_node()
+///
+/// @return size of page in bytes, 0 if memory isn't placed on nodes (it is from the heap and it is freed only entirely)
+///
+size_t node_page_size();
+// ----------------------------------------------------------------------------
+
+///
+/// Steer new connections (or datagrams) of the group of SO_REUSEPORT sockets to the socket,
+/// which thread runs on the CPU, that has received their packets from NIC (by RSS queue and its interrupt),
+/// or else to a socket on the same NUMA node. Packets of other CPUs are balanced by hash.
+///
+/// @param fd any socket of the group
+/// @param socket_cpus CPU of thread of each socket of the group, in order in which they were bound
+///
+/// @return true if the program of steering is attached to the group (Linux >= 4.5, CPUs of sockets are different)
+///
+bool steer_reuseport_by_cpu(const int fd, const std::vector<unsigned int>& socket_cpus);
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // CPU_TOPOLOGY_HPP
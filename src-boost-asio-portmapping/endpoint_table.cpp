@@ -0,0 +1,204 @@
+/**
+ * @file   endpoint_table.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Table of resolved endpoints of remote server with health tracking
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "endpoint_table.hpp"
+#include "log.hpp"
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <chrono>
+#include <limits>
+#include <algorithm>
+// ----------------------------------------------------------------------------
+
+T_endpoint_table::T_endpoint::T_endpoint(T_endpoint_table& table, const ba::ip::tcp::endpoint& endpoint)
+	: table_(table), endpoint_(endpoint), failures_(0), down_until_ms_(0), connect_latency_us_(0)
+{
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Resolve remote address in sync mode, and start refresh in async mode
+/// 
+/// @param io_service io_service, in which resolver works
+/// @param remote_address address of remote server
+/// @param remote_port port of remote server
+/// @param refresh_seconds period of re-resolve (TTL of resolved endpoints), 0 - resolve only once
+///
+T_endpoint_table::T_endpoint_table(ba::io_service& io_service, const std::string& remote_address, unsigned int remote_port,
+								   unsigned int refresh_seconds)
+	: remote_address_(remote_address),
+	  remote_port_(boost::lexical_cast<std::string>(remote_port)),
+	  refresh_seconds_(refresh_seconds),
+	  resolver_(io_service),
+	  refresh_timer_(io_service),
+	  healthy_from_ms_(0)
+{
+	// Resolve remote address:port of server
+	ba::ip::tcp::resolver::query query(remote_address_, remote_port_);
+	endpoints_ = make_endpoints(resolver_.resolve(query), NULL);
+	start_refresh_timer();
+}
+// ----------------------------------------------------------------------------
+
+/// Stop refresh
+void T_endpoint_table::stop() {
+	bs::error_code ec;
+	refresh_timer_.cancel(ec);
+	resolver_.cancel();
+}
+// ----------------------------------------------------------------------------
+
+/// Current time of steady clock in ms
+int64_t T_endpoint_table::now_ms() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// Current time of steady clock in us
+int64_t T_endpoint_table::now_us() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Select best endpoint among not yet tried: healthy in order of resolve, 
+/// else unhealthy, which failed the earliest
+/// 
+/// @param endpoints list of endpoints
+/// @param tried_mask bit mask of indexes of already tried endpoints
+/// 
+/// @return index of endpoint, or -1 if all endpoints have been tried
+///
+int T_endpoint_table::select(const T_endpoints& endpoints, const uint64_t tried_mask) {
+	const int64_t now = now_ms();
+	const size_t size = (endpoints.size() < size_t(max_endpoints)) ? endpoints.size() : size_t(max_endpoints);
+	int unhealthy = -1;
+	int64_t unhealthy_until = 0;
+	for(size_t i = 0; i < size; ++i) {
+		if(tried_mask & (uint64_t(1) << i)) continue;
+		const int64_t down_until = endpoints[i]->down_until_ms_.load(std::memory_order_relaxed);
+		if(down_until <= now) return static_cast<int>(i);	// healthy
+		if(unhealthy < 0 || down_until < unhealthy_until) 
+			unhealthy = static_cast<int>(i), unhealthy_until = down_until;
+	}
+	return unhealthy;
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Record successful connect and its latency
+/// 
+/// @param endpoint endpoint
+/// @param latency_us latency of connect in microseconds
+///
+void T_endpoint_table::report_success(T_endpoint& endpoint, const unsigned int latency_us) {
+	if(endpoint.failures_.load(std::memory_order_relaxed) != 0) {
+		endpoint.failures_.store(0, std::memory_order_relaxed);
+		endpoint.down_until_ms_.store(0, std::memory_order_relaxed);
+		endpoint.table_.healthy_from_ms_.store(0, std::memory_order_relaxed);
+	}
+	// average = 7/8 * average + 1/8 * latency (races between threads only lose one of samples)
+	const unsigned int average = endpoint.connect_latency_us_.load(std::memory_order_relaxed);
+	endpoint.connect_latency_us_.store(average ? (average - average / 8 + latency_us / 8) : latency_us, std::memory_order_relaxed);
+}
+
+/// 
+/// Record failed connect: endpoint becomes unhealthy for exponential backoff time
+/// 
+/// @param endpoint endpoint
+///
+void T_endpoint_table::report_failure(T_endpoint& endpoint) {
+	const unsigned int failures = endpoint.failures_.fetch_add(1, std::memory_order_relaxed);
+	const int64_t backoff_ms = (failures < 16) ? 
+		(std::min)(int64_t(failure_backoff_ms) << failures, int64_t(max_backoff_ms)) : int64_t(max_backoff_ms);
+	endpoint.down_until_ms_.store(now_ms() + backoff_ms, std::memory_order_relaxed);
+	endpoint.table_.update_health();
+}
+
+/// 
+/// Recalculate the earliest time, when any of current endpoints is healthy. It's called only after failures 
+/// and re-resolve, so selection of backends doesn't load the list of endpoints. A race with success of 
+/// other endpoint can only keep the table unhealthy until the stored time, but not longer than one backoff.
+///
+void T_endpoint_table::update_health() {
+	const T_endpoints_ptr current = endpoints();
+	int64_t healthy_from = (std::numeric_limits<int64_t>::max)();
+	for(auto &i : *current) 
+		healthy_from = (std::min)(healthy_from, i->down_until_ms_.load(std::memory_order_relaxed));
+	healthy_from_ms_.store(current->empty() ? 0 : healthy_from, std::memory_order_relaxed);
+}
+// ----------------------------------------------------------------------------
+
+/// Start timer for the next re-resolve
+void T_endpoint_table::start_refresh_timer() {
+	if(refresh_seconds_ == 0) return;
+	refresh_timer_.expires_from_now(boost::posix_time::seconds(refresh_seconds_));
+	refresh_timer_.async_wait(boost::bind(&T_endpoint_table::handle_refresh_timer, this, ba::placeholders::error));
+}
+
+/// Run when the timer of re-resolve is expired
+void T_endpoint_table::handle_refresh_timer(const bs::error_code& err) {
+	if(err) return;	// operation_aborted
+	ba::ip::tcp::resolver::query query(remote_address_, remote_port_);
+	resolver_.async_resolve(query, boost::bind(&T_endpoint_table::handle_resolve, this, 
+											   ba::placeholders::error, ba::placeholders::iterator));
+}
+
+/// 
+/// Run when the re-resolve is completed: replace list of endpoints, keep health of remaining endpoints
+/// 
+/// @param err 
+/// @param endpoint_it forward iterable object, that points to the resolved endpoints
+///
+void T_endpoint_table::handle_resolve(const bs::error_code& err, ba::ip::tcp::resolver::iterator endpoint_it) {
+	if(err == ba::error::operation_aborted) return;
+	if(!err && endpoint_it != ba::ip::tcp::resolver::iterator()) {
+		const T_endpoints_ptr old_endpoints = endpoints();
+		T_endpoints_ptr new_endpoints = make_endpoints(endpoint_it, old_endpoints.get());
+		if(new_endpoints) {
+			boost::atomic_store(&endpoints_, new_endpoints);
+			update_health();
+		}
+	} else {
+		// keep previous endpoints, while DNS is unavailable
+		PORTMAPPING_LOG(log_warning, "Remote resolve failed for: " << remote_address_ << ", " << err.message());
+	}
+	start_refresh_timer();
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Create new list of endpoints from resolved, and print them
+/// 
+/// @param endpoint_it forward iterable object, that points to the resolved endpoints
+/// @param old_endpoints previous list of endpoints, health of which will be kept, or NULL
+/// 
+/// @return new list, or empty pointer if the endpoints are the same as old
+///
+T_endpoint_table::T_endpoints_ptr T_endpoint_table::make_endpoints(ba::ip::tcp::resolver::iterator endpoint_it, 
+																   const T_endpoints *const old_endpoints) 
+{
+	boost::shared_ptr<T_endpoints> new_endpoints(new T_endpoints);
+	for(auto it = endpoint_it; it != ba::ip::tcp::resolver::iterator(); ++it) {
+		T_endpoint_ptr endpoint;
+		if(old_endpoints)
+			for(auto &i : *old_endpoints) 
+				if(i->endpoint_ == it->endpoint()) endpoint = i;
+		if(!endpoint) endpoint.reset(new T_endpoint(*this, it->endpoint()));
+		new_endpoints->push_back(endpoint);
+	}
+	if(old_endpoints && *old_endpoints == *new_endpoints) return T_endpoints_ptr();
+
+	PORTMAPPING_LOG(log_info, "Remote resolved endpoints for: " << remote_address_);
+	for(size_t i = 0; i < new_endpoints->size(); ++i)
+		PORTMAPPING_LOG(log_info, i << ": " << (*new_endpoints)[i]->endpoint_);
+	return new_endpoints;
+}
+// ----------------------------------------------------------------------------
@@ -0,0 +1,122 @@
+/**
+ * @file   endpoint_table.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Table of resolved endpoints of remote server with health tracking
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef ENDPOINT_TABLE_HPP
+#define ENDPOINT_TABLE_HPP
+// ----------------------------------------------------------------------------
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+namespace bs = boost::system;
+// ----------------------------------------------------------------------------
+#include <atomic>
+#include <vector>
+#include <string>
+#include <cstdint>
+// ----------------------------------------------------------------------------
+
+///
+/// Endpoints of remote server, which are re-resolved in background every refresh period (TTL),
+/// and health of each of them: connect failures and connect latency.
+/// Connections try healthy endpoints first, and endpoints after recent failures - only as last resort.
+///
+class T_endpoint_table : private boost::noncopyable {
+public:
+	/// Endpoint with its health
+	struct T_endpoint : private boost::noncopyable {
+		T_endpoint(T_endpoint_table& table, const ba::ip::tcp::endpoint& endpoint);
+
+		T_endpoint_table& table_;               ///< table, health of which is updated with health of this endpoint
+		const ba::ip::tcp::endpoint endpoint_;  ///< address:port of remote server
+		std::atomic<unsigned int> failures_;    ///< number of consecutive connect failures
+		std::atomic<int64_t> down_until_ms_;    ///< endpoint is unhealthy until this time (steady clock, ms)
+		std::atomic<unsigned int> connect_latency_us_;  ///< average connect latency (exponential moving average, us)
+	};
+	typedef boost::shared_ptr<T_endpoint> T_endpoint_ptr;
+
+	/// Immutable list of endpoints from one resolve, it is replaced entirely by next resolve
+	typedef std::vector<T_endpoint_ptr> T_endpoints;
+	typedef boost::shared_ptr<const T_endpoints> T_endpoints_ptr;
+
+	enum { max_endpoints = 64 };            ///< max endpoints, which are tried by one connection (bits of mask of tried endpoints)
+	enum { failure_backoff_ms = 1000 };     ///< time of unhealthy state after the first failure, it doubles after each next failure
+	enum { max_backoff_ms = 60000 };        ///< max time of unhealthy state
+
+	/// 
+	/// Resolve remote address in sync mode, and start refresh in async mode
+	/// 
+	/// @param io_service io_service, in which resolver works
+	/// @param remote_address address of remote server
+	/// @param remote_port port of remote server
+	/// @param refresh_seconds period of re-resolve (TTL of resolved endpoints), 0 - resolve only once
+	///
+	T_endpoint_table(ba::io_service& io_service, const std::string& remote_address, unsigned int remote_port,
+					 unsigned int refresh_seconds);
+
+	/// Stop refresh
+	void stop();
+
+	/// Current list of endpoints
+	inline T_endpoints_ptr endpoints() const { return boost::atomic_load(&endpoints_); }
+
+	/// Whether at least one endpoint is healthy at time now (ms), without access to the list of endpoints
+	inline bool healthy(const int64_t now) const { return healthy_from_ms_.load(std::memory_order_relaxed) <= now; }
+
+	/// 
+	/// Select best endpoint among not yet tried: healthy in order of resolve, 
+	/// else unhealthy, which failed the earliest
+	/// 
+	/// @param endpoints list of endpoints
+	/// @param tried_mask bit mask of indexes of already tried endpoints
+	/// 
+	/// @return index of endpoint, or -1 if all endpoints have been tried
+	///
+	static int select(const T_endpoints& endpoints, const uint64_t tried_mask);
+
+	/// Record successful connect and its latency
+	static void report_success(T_endpoint& endpoint, const unsigned int latency_us);
+
+	/// Record failed connect: endpoint becomes unhealthy for exponential backoff time
+	static void report_failure(T_endpoint& endpoint);
+
+	/// Current time of steady clock in ms
+	static int64_t now_ms();
+
+	/// Current time of steady clock in us
+	static int64_t now_us();
+
+private:
+	/// Start timer for the next re-resolve
+	void start_refresh_timer();
+
+	/// Run when the timer of re-resolve is expired
+	void handle_refresh_timer(const bs::error_code& err);
+
+	/// Run when the re-resolve is completed: replace list of endpoints, keep health of remaining endpoints
+	void handle_resolve(const bs::error_code& err, ba::ip::tcp::resolver::iterator endpoint_it);
+
+	/// Recalculate the earliest time, when any of current endpoints is healthy
+	void update_health();
+
+	/// Create new list of endpoints from resolved, and print them
+	T_endpoints_ptr make_endpoints(ba::ip::tcp::resolver::iterator endpoint_it, const T_endpoints *const old_endpoints);
+
+	const std::string remote_address_;      ///< address of remote server
+	const std::string remote_port_;         ///< port of remote server
+	const unsigned int refresh_seconds_;    ///< period of re-resolve
+	ba::ip::tcp::resolver resolver_;        ///< resolver in async mode
+	ba::deadline_timer refresh_timer_;      ///< timer for re-resolve
+	T_endpoints_ptr endpoints_;             ///< current list of endpoints (atomic access)
+	std::atomic<int64_t> healthy_from_ms_;  ///< min of down_until_ms_ of current endpoints: the earliest time, when any of them is healthy
+};
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // ENDPOINT_TABLE_HPP
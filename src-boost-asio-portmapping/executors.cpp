@@ -0,0 +1,180 @@
+/**
+ * @file   executors.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief PortMapping Executors
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "executors.hpp"
+#include "cpu_topology.hpp"
+#include "buffer_pool.hpp"
+#include "log.hpp"
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <chrono>
+// ----------------------------------------------------------------------------
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+// ----------------------------------------------------------------------------
+
+/// 
+/// Pin current thread to the CPU-core
+/// 
+/// @param core id of CPU-core of OS (ids can be sparse, it isn't wrapped by number of cores)
+/// 
+/// @return true if success, false if there isn't such CPU or it isn't allowed for the process
+///
+bool pin_this_thread_to_core(const unsigned int core) {
+#ifdef _WIN32
+	if(core >= sizeof(DWORD_PTR) * 8) return false;	// CPU of other processor group
+	return ::SetThreadAffinityMask(::GetCurrentThread(), DWORD_PTR(1) << core) != 0;
+#elif defined(__linux__)
+	// dynamic set: id of CPU can be above CPU_SETSIZE
+	cpu_set_t *const cpuset = CPU_ALLOC(core + 1);
+	if(cpuset == NULL) return false;
+	const size_t cpuset_size = CPU_ALLOC_SIZE(core + 1);
+	CPU_ZERO_S(cpuset_size, cpuset);
+	CPU_SET_S(core, cpuset_size, cpuset);
+	const bool pinned = (::pthread_setaffinity_np(::pthread_self(), cpuset_size, cpuset) == 0);	// EINVAL - CPU isn't online
+	CPU_FREE(cpuset);
+	return pinned;
+#else
+	return false;
+#endif
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Create io_services and start threads
+/// 
+/// @param thread_num number of threads for executors
+/// @param sharded true - one io_service per thread pinned to core, false - one io_service for all threads
+/// @param uring_buffers provided buffers of the ring of io_uring of each io_service, 0 - without io_uring
+/// @param cpus CPUs, to which threads are pinned in turn, empty - default (sharded: allowed CPUs, shared: not pinned)
+/// @param busy_poll_us max time of busy poll of idle io_service before block in the reactor, microseconds, 0 - always block
+///
+T_executors::T_executors(unsigned int thread_num, bool sharded, unsigned int uring_buffers, const std::vector<unsigned int>& cpus,
+						 unsigned int busy_poll_us) 
+	: sharded_(sharded)
+{
+	if(thread_num == 0) thread_num = 1;
+	const size_t io_service_num = sharded_ ? thread_num : 1;
+
+	// placement of threads: CPU of each thread and NUMA node of each io_service
+	const T_cpu_topology& topology = T_cpu_topology::instance();
+	const std::vector<unsigned int>& pin_cpus = (cpus.empty() && sharded_) ? topology.allowed_cpus() : cpus;
+	for(size_t i = 0; i < thread_num; ++i)
+		cpus_.push_back(pin_cpus.empty() ? -1 : static_cast<int>(pin_cpus[i % pin_cpus.size()]));
+	nodes_.assign(io_service_num, -1);
+	if(topology.nodes() > 1 && !pin_cpus.empty()) {
+		for(size_t i = 0; i < io_service_num; ++i) {
+			// in shared mode the io_service has a node, only if all threads are on it
+			nodes_[i] = static_cast<int>(topology.node_of_cpu(cpus_[i]));
+			for(size_t j = i + 1; !sharded_ && j < thread_num; ++j)
+				if(static_cast<int>(topology.node_of_cpu(cpus_[j])) != nodes_[i]) nodes_[i] = -1;
+		}
+	}
+	if(!pin_cpus.empty()) {
+		std::vector<unsigned int> pinned;
+		for(auto cpu : cpus_) pinned.push_back(static_cast<unsigned int>(cpu));
+		PORTMAPPING_LOG(log_info, "Executor threads are pinned to CPUs " << T_cpu_topology::format_list(pinned) << 
+			" (NUMA nodes: " << topology.nodes() << ")");
+	}
+
+	for(size_t i = 0; i < io_service_num; ++i) {
+		// concurrency_hint = 1 for io_service in sharded mode, that is run only by one thread
+		io_services_.emplace_back(sharded_ ? new ba::io_service(1) : new ba::io_service);
+		works_.emplace_back(new ba::io_service::work(*io_services_.back()));
+		timing_wheels_.emplace_back(new T_timing_wheel(*io_services_.back()));
+		pacers_.emplace_back(new T_pacer(*io_services_.back()));
+	}
+
+#ifdef PORTMAPPING_URING
+	// rings for all io_services or for none of them: connections fall back to buffered relay
+	if(uring_buffers != 0) {
+		try {
+			for(auto &i : io_services_) urings_.emplace_back(new T_uring(*i, uring_buffers));
+		} catch(const std::exception& e) {
+			urings_.clear();
+			PORTMAPPING_LOG(log_warning, "io_uring isn't available (" << e.what() << "): buffered relay is used");
+		}
+	}
+#else
+	if(uring_buffers != 0) PORTMAPPING_LOG(log_warning, "io_uring isn't available on this platform: buffered relay is used");
+#endif
+
+	if(busy_poll_us != 0)
+		PORTMAPPING_LOG(log_info, "Executors: busy poll up to " << busy_poll_us << " us before block");
+
+	// create threads in pool for executors
+	for(size_t i = 0; i < thread_num; ++i) {
+		ba::io_service *const io_service = io_services_[sharded_ ? i : 0].get();
+		const int cpu = cpus_[i];
+		if(cpu >= 0 || busy_poll_us != 0)
+			threads_.emplace_back([io_service, cpu, busy_poll_us]() { 
+				if(cpu >= 0) {
+					if(!pin_this_thread_to_core(static_cast<unsigned int>(cpu)))
+						PORTMAPPING_LOG(log_warning, "Executor thread isn't pinned to CPU " << cpu);
+					else T_buffer_pool::set_thread_node(T_cpu_topology::instance().node_of_cpu(static_cast<unsigned int>(cpu)));
+				}
+				if(busy_poll_us != 0) run_busy_poll(*io_service, busy_poll_us);
+				else io_service->run(); 
+			});
+		else
+			threads_.emplace_back(boost::bind(&boost::asio::io_service::run, io_service));
+	}
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Run io_service by busy poll: ready handlers and the reactor (epoll_wait() with zero timeout) are polled 
+/// without block, and the thread blocks in the reactor only after the budget of spin without any handler
+///
+/// @param io_service io_service
+/// @param busy_poll_us max budget of spin, microseconds
+///
+void T_executors::run_busy_poll(ba::io_service& io_service, const unsigned int busy_poll_us) {
+	typedef std::chrono::steady_clock T_clock;
+	const T_clock::duration max_budget = std::chrono::microseconds(busy_poll_us);
+	const T_clock::duration min_budget = max_budget / busy_poll_backoff;
+	T_clock::duration budget = max_budget;
+	while(!io_service.stopped()) {
+		if(io_service.poll() != 0) continue;	// under load: handlers are run without wakeups
+
+		// idle: spin up to the budget, the next packet is handled without wakeup of the thread
+		bool found = false;
+		const T_clock::time_point deadline = T_clock::now() + budget;
+		while(!found && T_clock::now() < deadline) found = (io_service.poll() != 0);
+		if(found) {
+			budget = std::min(budget * 2, max_budget);
+			continue;
+		}
+		budget = std::max(budget / 2, min_budget);
+		io_service.run_one();	// block in the reactor until the next handler, or until stop
+	}
+}
+// ----------------------------------------------------------------------------
+
+T_executors::~T_executors() {
+	stop();
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Stop io_services and
+/// wait for all executing threads
+/// 
+///
+void T_executors::stop() {
+	for(auto &i : io_services_) i->stop();
+	for(auto &i : threads_) if(i.joinable()) i.join();
+}
+// ----------------------------------------------------------------------------
@@ -0,0 +1,129 @@
+/**
+ * @file   executors.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief PortMapping Executors
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef EXECUTORS_HPP
+#define EXECUTORS_HPP
+// ----------------------------------------------------------------------------
+#include "timing_wheel.hpp"
+#include "pacer.hpp"
+#include "uring.hpp"
+// ----------------------------------------------------------------------------
+#include <boost/noncopyable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+// ----------------------------------------------------------------------------
+
+#include <vector>
+#include <memory>
+
+// ----------------------------------------------------------------------------
+
+///
+/// Thread pool for executors, in which connections are working
+/// 
+/// shared mode:  one io_service, which is run by all threads - handlers of connection can be executed on any thread
+/// sharded mode: one io_service per thread, each thread pinned to own CPU-core - connection lives its whole life on one core
+/// Each io_service has own timing wheel for timeouts of connections, which work in it, and own pacer for their deferred reads,
+/// and optionally own ring of io_uring for their relay.
+/// Threads are pinned to the configured list of CPUs (in sharded mode by default to allowed CPUs, node by node),
+/// and the NUMA node of each io_service is known, so memory of its pools is placed on that node.
+/// Optionally threads busy poll their io_service instead of blocking in the reactor (see run_busy_poll()).
+///
+class T_executors : private boost::noncopyable {
+public:
+	/// 
+	/// Create io_services and start threads
+	/// 
+	/// @param thread_num number of threads for executors
+	/// @param sharded true - one io_service per thread pinned to core, false - one io_service for all threads
+	/// @param uring_buffers provided buffers of the ring of io_uring of each io_service, 0 - without io_uring
+	/// @param cpus CPUs, to which threads are pinned in turn, empty - default (sharded: allowed CPUs, shared: not pinned)
+	/// @param busy_poll_us max time of busy poll of idle io_service before block in the reactor, microseconds, 0 - always block
+	///
+	T_executors(unsigned int thread_num, bool sharded, unsigned int uring_buffers = 0, 
+				const std::vector<unsigned int>& cpus = std::vector<unsigned int>(), unsigned int busy_poll_us = 0);
+	~T_executors();
+
+	/// Stop io_services and wait for all executing threads
+	void stop();
+
+	/// Whether each thread has own io_service
+	inline bool sharded() const { return sharded_; }
+
+	/// Number of io_services (1 in shared mode, number of threads in sharded mode)
+	inline size_t size() const { return io_services_.size(); }
+
+	/// Number of threads
+	inline size_t threads() const { return threads_.size(); }
+
+	/// CPU, to which the thread of io_service is pinned in sharded mode, -1 if it isn't pinned or in shared mode
+	inline int cpu(const size_t i) const { return sharded_ ? cpus_[i] : -1; }
+
+	/// NUMA node of threads of io_service, -1 if they aren't pinned, are on different nodes, or there is one node
+	inline int node(const size_t i) const { return nodes_[i]; }
+
+	/// Return io_service by index
+	inline ba::io_service& get_io_service(const size_t i) { return *io_services_[i]; }
+
+	/// Return timing wheel of io_service by index
+	inline T_timing_wheel& get_timing_wheel(const size_t i) { return *timing_wheels_[i]; }
+
+	/// Return pacer of io_service by index
+	inline T_pacer& get_pacer(const size_t i) { return *pacers_[i]; }
+
+	/// Return ring of io_uring of io_service by index, NULL - io_uring isn't used or isn't supported by the kernel
+	inline T_uring* get_uring(const size_t i) {
+#ifdef PORTMAPPING_URING
+		return (i < urings_.size()) ? urings_[i].get() : NULL;
+#else
+		return NULL;
+#endif
+	}
+
+private:
+	enum { busy_poll_backoff = 32 };        ///< busy poll budget falls to max/busy_poll_backoff at most, while there isn't load
+
+	///
+	/// Run io_service by busy poll: ready handlers and the reactor are polled without block,
+	/// and the thread blocks in the reactor only after the budget of spin without any handler.
+	/// The budget adapts to load: it's halved after each spin, which hasn't found work (load has dropped,
+	/// so CPU is released sooner), and is doubled up to busy_poll_us after each spin, which has found work.
+	///
+	/// @param io_service io_service
+	/// @param busy_poll_us max budget of spin, microseconds
+	///
+	static void run_busy_poll(ba::io_service& io_service, const unsigned int busy_poll_us);
+
+	const bool sharded_;                    ///< mode: one io_service per thread or one io_service for all threads
+	std::vector<std::unique_ptr<ba::io_service> > io_services_;     ///< io_services of executors
+	std::vector<std::unique_ptr<ba::io_service::work> > works_;     ///< objects to inform the io_services when it has work to do
+	std::vector<std::unique_ptr<T_timing_wheel> > timing_wheels_;   ///< timing wheels for timeouts of connections (one per io_service)
+	std::vector<std::unique_ptr<T_pacer> > pacers_;                 ///< schedulers of deferred reads of connections (one per io_service)
+#ifdef PORTMAPPING_URING
+	std::vector<std::unique_ptr<T_uring> > urings_;                 ///< rings of io_uring (one per io_service, or none)
+#endif
+	std::vector<int> cpus_;                 ///< CPU of each thread, -1 - not pinned
+	std::vector<int> nodes_;                ///< NUMA node of each io_service, -1 - any
+	std::vector<boost::thread> threads_;    ///< thread pool object for executors
+};
+// ----------------------------------------------------------------------------
+
+/// 
+/// Pin current thread to the CPU-core
+/// 
+/// @param core id of CPU-core of OS (ids can be sparse, it isn't wrapped by number of cores)
+/// 
+/// @return true if success, false if there isn't such CPU or it isn't allowed for the process
+///
+bool pin_this_thread_to_core(const unsigned int core);
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // EXECUTORS_HPP
@@ -0,0 +1,74 @@
+/**
+ * @file   handler_allocator.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Custom memory allocator for reuse once allocated memory.
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "handler_allocator.hpp"
+// ----------------------------------------------------------------------------
+
+std::atomic<uint64_t> T_handler_overflow::cache_allocations_(0);
+std::atomic<uint64_t> T_handler_overflow::heap_allocations_(0);
+// ----------------------------------------------------------------------------
+
+T_handler_overflow::T_thread_cache::T_thread_cache() {
+	for(auto &i : count_) i = 0;
+}
+
+/// Return all blocks of the thread to the heap, when thread exits
+T_handler_overflow::T_thread_cache::~T_thread_cache() {
+	for(size_t size_class = 0; size_class < size_classes; ++size_class)
+		while(count_[size_class] != 0) ::operator delete(blocks_[size_class][--count_[size_class]]);
+}
+
+/// Cache of blocks of current thread
+T_handler_overflow::T_thread_cache& T_handler_overflow::thread_cache() {
+	static thread_local T_thread_cache cache;
+	return cache;
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Take block from the cache of current thread, or from the heap
+///
+/// @param size size of memory in bytes
+///
+/// @return pointer to memory
+///
+void* T_handler_overflow::allocate(const std::size_t size) {
+	const size_t i = size_class(size);
+	if(i < size_classes) {
+		T_thread_cache& cache = thread_cache();
+		if(cache.count_[i] != 0) {
+			cache_allocations_.fetch_add(1, std::memory_order_relaxed);
+			return cache.blocks_[i][--cache.count_[i]];
+		}
+		heap_allocations_.fetch_add(1, std::memory_order_relaxed);
+		return ::operator new(block_size(i));
+	}
+	heap_allocations_.fetch_add(1, std::memory_order_relaxed);
+	return ::operator new(size);
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Return block to the cache of current thread, or to the heap if the cache is full
+///
+/// @param pointer pointer returned by allocate()
+/// @param size size of memory in bytes, the same as in allocate()
+///
+void T_handler_overflow::deallocate(void *const pointer, const std::size_t size) {
+	const size_t i = size_class(size);
+	if(i < size_classes) {
+		T_thread_cache& cache = thread_cache();
+		if(cache.count_[i] < thread_cache_blocks) {
+			cache.blocks_[i][cache.count_[i]++] = pointer;
+			return;
+		}
+	}
+	::operator delete(pointer);
+}
+// ----------------------------------------------------------------------------
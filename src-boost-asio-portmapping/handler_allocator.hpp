@@ -13,65 +13,144 @@
 #include <boost/bind.hpp>
 #include <boost/aligned_storage.hpp>
 #include <boost/noncopyable.hpp>
+// ----------------------------------------------------------------------------
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+// ----------------------------------------------------------------------------
+
+///
+/// Memory for handlers, which don't fit to the arena of their connection:
+/// blocks of size classes 256 B, 512 B, 1 KB, 2 KB, 4 KB in the cache of each thread without locks,
+/// bigger blocks and blocks over the limit of the cache are taken from the heap.
+/// Block can be returned in other thread, than it was taken in.
+/// Each fallback is counted, so the relay path without heap allocations can be checked in metrics.
+///
+class T_handler_overflow : private boost::noncopyable {
+public:
+	enum { size_classes = 5 };              ///< number of size classes
+	enum { min_block_size = 256 };          ///< size of block of the smallest class, each next class is 2 times bigger
+	enum { thread_cache_blocks = 32 };      ///< max blocks of each class in the cache of one thread
+
+	/// Size of block of the size class
+	static inline size_t block_size(const size_t size_class) { return size_t(min_block_size) << size_class; }
+
+	///
+	/// Take block from the cache of current thread, or from the heap
+	///
+	/// @param size size of memory in bytes
+	///
+	/// @return pointer to memory
+	///
+	static void* allocate(const std::size_t size);
+
+	///
+	/// Return block to the cache of current thread, or to the heap if the cache is full
+	///
+	/// @param pointer pointer returned by allocate()
+	/// @param size size of memory in bytes, the same as in allocate()
+	///
+	static void deallocate(void *const pointer, const std::size_t size);
+
+	/// Allocations of handlers, that didn't fit to arenas and were served by caches of threads
+	static inline uint64_t cache_allocations() { return cache_allocations_.load(std::memory_order_relaxed); }
+
+	/// Allocations of handlers, that didn't fit to arenas and were served by the heap
+	static inline uint64_t heap_allocations() { return heap_allocations_.load(std::memory_order_relaxed); }
 
+private:
+	/// Cache of blocks of one thread
+	struct T_thread_cache {
+		T_thread_cache();
+		~T_thread_cache();
+		void *blocks_[size_classes][thread_cache_blocks];
+		size_t count_[size_classes];
+	};
+	/// Cache of blocks of current thread
+	static T_thread_cache& thread_cache();
+
+	/// Size class of block for size, or size_classes if it's bigger than all classes
+	static inline size_t size_class(const std::size_t size) {
+		size_t i = 0;
+		while(i < size_classes && size > block_size(i)) ++i;
+		return i;
+	}
+
+	// fallback is rare, so shared counters don't cost on the relay path
+	static std::atomic<uint64_t> cache_allocations_;    ///< fallbacks served by caches of threads
+	static std::atomic<uint64_t> heap_allocations_;     ///< fallbacks served by the heap
+};
 // ----------------------------------------------------------------------------
 
-/// Class to manage the memory to be used for handler-based custom allocation.
-/// It contains a single block of memory which may be returned for allocation
-/// requests. If the memory is in use when an allocation request is made, the
-/// allocator delegates allocation to the global heap.
-template<size_t size = 1024>
-class T_handler_allocator
+///
+/// Arena of memory for handlers of one connection: slots_ blocks of slot_size bytes,
+/// each handler takes a free one, so several concurrent operations (reads and writes
+/// of both directions) don't go to the heap. Slots are taken and returned by atomic bit mask,
+/// because handlers of one connection can run in different threads.
+/// Handler bigger than slot, or when all slots are in use, is served by T_handler_overflow.
+///
+template<size_t slot_size = 256, size_t slots = 4>
+class T_handler_arena
   : private boost::noncopyable
 {
+	static_assert(slots > 0 && slots <= 32, "slots are tracked by bits of uint32_t");
+	static_assert(slot_size % 16 == 0, "slot_size must keep alignment of handlers");
 public:
-  T_handler_allocator()
-    : in_use_(false)
+  T_handler_arena()
+    : in_use_(0)
   {
   }
 
   void* allocate(std::size_t size)
   {
-    if (!in_use_ && size < storage_.size)
+    if (size <= slot_size)
     {
-      in_use_ = true;
-      return storage_.address();
-    }
-    else
-    {
-      return ::operator new(size);
+      uint32_t in_use = in_use_.load(std::memory_order_relaxed);
+      for (size_t slot = 0; slot < slots; ++slot)
+      {
+        const uint32_t bit = uint32_t(1) << slot;
+        if (in_use & bit) continue;
+        // on failure in_use is reloaded, and the search goes on from the next slot
+        if (in_use_.compare_exchange_strong(in_use, in_use | bit, std::memory_order_acquire, std::memory_order_relaxed))
+          return storage_begin() + slot * slot_size;
+      }
     }
+    return T_handler_overflow::allocate(size);
   }
 
-  void deallocate(void* pointer)
+  void deallocate(void* pointer, std::size_t size)
   {
-    if (pointer == storage_.address())
+    char *const p = static_cast<char*>(pointer);
+    if (p >= storage_begin() && p < storage_begin() + slots * slot_size)
     {
-      in_use_ = false;
+      const size_t slot = static_cast<size_t>(p - storage_begin()) / slot_size;
+      in_use_.fetch_and(~(uint32_t(1) << slot), std::memory_order_release);
     }
     else
     {
-      ::operator delete(pointer);
+      T_handler_overflow::deallocate(pointer, size);
     }
   }
 
 private:
-  // Storage space used for handler-based custom memory allocation.
-  boost::aligned_storage<size> storage_;
+  inline char* storage_begin() { return static_cast<char*>(storage_.address()); }
+
+  // Storage space of all slots used for handler-based custom memory allocation.
+  boost::aligned_storage<slot_size * slots> storage_;
 
-  // Whether the handler-based custom allocation storage has been used.
-  bool in_use_;
+  // Bit of each slot, which is in use.
+  std::atomic<uint32_t> in_use_;
 };
 // ----------------------------------------------------------------------------
 
 /// Wrapper class template for handler objects to allow handler memory
 /// allocation to be customised. Calls to operator() are forwarded to the
 /// encapsulated handler.
-template <typename T_handler>
+template <typename T_handler, typename T_arena>
 class T_custom_alloc_handler
 {
 public:
-  T_custom_alloc_handler(T_handler_allocator<>& a, T_handler h)
+  T_custom_alloc_handler(T_arena& a, T_handler h)
     : allocator_(a),
       handler_(h)
   {
@@ -90,29 +169,29 @@ public:
   }
 
   friend void* asio_handler_allocate(std::size_t size,
-      T_custom_alloc_handler<T_handler>* this_handler)
+      T_custom_alloc_handler<T_handler, T_arena>* this_handler)
   {
     return this_handler->allocator_.allocate(size);
   }
 
-  friend void asio_handler_deallocate(void* pointer, std::size_t /*size*/,
-      T_custom_alloc_handler<T_handler>* this_handler)
+  friend void asio_handler_deallocate(void* pointer, std::size_t size,
+      T_custom_alloc_handler<T_handler, T_arena>* this_handler)
   {
-    this_handler->allocator_.deallocate(pointer);
+    this_handler->allocator_.deallocate(pointer, size);
   }
 
 private:
-  T_handler_allocator<>& allocator_;
+  T_arena& allocator_;
   T_handler handler_;
 };
 // ----------------------------------------------------------------------------
 
 /// Helper function to wrap a handler object to add custom allocation.
-template <typename T_handler>
-inline T_custom_alloc_handler<T_handler> make_custom_alloc_handler(
-    T_handler_allocator<>& a, T_handler h)
+template <typename T_handler, typename T_arena>
+inline T_custom_alloc_handler<T_handler, T_arena> make_custom_alloc_handler(
+    T_arena& a, T_handler h)
 {
-  return T_custom_alloc_handler<T_handler>(a, h);
+  return T_custom_alloc_handler<T_handler, T_arena>(a, h);
 }
 // ----------------------------------------------------------------------------
 
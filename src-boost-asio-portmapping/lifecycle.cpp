@@ -0,0 +1,249 @@
+/**
+ * @file   lifecycle.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Signals of process: draining, reload of remote servers and handoff of listeners to the new process
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "lifecycle.hpp"
+#include "config.hpp"
+#include "log.hpp"
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <csignal>
+#include <cstring>
+// ----------------------------------------------------------------------------
+#ifdef PORTMAPPING_HANDOFF
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+extern char **environ;
+#endif
+// ----------------------------------------------------------------------------
+
+///
+/// Start wait of signals
+///
+/// @param io_service_acceptors io_service of acceptors, which is stopped at the end of draining
+/// @param servers port mappings
+/// @param metrics_server HTTP listener of metrics, or NULL
+/// @param overload_guard budgets of process with number of active connections of all port mappings
+/// @param drain_seconds max time of draining
+/// @param config_file config file, which is read again on SIGHUP, or empty - settings are from command line
+/// @param argv arguments of process for the new process
+///
+T_lifecycle::T_lifecycle(ba::io_service& io_service_acceptors, const std::vector<T_server*>& servers, T_metrics_server *const metrics_server,
+						 const T_overload_guard& overload_guard, unsigned int drain_seconds, const std::string& config_file, char** argv)
+	: io_service_acceptors_(io_service_acceptors), signals_(io_service_acceptors, SIGINT, SIGTERM), drain_timer_(io_service_acceptors),
+	  servers_(servers), metrics_server_(metrics_server), overload_guard_(overload_guard), drain_seconds_(drain_seconds),
+	  config_file_(config_file), argv_(argv), draining_(false)
+{
+#ifdef SIGHUP
+	signals_.add(SIGHUP);
+#endif
+#ifdef PORTMAPPING_HANDOFF
+	signals_.add(SIGUSR2);
+	signals_.add(SIGCHLD);
+#endif
+	start_wait();
+}
+// ----------------------------------------------------------------------------
+
+/// Start wait of the next signal
+void T_lifecycle::start_wait() {
+	signals_.async_wait(boost::bind(&T_lifecycle::handle_signal, this, ba::placeholders::error, ba::placeholders::signal_number));
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Run when signal is received
+///
+/// @param err reference to error object
+/// @param signal_number received signal
+///
+void T_lifecycle::handle_signal(const bs::error_code& err, const int signal_number) {
+	if(err) return;	// signal_set is cancelled
+	switch(signal_number) {
+#ifdef SIGHUP
+	case SIGHUP:
+		reload();
+		break;
+#endif
+#ifdef PORTMAPPING_HANDOFF
+	case SIGUSR2:
+		handoff();
+		break;
+	case SIGCHLD:
+		reap_children();
+		break;
+#endif
+	default:	// SIGTERM, SIGINT
+		if(draining_) {
+			PORTMAPPING_LOG(log_warning, "Stop at once by the second signal " << signal_number << ", active connections " <<
+				overload_guard_.active_connections() << " are closed");
+			io_service_acceptors_.stop();
+			return;
+		}
+		drain();
+		break;
+	}
+	start_wait();
+}
+// ----------------------------------------------------------------------------
+
+/// Stop accept of all port mappings and wait for the end of established connections
+void T_lifecycle::drain() {
+	draining_ = true;
+	for(auto &i : servers_) i->stop_accept();
+	drain_deadline_ = std::chrono::steady_clock::now() + std::chrono::seconds(drain_seconds_);
+	PORTMAPPING_LOG(log_info, "Draining: listeners are closed, wait for " << overload_guard_.active_connections() <<
+		" active connections up to " << drain_seconds_ << " sec");
+
+	drain_timer_.expires_from_now(boost::posix_time::milliseconds(0));
+	drain_timer_.async_wait(boost::bind(&T_lifecycle::handle_drain_timer, this, ba::placeholders::error));
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Run by timer of draining: stop io_service of acceptors, if there aren't connections or time is over
+///
+/// @param err reference to error object
+///
+void T_lifecycle::handle_drain_timer(const bs::error_code& err) {
+	if(err) return;
+	const size_t active_connections = overload_guard_.active_connections();
+	if(active_connections == 0) {
+		PORTMAPPING_LOG(log_info, "Draining is finished: all connections are closed");
+		io_service_acceptors_.stop();
+		return;
+	}
+	if(std::chrono::steady_clock::now() >= drain_deadline_) {
+		PORTMAPPING_LOG(log_warning, "Draining timeout: " << active_connections << " active connections are closed");
+		io_service_acceptors_.stop();
+		return;
+	}
+	drain_timer_.expires_from_now(boost::posix_time::milliseconds(static_cast<long>(drain_check_ms)));
+	drain_timer_.async_wait(boost::bind(&T_lifecycle::handle_drain_timer, this, ba::placeholders::error));
+}
+// ----------------------------------------------------------------------------
+
+/// Read config file again and replace lists of remote servers of port mappings with the same names
+void T_lifecycle::reload() {
+	if(config_file_.empty()) {
+		PORTMAPPING_LOG(log_warning, "Reload: settings are from command line, there isn't config file to read");
+		return;
+	}
+	T_config config;
+	try {
+		config = T_config::from_file(config_file_);
+	} catch(std::exception& e) {
+		PORTMAPPING_LOG(log_error, "Reload: config " << config_file_ << " isn't changed: " << e.what());
+		return;
+	}
+
+	PORTMAPPING_LOG(log_info, "Reload: config " << config_file_ << " (only remote servers, other settings require restart)");
+	for(auto &mapping : config.mappings_) {
+		auto server = std::find_if(servers_.begin(), servers_.end(),
+			[&mapping](const T_server *const i) { return i->name() == mapping.name_; });
+		if(server == servers_.end()) {
+			PORTMAPPING_LOG(log_warning, "Reload: new port mapping " << mapping.name_ << " requires restart");
+			continue;
+		}
+		try {
+			(*server)->reload_backends(mapping);
+		} catch(std::exception& e) {
+			PORTMAPPING_LOG(log_error, "Reload: remotes of port mapping " << mapping.name_ << " aren't changed: " << e.what());
+		}
+	}
+}
+// ----------------------------------------------------------------------------
+
+#ifdef PORTMAPPING_HANDOFF
+///
+/// Start the new process from the same executable with the same arguments, which inherits listening sockets
+/// by their descriptors in environment variable T_server::listen_fds_env. Only these sockets are left open in it:
+/// sockets of connections must be closed only by this process
+///
+void T_lifecycle::handoff() {
+	if(draining_) {
+		PORTMAPPING_LOG(log_warning, "Handoff: listeners are already closed by draining");
+		return;
+	}
+
+	// everything is prepared before fork(): the child only closes descriptors and calls exec
+	std::ostringstream listen_fds;
+	std::vector<int> keep_fds;
+	std::vector<std::string> listeners;
+	for(auto &i : servers_)
+		if(!i->listen_fds().empty()) listeners.push_back(i->listen_fds());
+	if(metrics_server_ != NULL) {
+		std::ostringstream metrics_listener;
+		metrics_listener << metrics_server_->acceptor().local_endpoint() << "=" << metrics_server_->acceptor().native_handle();
+		listeners.push_back(metrics_listener.str());
+	}
+	for(size_t i = 0; i < listeners.size(); ++i) {
+		listen_fds << (i ? ";" : "") << listeners[i];
+		std::istringstream fds(listeners[i].substr(listeners[i].rfind('=') + 1));
+		std::string fd;
+		while(std::getline(fds, fd, ',')) keep_fds.push_back(std::stoi(fd));
+	}
+	std::sort(keep_fds.begin(), keep_fds.end());
+
+	const std::string env_prefix = std::string(T_server::listen_fds_env) + "=";
+	const std::string env_listen_fds = env_prefix + listen_fds.str();
+	std::vector<char*> envp;
+	for(char **i = environ; *i != NULL; ++i)
+		if(std::strncmp(*i, env_prefix.c_str(), env_prefix.size()) != 0) envp.push_back(*i);
+	envp.push_back(const_cast<char*>(env_listen_fds.c_str()));
+	envp.push_back(NULL);
+
+	struct rlimit limit;
+	const int max_fd = (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) ?
+		static_cast<int>(limit.rlim_cur) - 1 : 65535;
+
+	const pid_t pid = ::fork();
+	if(pid == 0) {
+		// child: only async-signal-safe calls
+		int from = 3;
+		for(size_t i = 0; i <= keep_fds.size(); ++i) {
+			const int to = (i < keep_fds.size()) ? keep_fds[i] - 1 : max_fd;
+#ifdef SYS_close_range
+			if(to >= from && ::syscall(SYS_close_range, from, to, 0) != 0)
+#endif
+				for(int fd = from; fd <= to; ++fd) ::close(fd);
+			if(i < keep_fds.size()) {
+				::fcntl(keep_fds[i], F_SETFD, 0);	// clear FD_CLOEXEC
+				from = keep_fds[i] + 1;
+			}
+		}
+		::execve("/proc/self/exe", argv_, &envp[0]);
+		::_exit(127);
+	}
+	if(pid < 0) {
+		PORTMAPPING_LOG(log_error, "Handoff: fork() failed, errno " << errno);
+		return;
+	}
+	PORTMAPPING_LOG(log_info, "Handoff: new process " << pid << " inherits listeners " << listen_fds.str() <<
+		", send SIGTERM to this process " << ::getpid() << " to drain it");
+}
+// ----------------------------------------------------------------------------
+
+/// Collect exit status of finished new processes, so they don't remain zombies
+void T_lifecycle::reap_children() {
+	int status = 0;
+	pid_t pid;
+	while((pid = ::waitpid(-1, &status, WNOHANG)) > 0)
+		PORTMAPPING_LOG(log_warning, "Handoff: new process " << pid << " has exited with status " <<
+			(WIFEXITED(status) ? WEXITSTATUS(status) : -1));
+}
+// ----------------------------------------------------------------------------
+#endif
@@ -0,0 +1,94 @@
+/**
+ * @file   lifecycle.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Signals of process: draining, reload of remote servers and handoff of listeners to the new process
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef LIFECYCLE_HPP
+#define LIFECYCLE_HPP
+// ----------------------------------------------------------------------------
+#include "server.hpp"
+#include "metrics_server.hpp"
+#include "admission.hpp"
+// ----------------------------------------------------------------------------
+#include <boost/noncopyable.hpp>
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+namespace bs = boost::system;
+// ----------------------------------------------------------------------------
+#include <vector>
+#include <string>
+#include <chrono>
+// ----------------------------------------------------------------------------
+
+///
+/// Handler of signals of process in io_service of acceptors:
+/// - SIGTERM, SIGINT: draining - listeners are closed, established connections go on up to drain timeout,
+///   then io_service of acceptors is stopped (the second signal stops it at once)
+/// - SIGHUP: config file is read again, and lists of remote servers of port mappings are replaced
+///   without drop of established connections (other settings require restart)
+/// - SIGUSR2 (Linux): the new process is started from the same executable with the same arguments,
+///   and it inherits listening sockets, so there isn't any moment, when connections are refused;
+///   this process goes on accepting until SIGTERM
+///
+class T_lifecycle : private boost::noncopyable {
+public:
+	enum { drain_check_ms = 100 };          ///< period of check of active connections while draining
+
+	///
+	/// Start wait of signals
+	///
+	/// @param io_service_acceptors io_service of acceptors, which is stopped at the end of draining
+	/// @param servers port mappings
+	/// @param metrics_server HTTP listener of metrics, or NULL
+	/// @param overload_guard budgets of process with number of active connections of all port mappings
+	/// @param drain_seconds max time of draining
+	/// @param config_file config file, which is read again on SIGHUP, or empty - settings are from command line
+	/// @param argv arguments of process for the new process
+	///
+	T_lifecycle(ba::io_service& io_service_acceptors, const std::vector<T_server*>& servers, T_metrics_server *const metrics_server,
+				const T_overload_guard& overload_guard, unsigned int drain_seconds, const std::string& config_file, char** argv);
+
+private:
+	/// Start wait of the next signal
+	void start_wait();
+
+	/// Run when signal is received
+	void handle_signal(const bs::error_code& err, int signal_number);
+
+	/// Stop accept of all port mappings and wait for the end of established connections
+	void drain();
+
+	/// Run by timer of draining: stop io_service of acceptors, if there aren't connections or time is over
+	void handle_drain_timer(const bs::error_code& err);
+
+	/// Read config file again and replace lists of remote servers
+	void reload();
+
+#ifdef PORTMAPPING_HANDOFF
+	/// Start the new process, which inherits listening sockets
+	void handoff();
+
+	/// Collect exit status of finished new processes
+	void reap_children();
+#endif
+
+	ba::io_service& io_service_acceptors_;  ///< io_service of acceptors
+	ba::signal_set signals_;                ///< signals, which are waited
+	ba::deadline_timer drain_timer_;        ///< timer of check of draining
+	const std::vector<T_server*> servers_;  ///< port mappings
+	T_metrics_server *const metrics_server_;    ///< HTTP listener of metrics, or NULL
+	const T_overload_guard& overload_guard_;    ///< active connections of all port mappings
+	const unsigned int drain_seconds_;      ///< max time of draining
+	const std::string config_file_;         ///< config file, empty - settings are from command line
+	char **const argv_;                     ///< arguments of process
+	bool draining_;                         ///< draining has been started
+	std::chrono::steady_clock::time_point drain_deadline_;  ///< end of draining
+};
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // LIFECYCLE_HPP
@@ -0,0 +1,175 @@
+/**
+ * @file   log.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Asynchronous logging: records are put to lock-free ring buffer and are written by background thread
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "log.hpp"
+// ----------------------------------------------------------------------------
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/bind.hpp>
+// ----------------------------------------------------------------------------
+#include <iostream>
+#include <stdexcept>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <cstdio>
+// ----------------------------------------------------------------------------
+
+/// Output place in source code as: file.cpp:line function
+std::ostream& operator<<(std::ostream& out, const T_source_location& location) {
+	const char *file = location.file_;
+	for(const char *i = location.file_; *i != 0; ++i)
+		if(*i == '/' || *i == '\\') file = i + 1;
+	return out << file << ":" << location.line_ << " " << location.function_;
+}
+// ----------------------------------------------------------------------------
+
+/// Single log of process, background thread is started at the first use
+T_log& T_log::instance() {
+	static T_log log;
+	return log;
+}
+// ----------------------------------------------------------------------------
+
+T_log::T_log()
+	: level_(log_info), ring_(new T_record[ring_size]), write_position_(0), read_position_(0), dropped_(0), stop_(false)
+{
+	static_assert((ring_size & (ring_size - 1)) == 0, "ring_size must be power of 2");
+	for(size_t i = 0; i < ring_size; ++i) ring_[i].sequence_.store(i, std::memory_order_relaxed);
+	thread_ = boost::thread(boost::bind(&T_log::run, this));
+}
+// ----------------------------------------------------------------------------
+
+T_log::~T_log() {
+	stop_.store(true, std::memory_order_release);
+	thread_.join();
+	flush();
+}
+// ----------------------------------------------------------------------------
+
+/// Parse level name: trace, debug, info, warning, error, off
+T_log_level T_log::parse_level(const std::string& name) {
+	if(name == "trace") return log_trace;
+	if(name == "debug") return log_debug;
+	if(name == "info") return log_info;
+	if(name == "warning") return log_warning;
+	if(name == "error") return log_error;
+	if(name == "off") return log_off;
+	throw std::runtime_error("Unknown log level: " + name + " (use trace, debug, info, warning, error or off)");
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Put record to the ring buffer, or drop it if the ring buffer is full
+///
+/// @param level level of record
+/// @param location place in source code
+/// @param message formatted message (without terminating zero)
+/// @param length length of message
+///
+void T_log::push(const T_log_level level, const T_source_location& location, const char *const message, const size_t length) {
+	size_t position = write_position_.load(std::memory_order_relaxed);
+	T_record *record;
+	for(;;) {
+		record = &ring_[position & (ring_size - 1)];
+		const size_t sequence = record->sequence_.load(std::memory_order_acquire);
+		const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+		if(diff == 0) {
+			// cell is free: take it, or try again with the position updated by other producer
+			if(write_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+		} else if(diff < 0) {
+			// the consumer hasn't read this cell yet: ring buffer is full
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			position = write_position_.load(std::memory_order_relaxed);
+		}
+	}
+
+	record->level_ = level;
+	record->file_ = location.file_;
+	record->line_ = location.line_;
+	record->function_ = location.function_;
+	record->time_us_ = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	record->length_ = length;
+	memcpy(record->message_, message, length);
+	record->sequence_.store(position + 1, std::memory_order_release);
+}
+// ----------------------------------------------------------------------------
+
+/// Write all records, which are in the ring buffer, under drain_mutex_
+size_t T_log::drain() {
+	static const char *const level_names[] = { "TRACE", "DEBUG", "INFO", "WARNING", "ERROR", "OFF" };
+	size_t count = 0;
+	for(;; ++count, ++read_position_) {
+		T_record& record = ring_[read_position_ & (ring_size - 1)];
+		if(record.sequence_.load(std::memory_order_acquire) != read_position_ + 1) break;
+
+		const std::time_t seconds = static_cast<std::time_t>(record.time_us_ / 1000000);
+		char time[32];
+		const boost::posix_time::ptime utc_time = boost::posix_time::from_time_t(seconds);
+		std::snprintf(time, sizeof(time), "%s.%06d", boost::posix_time::to_iso_extended_string(utc_time).c_str(),
+			static_cast<int>(record.time_us_ % 1000000));
+
+		std::ostream& out = (record.level_ >= log_warning) ? std::cerr : std::clog;
+		out << time << " " << level_names[record.level_] << " [" <<
+			T_source_location(record.file_, record.line_, record.function_) << "] ";
+		out.write(record.message_, record.length_);
+		out << "\n";
+
+		// cell is free for producers on the next round of the ring buffer
+		record.sequence_.store(read_position_ + ring_size, std::memory_order_release);
+	}
+
+	const size_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+	if(dropped != 0) std::cerr << "Log records dropped, because the ring buffer was full: " << dropped << "\n";
+	if(count != 0 || dropped != 0) {
+		std::clog.flush();
+		std::cerr.flush();
+	}
+	return count;
+}
+// ----------------------------------------------------------------------------
+
+/// Write all records, which are in the ring buffer
+void T_log::flush() {
+	boost::lock_guard<boost::mutex> lock(drain_mutex_);
+	drain();
+}
+// ----------------------------------------------------------------------------
+
+/// Loop of background thread
+void T_log::run() {
+	while(!stop_.load(std::memory_order_acquire)) {
+		size_t count;
+		{
+			boost::lock_guard<boost::mutex> lock(drain_mutex_);
+			count = drain();
+		}
+		if(count == 0) boost::this_thread::sleep(boost::posix_time::milliseconds(static_cast<long>(idle_sleep_ms)));
+	}
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Start formatting of record
+///
+/// @param level level of record
+/// @param location place in source code
+///
+T_log::T_record_writer::T_record_writer(const T_log_level level, const T_source_location& location)
+	: level_(level), location_(location), streambuf_(message_, message_size), stream_(&streambuf_)
+{}
+// ----------------------------------------------------------------------------
+
+/// Put formatted record to the log
+T_log::T_record_writer::~T_record_writer() {
+	T_log::instance().push(level_, location_, message_, streambuf_.size());
+}
+// ----------------------------------------------------------------------------
@@ -0,0 +1,169 @@
+/**
+ * @file   log.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Asynchronous logging: records are put to lock-free ring buffer and are written by background thread
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef LOG_HPP
+#define LOG_HPP
+// ----------------------------------------------------------------------------
+#include <boost/noncopyable.hpp>
+#include <boost/thread/thread.hpp>
+// ----------------------------------------------------------------------------
+#include <atomic>
+#include <memory>
+#include <streambuf>
+#include <ostream>
+#include <string>
+#include <cstdint>
+// ----------------------------------------------------------------------------
+
+/// Levels of log records
+enum T_log_level {
+	log_trace,      ///< each connection
+	log_debug,      ///< errors of connections, which are usual (reset by peer...)
+	log_info,       ///< start and settings
+	log_warning,    ///< problems, which don't stop work
+	log_error,      ///< exceptions
+	log_off         ///< nothing
+};
+// ----------------------------------------------------------------------------
+
+/// Records with level below it aren't compiled at all
+#ifndef PORTMAPPING_LOG_MIN_LEVEL
+	#define PORTMAPPING_LOG_MIN_LEVEL log_debug
+#endif
+
+/// Name of current function
+#ifdef _MSC_VER
+	#define PORTMAPPING_FUNCTION __FUNCTION__
+#else
+	#define PORTMAPPING_FUNCTION __func__
+#endif
+// ----------------------------------------------------------------------------
+
+/// Place in source code: only pointers to string literals, without memory allocation
+struct T_source_location {
+	T_source_location(const char *const file, const int line, const char *const function)
+		: file_(file), line_(line), function_(function) {}
+
+	const char *file_;          ///< file name
+	int line_;                  ///< line number
+	const char *function_;      ///< function name
+};
+
+/// Current place in source code
+#define SOURCE_LOCATION T_source_location(__FILE__, __LINE__, PORTMAPPING_FUNCTION)
+
+/// Output place in source code as: file.cpp:line function
+std::ostream& operator<<(std::ostream& out, const T_source_location& location);
+// ----------------------------------------------------------------------------
+
+///
+/// Write record to the log, if its level is enabled:
+/// the message is formatted only in this case, by stream operators into the buffer on the stack
+///
+/// PORTMAPPING_LOG(log_info, "Start listener: " << local_endpoint_);
+///
+#define PORTMAPPING_LOG(level, message) PORTMAPPING_LOG_AT(level, SOURCE_LOCATION, message)
+
+/// Write record to the log with the specified place in source code
+#define PORTMAPPING_LOG_AT(level, location, message) \
+	do { \
+		if((level) >= PORTMAPPING_LOG_MIN_LEVEL && T_log::instance().enabled(level)) { \
+			T_log::T_record_writer log_record_writer_(level, location); \
+			log_record_writer_.stream() << message; \
+		} \
+	} while(false)
+// ----------------------------------------------------------------------------
+
+///
+/// Asynchronous log: records are formatted into fixed size buffers, put to the bounded lock-free ring buffer
+/// (multiple producers - single consumer) and are written to std::clog (std::cerr - warnings and errors)
+/// by the background thread. If the ring buffer is full, records are dropped and counted.
+///
+class T_log : private boost::noncopyable {
+public:
+	enum { message_size = 240 };            ///< max length of message, longer messages are truncated
+	enum { ring_size = 4096 };              ///< number of records in the ring buffer (power of 2)
+	enum { idle_sleep_ms = 10 };            ///< sleep of background thread, when the ring buffer is empty
+
+	/// Single log of process, background thread is started at the first use
+	static T_log& instance();
+
+	/// Whether records of this level are written
+	inline bool enabled(const T_log_level level) const { return level >= level_.load(std::memory_order_relaxed); }
+
+	/// Set min level of records, which are written
+	inline void set_level(const T_log_level level) { level_.store(level, std::memory_order_relaxed); }
+
+	/// Parse level name: trace, debug, info, warning, error, off
+	static T_log_level parse_level(const std::string& name);
+
+	/// Write all records, which are in the ring buffer
+	void flush();
+
+	/// Formatter of one record: message is formatted into the buffer on the stack, and is put to the log in destructor
+	class T_record_writer : private boost::noncopyable {
+		/// Stream buffer over the fixed array, it truncates the message
+		class T_array_streambuf : public std::streambuf {
+		public:
+			T_array_streambuf(char *const buffer, const size_t size) { setp(buffer, buffer + size); }
+			inline size_t size() const { return pptr() - pbase(); }
+		};
+	public:
+		T_record_writer(const T_log_level level, const T_source_location& location);
+		~T_record_writer();
+
+		/// Stream for message
+		inline std::ostream& stream() { return stream_; }
+
+	private:
+		const T_log_level level_;
+		const T_source_location location_;
+		char message_[message_size];
+		T_array_streambuf streambuf_;
+		std::ostream stream_;
+	};
+
+private:
+	/// Record in the ring buffer
+	struct T_record {
+		std::atomic<size_t> sequence_;      ///< sequence number of the cell: position for write, position+1 for read
+		T_log_level level_;
+		const char *file_;
+		int line_;
+		const char *function_;
+		int64_t time_us_;                   ///< system time, us since epoch
+		size_t length_;
+		char message_[message_size];
+	};
+
+	T_log();
+	~T_log();
+
+	/// Put record to the ring buffer, or drop it if the ring buffer is full
+	void push(const T_log_level level, const T_source_location& location, const char *const message, const size_t length);
+
+	/// Write all records, which are in the ring buffer, under drain_mutex_
+	size_t drain();
+
+	/// Loop of background thread
+	void run();
+
+	std::atomic<T_log_level> level_;        ///< min level of records, which are written
+	std::unique_ptr<T_record[]> ring_;      ///< ring buffer of records
+	std::atomic<size_t> write_position_;    ///< position of next record for producers
+	size_t read_position_;                  ///< position of next record for consumer
+	std::atomic<size_t> dropped_;           ///< records dropped since the last drain, because the ring buffer was full
+	boost::mutex drain_mutex_;              ///< only one consumer: background thread or flush()
+	std::atomic<bool> stop_;                ///< flag of stop of background thread
+	boost::thread thread_;                  ///< background thread
+};
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // LOG_HPP
@@ -10,9 +10,14 @@
  */
 // ----------------------------------------------------------------------------
 #include "server.hpp"
+#include "executors.hpp"
+#include "cpu_topology.hpp"
+#include "config.hpp"
+#include "metrics_server.hpp"
+#include "lifecycle.hpp"
 #include "seh_exception.hpp"
 // ----------------------------------------------------------------------------
-#include <boost/lexical_cast.hpp>
+#include <boost/bind.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/asio.hpp>
 // ----------------------------------------------------------------------------
@@ -20,6 +25,9 @@
 #include <iostream>
 #include <string>
 #include <locale>
+#include <vector>
+#include <memory>
+#include <csignal>
 
 
 /// 
@@ -33,8 +41,11 @@
 int main(int argc, char** argv) {
 	std::ofstream file_log, file_error;
 	try {
+#ifdef _MSC_VER
 		std::locale::global(std::locale("rus"));
-		std::cout << "Usage: main_boost_asio.exe [remote_port remote_address local_port local_address number_acceptors numer_executors language_locale]" << std::endl << std::endl;
+#endif
+		std::cout << "Usage: main_boost_asio.exe [remote_port remote_address[:port][,address2[:port2],...] local_port local_address number_acceptors numer_executors language_locale relay_mode(buffered|splice|uring) executors_mode(shared|sharded) connections_prealloc connections_max dns_refresh_seconds balance_policy(rr|least|p2c|hash) upstream_prewarm connect_timeout idle_timeout lifetime_timeout metrics_port socket_profile(os|default|latency|throughput|keepalive) listen_backlog max_connections max_connections_per_ip accept_rate bandwidth_connection bandwidth_client_ip bandwidth_mapping protocol(tcp|udp)]" << std::endl;
+		std::cout << "   or: main_boost_asio.exe --config file.ini" << std::endl << std::endl;
 
 #ifdef _MSC_VER
 		std::cout << "_MSC_VER  = " << _MSC_VER  << std::endl; 
@@ -43,49 +54,37 @@ int main(int argc, char** argv) {
 		std::cout << "__GNUC__  = " << __GNUC__  << ", __GNUC_MINOR__ = " << __GNUC_MINOR__ << std::endl;
 #endif
 
-		// Remote address::port
-		unsigned short remote_port = 80;
-		std::string remote_address = "google.com";
-
-		// Local interface address::port
-		unsigned short local_port = 10001;
-		std::string local_interface_address = "0.0.0.0";
-
-		// Number of thread for acceptors and executors
-		unsigned int thread_num_acceptors = 2;
-		unsigned int thread_num_executors = boost::thread::hardware_concurrency();
-
-		std::cout << "(Default: main_boost_asio.exe " << remote_port << " " << remote_address << " " << 
-			local_port << " " << local_interface_address << " " << 
-			thread_num_acceptors << " " << thread_num_executors << " " << std::locale::global(std::locale()).name() << ")" << std::endl;
-
-		// read remote port number from command line, if provided
-		if(argc > 1)
-			remote_port = boost::lexical_cast<unsigned short>(argv[1]);
-		// read remote address from command line, if provided
-		if(argc > 2)
-			remote_address = argv[2];
-
-		// read local port number from command line, if provided
-		if(argc > 3)
-			local_port = boost::lexical_cast<unsigned short>(argv[3]);
-		// read local interface address from command line, if provided
-		if(argc > 4)
-			local_interface_address = argv[4];
-
-		// read number of threads in thread pool from command line, if provided
-		if(argc > 5)
-			thread_num_acceptors = boost::lexical_cast<unsigned int>(argv[5]);
-		if(argc > 6)
-			thread_num_executors = boost::lexical_cast<unsigned int>(argv[6]);
+		{
+			const T_config defaults;
+			const T_mapping_config mapping;
+			std::cout << "(Default: main_boost_asio.exe " << mapping.remote_port_ << " " << mapping.remote_address_ << " " << 
+				mapping.local_port_ << " " << mapping.local_interface_address_ << " " << 
+				defaults.thread_num_acceptors_ << " " << defaults.thread_num_executors_ << " " << std::locale::global(std::locale()).name() << " buffered shared " << 
+				defaults.connections_prealloc_ << " " << defaults.connections_max_ << " " << mapping.dns_refresh_seconds_ << " " << 
+				T_backend_pool::policy_name(mapping.balance_policy_) << " " << mapping.upstream_prewarm_ << " " << 
+				mapping.timeouts_.connect_seconds_ << " " << mapping.timeouts_.idle_seconds_ << " " << mapping.timeouts_.lifetime_seconds_ << " " << 
+				defaults.metrics_port_ << " " << mapping.socket_options_.profile_ << " " << mapping.listen_backlog_ << " " << 
+				mapping.admission_.max_connections_ << " " << mapping.admission_.max_connections_per_ip_ << " " << 
+				mapping.admission_.accept_rate_ << " " << mapping.bandwidth_.connection_rate_ << " " << 
+				mapping.bandwidth_.client_ip_rate_ << " " << mapping.bandwidth_.mapping_rate_ << " tcp)" << std::endl;
+		}
+
+		// read settings: many port mappings from config file, or one port mapping from command line
+		const std::string config_file = (argc > 2 && (std::string(argv[1]) == "--config" || std::string(argv[1]) == "-c")) ? 
+			argv[2] : "";
+		const T_config config = !config_file.empty() ? T_config::from_file(config_file) : T_config::from_command_line(argc, argv);
 
 		// set language locale
-		if(argc > 7)
-			setlocale(LC_ALL, argv[7]);
+		if(!config.locale_.empty())
+			setlocale(LC_ALL, config.locale_.c_str());
 		// ----------------------------------------------------------------------------
 
 		// Enable Windows SEH exceptions. Compile with key: /EHa 
 		seh::seh_exception_init();
+#ifdef SIGPIPE
+		// write or splice() to the socket closed by peer returns EPIPE instead of termination of process
+		std::signal(SIGPIPE, SIG_IGN);
+#endif
 
 		if(true) std::cout.rdbuf(NULL);	// switch off std::cout
 				
@@ -101,20 +100,81 @@ int main(int argc, char** argv) {
 			std::clog.rdbuf(file_log.rdbuf());
 		}
 		std::clog << "----------------------------------------------------------------------------"  << std::endl;
+		T_log::instance().set_level(config.log_level_);
 		// ----------------------------------------------------------------------------
 
 
-		boost::asio::io_service io_service_acceptors, io_service_executors;
-		// construct new server object
-		T_server s(io_service_acceptors, io_service_executors, thread_num_acceptors, thread_num_executors,
-			remote_port, remote_address, local_port, local_interface_address);
-		// run io_service object, that perform all dispatch operations
+		// construct thread pool of executors, memory pools of connections and budgets, which are shared by all port mappings:
+		// order of destruction - not run handlers of acceptors, then of executors, and only then memory of connections held by them
+		T_overload_guard overload_guard(config.connections_max_, config.buffer_pool_max_bytes_, config.overload_resume_percent_);
+		std::unique_ptr<T_connection_slabs> connection_slabs_ptr;
+		bool uring = false;	// rings of io_uring are created only if any port mapping uses them
+		for(auto &mapping : config.mappings_) uring = uring || (mapping.relay_mode_ == relay_uring);
+		T_executors executors(config.thread_num_executors_, config.sharded_, uring ? config.uring_buffers_ : 0, config.executor_cpus_,
+							  config.busy_poll_us_);
+		boost::asio::io_service io_service_acceptors;
+		connection_slabs_ptr.reset(new T_connection_slabs(executors, config.connections_prealloc_, config.connections_max_));
+		T_connection_slabs& connection_slabs = *connection_slabs_ptr;
+		// construct new server object for each port mapping: each has own listener
+		std::vector<std::unique_ptr<T_server> > servers;
+		for(auto &mapping : config.mappings_)
+			servers.emplace_back(new T_server(io_service_acceptors, executors, connection_slabs, overload_guard,
+											  config.thread_num_acceptors_, mapping));
+
+		std::vector<T_server*> servers_ptrs;
+		for(auto &i : servers) servers_ptrs.push_back(i.get());
+
+		// HTTP listener of metrics of all port mappings
+		std::unique_ptr<T_metrics_server> metrics_server;
+		if(config.metrics_port_ != 0) {
+			metrics_server.reset(new T_metrics_server(io_service_acceptors, 
+				boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string(config.metrics_address_), config.metrics_port_),
+				servers_ptrs, connection_slabs));
+		}
+#ifdef PORTMAPPING_HANDOFF
+		T_server::close_inherited_listeners();	// listeners of the previous process, which aren't in settings of this one
+#endif
+
+		// signals: SIGTERM - draining, SIGHUP - reload of remote servers, SIGUSR2 - handoff of listeners to the new process
+		T_lifecycle lifecycle(io_service_acceptors, servers_ptrs, metrics_server.get(), overload_guard, config.drain_seconds_, 
+							  config_file, argv);
+
+		// create threads in pool for acceptors, pinned in turn to acceptor_cpus (the main thread takes the first one)
+		const std::vector<unsigned int>& acceptor_cpus = config.acceptor_cpus_;
+		if(!acceptor_cpus.empty()) {
+			if(!pin_this_thread_to_core(acceptor_cpus[0]))
+				PORTMAPPING_LOG(log_warning, "Acceptor thread isn't pinned to CPU " << acceptor_cpus[0]);
+			PORTMAPPING_LOG(log_info, "Acceptor threads are pinned to CPUs " << T_cpu_topology::format_list(acceptor_cpus));
+		}
+		std::vector<boost::thread> thr_grp_acceptors;
+		for(size_t i = 1; i < config.thread_num_acceptors_; ++i) {	// one main thread already in pool: io_service_acceptors.run()
+			if(acceptor_cpus.empty()) {
+				thr_grp_acceptors.emplace_back(boost::bind(&boost::asio::io_service::run, &io_service_acceptors));
+				continue;
+			}
+			const unsigned int cpu = acceptor_cpus[i % acceptor_cpus.size()];
+			thr_grp_acceptors.emplace_back([&io_service_acceptors, cpu]() {
+				if(!pin_this_thread_to_core(cpu))
+					PORTMAPPING_LOG(log_warning, "Acceptor thread isn't pinned to CPU " << cpu);
+				io_service_acceptors.run();
+			});
+		}
+
+		// run io_service object, that perform all dispatch operations (until the end of draining)
 		io_service_acceptors.run();
+
+		// stop all handlers before destruction of servers
+		io_service_acceptors.stop();
+		executors.stop();
+		for(auto &i : thr_grp_acceptors) i.join();
 	} catch (std::exception& e) {
 		std::cerr << e.what() << std::endl;
 	} catch (...) {
 		std::cerr << "Unknown exception!" << std::endl;
 	}
+	T_log::instance().flush();	// background thread of the log writes to these files until exit
+	if(file_log.is_open()) std::clog.rdbuf(NULL);
+	if(file_error.is_open()) std::cerr.rdbuf(NULL);
 	file_log.close(), file_error.close();
 
 	return 0;
@@ -0,0 +1,125 @@
+/**
+ * @file   metrics.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Counters of port mapping, sharded by threads
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "metrics.hpp"
+// ----------------------------------------------------------------------------
+
+/// Upper bounds of buckets of connect latency, us
+const uint64_t T_metrics::latency_bucket_us[T_metrics::latency_buckets] = {
+	100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000
+};
+// ----------------------------------------------------------------------------
+
+///
+/// Create counters
+///
+/// @param name name of port mapping
+///
+T_metrics::T_metrics(const std::string& name)
+	: name_(name)
+{
+	for(auto &i : shards_) i.store(NULL, std::memory_order_relaxed);
+}
+// ----------------------------------------------------------------------------
+
+T_metrics::~T_metrics() {
+	for(auto &i : shards_) delete i.load(std::memory_order_relaxed);
+}
+// ----------------------------------------------------------------------------
+
+/// Index of current thread, assigned at the first use
+size_t T_metrics::thread_index() {
+	static std::atomic<size_t> next_index(0);
+	static thread_local size_t index = next_index.fetch_add(1, std::memory_order_relaxed);
+	return index;
+}
+// ----------------------------------------------------------------------------
+
+/// Shard of current thread, it's created at the first use
+T_metrics::T_shard& T_metrics::shard() {
+	std::atomic<T_shard*>& slot = shards_[thread_index() % max_shards];
+	T_shard *current = slot.load(std::memory_order_acquire);
+	if(current != NULL) return *current;
+
+	T_shard *const created = new T_shard;
+	for(auto &i : created->counters_) i.store(0, std::memory_order_relaxed);
+	for(auto &i : created->latency_buckets_) i.store(0, std::memory_order_relaxed);
+	created->latency_sum_us_.store(0, std::memory_order_relaxed);
+	// other thread with the same index modulo max_shards could create it first
+	if(slot.compare_exchange_strong(current, created, std::memory_order_acq_rel, std::memory_order_acquire))
+		return *created;
+	delete created;
+	return *current;
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Add successful connect with its latency to histogram of current thread
+///
+/// @param latency_us latency of connect, us
+///
+void T_metrics::add_connect_latency(const uint64_t latency_us) {
+	T_shard& current = shard();
+	size_t bucket = 0;
+	while(bucket < latency_buckets && latency_us > latency_bucket_us[bucket]) ++bucket;
+	current.latency_buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+	current.latency_sum_us_.fetch_add(latency_us, std::memory_order_relaxed);
+}
+// ----------------------------------------------------------------------------
+
+/// Sum of counters of all threads
+T_metrics::T_snapshot T_metrics::snapshot() const {
+	T_snapshot sum = T_snapshot();
+	for(auto &i : shards_) {
+		const T_shard *const current = i.load(std::memory_order_acquire);
+		if(current == NULL) continue;
+		for(size_t c = 0; c < counters_count; ++c)
+			sum.counters_[c] += current->counters_[c].load(std::memory_order_relaxed);
+		for(size_t b = 0; b <= latency_buckets; ++b)
+			sum.latency_buckets_[b] += current->latency_buckets_[b].load(std::memory_order_relaxed);
+		sum.latency_sum_us_ += current->latency_sum_us_.load(std::memory_order_relaxed);
+	}
+	return sum;
+}
+// ----------------------------------------------------------------------------
+
+/// Name of counter in Prometheus format (without prefix)
+const char* T_metrics::counter_name(const T_counter counter) {
+	static const char *const names[counters_count] = {
+		"accepts_total", "accept_errors_total", "connections_opened_total", "connections_closed_total",
+		"client_to_server_bytes_total", "server_to_client_bytes_total",
+		"connect_failures_total", "connect_timeouts_total", "upstream_unavailable_total", "upstream_pool_hits_total",
+		"idle_timeouts_total", "lifetime_timeouts_total", "relay_errors_total",
+		"accept_batches_total", "accept_pauses_total", "connections_rejected_total",
+		"reads_deferred_total", "uring_buffer_waits_total", "udp_datagrams_dropped_total"
+	};
+	return names[counter];
+}
+// ----------------------------------------------------------------------------
+
+/// Description of counter
+const char* T_metrics::counter_help(const T_counter counter) {
+	static const char *const help[counters_count] = {
+		"Accepted connections", "Errors of accept",
+		"Connections, which started connect to the server", "Closed connections",
+		"Bytes read from clients", "Bytes read from servers",
+		"Failed connect attempts", "Connect attempts interrupted by timeout",
+		"Connections closed, because connect to all endpoints failed", "Connections, which adopted pre-established connection",
+		"Connections closed by idle timeout", "Connections closed by lifetime timeout",
+		"Directions of relay ended by error",
+		"Batches of connections taken from the listen queue at once and handed to executor",
+		"Delays of accept by overload, limit of connections or accept rate",
+		"Accepted connections closed at once by limits of connections of port mapping or of client IP",
+		"Reads deferred by limits of bandwidth",
+		"Receives of io_uring retried, because all provided buffers were in use",
+		"UDP datagrams dropped: too big, limit of sessions, no remote server or full socket buffer"
+	};
+	return help[counter];
+}
+// ----------------------------------------------------------------------------
@@ -0,0 +1,114 @@
+/**
+ * @file   metrics.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Counters of port mapping, sharded by threads
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef METRICS_HPP
+#define METRICS_HPP
+// ----------------------------------------------------------------------------
+#include <boost/noncopyable.hpp>
+// ----------------------------------------------------------------------------
+#include <atomic>
+#include <string>
+#include <cstdint>
+// ----------------------------------------------------------------------------
+
+///
+/// Counters of one port mapping. Each thread updates own shard of counters (cache-line padded),
+/// so there is no contention between threads: counters are summed only when they are read.
+///
+class T_metrics : private boost::noncopyable {
+public:
+	/// Counters
+	enum T_counter {
+		accepts,                    ///< accepted connections
+		accept_errors,              ///< errors of accept
+		connections_opened,         ///< connections, which started connect to the server
+		connections_closed,         ///< connections, which are closed (active = opened - closed)
+		bytes_client_to_server,     ///< bytes read from clients
+		bytes_server_to_client,     ///< bytes read from servers
+		connect_failures,           ///< failed connect attempts (also interrupted by timeout)
+		connect_timeouts,           ///< connect attempts interrupted by timeout
+		upstream_unavailable,       ///< connections closed, because connect to all endpoints failed
+		upstream_pool_hits,         ///< connections, which adopted pre-established connection to the server
+		idle_timeouts,              ///< connections closed by idle timeout
+		lifetime_timeouts,          ///< connections closed by lifetime timeout
+		relay_errors,               ///< directions of relay ended by error (not by EOF)
+		accept_batches,             ///< batches of connections taken from the listen queue at once and handed to executor
+		accept_pauses,              ///< delays of accept by overload of process, limit of connections of port mapping or accept rate
+		connections_rejected,       ///< accepted connections closed at once by limits of connections of port mapping or of client IP
+		reads_deferred,             ///< reads deferred by limits of bandwidth
+		uring_buffer_waits,         ///< receives of io_uring retried, because all provided buffers of the ring were in use
+		udp_datagrams_dropped,      ///< UDP datagrams dropped: too big, limit of sessions, no remote server or full socket buffer
+		counters_count
+	};
+
+	enum { cache_line_size = 64 };          ///< padding of shards
+	enum { max_shards = 256 };              ///< threads with greater indexes share shards (it's still correct)
+	enum { latency_buckets = 14 };          ///< number of buckets of histogram of connect latency (without +Inf)
+
+	/// Upper bounds of buckets of connect latency, us
+	static const uint64_t latency_bucket_us[latency_buckets];
+
+	/// Sum of shards
+	struct T_snapshot {
+		uint64_t counters_[counters_count];                 ///< counters
+		uint64_t latency_buckets_[latency_buckets + 1];     ///< connect latencies in each bucket (not cumulative), the last - +Inf
+		uint64_t latency_sum_us_;                           ///< sum of connect latencies, us
+	};
+
+	///
+	/// Create counters
+	///
+	/// @param name name of port mapping
+	///
+	explicit T_metrics(const std::string& name);
+	~T_metrics();
+
+	/// Add value to counter of current thread
+	inline void add(const T_counter counter, const uint64_t value = 1) {
+		shard().counters_[counter].fetch_add(value, std::memory_order_relaxed);
+	}
+
+	/// Add successful connect with its latency to histogram of current thread
+	void add_connect_latency(const uint64_t latency_us);
+
+	/// Sum of counters of all threads
+	T_snapshot snapshot() const;
+
+	/// Name of port mapping
+	inline const std::string& name() const { return name_; }
+
+	/// Name of counter in Prometheus format (without prefix)
+	static const char* counter_name(const T_counter counter);
+
+	/// Description of counter
+	static const char* counter_help(const T_counter counter);
+
+private:
+	/// Counters of one thread
+	struct T_shard {
+		char padding_before_[cache_line_size];
+		std::atomic<uint64_t> counters_[counters_count];
+		std::atomic<uint64_t> latency_buckets_[latency_buckets + 1];
+		std::atomic<uint64_t> latency_sum_us_;
+		char padding_after_[cache_line_size];
+	};
+
+	/// Shard of current thread, it's created at the first use
+	T_shard& shard();
+
+	/// Index of current thread, assigned at the first use
+	static size_t thread_index();
+
+	const std::string name_;                    ///< name of port mapping
+	std::atomic<T_shard*> shards_[max_shards];  ///< shards of threads by their indexes
+};
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // METRICS_HPP
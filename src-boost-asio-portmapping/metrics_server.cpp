@@ -0,0 +1,225 @@
+/**
+ * @file   metrics_server.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief HTTP endpoint with metrics of all port mappings in Prometheus text format
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "metrics_server.hpp"
+#include "buffer_pool.hpp"
+#include "handler_allocator.hpp"
+#include "log.hpp"
+
+#include <boost/bind.hpp>
+
+#include <sstream>
+// ----------------------------------------------------------------------------
+
+/// One request to the metrics server: it lives while the handlers hold it
+struct T_metrics_server::T_request {
+	explicit T_request(ba::io_service& io_service) : socket_(io_service) {}
+
+	ba::ip::tcp::socket socket_;            ///< socket of client
+	std::string request_;                   ///< data of request, which are read
+	char buffer_[512];                      ///< buffer for read
+	std::string response_;                  ///< response
+};
+// ----------------------------------------------------------------------------
+
+///
+/// Start listener
+///
+/// @param io_service io_service, in which requests are processed
+/// @param local_endpoint address:port to listen on
+/// @param servers port mappings, metrics of which are returned
+/// @param connection_slabs memory pools for connections
+///
+T_metrics_server::T_metrics_server(ba::io_service& io_service, const ba::ip::tcp::endpoint& local_endpoint,
+								   const std::vector<T_server*>& servers, T_connection_slabs& connection_slabs)
+	: io_service_(io_service), acceptor_(io_service), servers_(servers), connection_slabs_(connection_slabs)
+{
+#ifdef PORTMAPPING_HANDOFF
+	const int inherited_fd = T_server::take_inherited_listener(local_endpoint);
+	if(inherited_fd >= 0) acceptor_.assign(local_endpoint.protocol(), inherited_fd);
+#endif
+	if(!acceptor_.is_open()) {
+		acceptor_.open(local_endpoint.protocol());
+		acceptor_.set_option(ba::ip::tcp::acceptor::reuse_address(true));
+		acceptor_.bind(local_endpoint);
+		acceptor_.listen();
+	}
+	PORTMAPPING_LOG(log_info, "Start metrics listener: http://" << local_endpoint << "/metrics");
+	start_accept();
+}
+// ----------------------------------------------------------------------------
+
+/// Start accept of next request
+void T_metrics_server::start_accept() {
+	const T_request_ptr request(new T_request(io_service_));
+	acceptor_.async_accept(request->socket_,
+		boost::bind(&T_metrics_server::handle_accept, this, request, ba::placeholders::error));
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Run when new connection is accepted
+///
+/// @param request request
+/// @param e reference to error object
+///
+void T_metrics_server::handle_accept(T_request_ptr request, const bs::error_code& e) {
+	if(e == ba::error::operation_aborted) return;	// acceptor is closed
+	if(!e) handle_read(request, bs::error_code(), 0);
+	start_accept();
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Run when part of request is read: read next part, or write response after the end of headers
+///
+/// @param request request
+/// @param err reference to error object
+/// @param len length of data, that have been read
+///
+void T_metrics_server::handle_read(T_request_ptr request, const bs::error_code& err, const size_t len) {
+	if(err) return;		// socket is closed with the last handler
+	request->request_.append(request->buffer_, len);
+	if(request->request_.find("\r\n\r\n") == std::string::npos && request->request_.size() < max_request_size) {
+		request->socket_.async_read_some(ba::buffer(request->buffer_),
+			boost::bind(&T_metrics_server::handle_read, this, request, ba::placeholders::error, ba::placeholders::bytes_transferred));
+		return;
+	}
+
+	std::ostringstream body;
+	write(body);
+	std::ostringstream response;
+	response << "HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: " << body.str().size() << "\r\n"
+		"Connection: close\r\n\r\n" << body.str();
+	request->response_ = response.str();
+	ba::async_write(request->socket_, ba::buffer(request->response_),
+		boost::bind(&T_metrics_server::handle_write, this, request, ba::placeholders::error));
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Run when response is written
+///
+/// @param request request
+/// @param err reference to error object
+///
+void T_metrics_server::handle_write(T_request_ptr request, const bs::error_code& err) {
+	if(err) return;	// the socket is closed with the last reference to request
+	bs::error_code ec;
+	request->socket_.shutdown(ba::socket_base::shutdown_both, ec);
+}
+// ----------------------------------------------------------------------------
+
+/// Value of label escaped as in Prometheus text format: backslash, double quote and line feed
+static std::string escape_label(const std::string& value) {
+	std::string escaped;
+	escaped.reserve(value.size());
+	for(auto c : value) {
+		if(c == '\\') escaped += "\\\\";
+		else if(c == '"') escaped += "\\\"";
+		else if(c == '\n') escaped += "\\n";
+		else escaped += c;
+	}
+	return escaped;
+}
+
+/// Labels of port mapping
+static std::string mapping_labels(const T_server& server) {
+	return "mapping=\"" + escape_label(server.name()) + "\"";
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Write all metrics in Prometheus text format
+///
+/// @param out stream for output
+///
+void T_metrics_server::write(std::ostream& out) const {
+	std::vector<T_metrics::T_snapshot> snapshots;
+	for(auto &server : servers_) snapshots.push_back(server->metrics().snapshot());
+
+	// counters of port mappings
+	for(size_t c = 0; c < T_metrics::counters_count; ++c) {
+		const T_metrics::T_counter counter = static_cast<T_metrics::T_counter>(c);
+		out << "# HELP portmapping_" << T_metrics::counter_name(counter) << " " << T_metrics::counter_help(counter) << "\n";
+		out << "# TYPE portmapping_" << T_metrics::counter_name(counter) << " counter\n";
+		for(size_t i = 0; i < servers_.size(); ++i)
+			out << "portmapping_" << T_metrics::counter_name(counter) << "{" << mapping_labels(*servers_[i]) << "} " << 
+				snapshots[i].counters_[c] << "\n";
+	}
+
+	out << "# HELP portmapping_active_connections Connections, which are connecting or relaying\n";
+	out << "# TYPE portmapping_active_connections gauge\n";
+	for(size_t i = 0; i < servers_.size(); ++i)
+		out << "portmapping_active_connections{" << mapping_labels(*servers_[i]) << "} " << 
+			(snapshots[i].counters_[T_metrics::connections_opened] - snapshots[i].counters_[T_metrics::connections_closed]) << "\n";
+
+	// histogram of connect latency
+	out << "# HELP portmapping_connect_latency_seconds Latency of successful connect to the server\n";
+	out << "# TYPE portmapping_connect_latency_seconds histogram\n";
+	for(size_t i = 0; i < servers_.size(); ++i) {
+		const std::string labels = mapping_labels(*servers_[i]);
+		uint64_t cumulative = 0;
+		for(size_t b = 0; b <= T_metrics::latency_buckets; ++b) {
+			cumulative += snapshots[i].latency_buckets_[b];
+			out << "portmapping_connect_latency_seconds_bucket{" << labels << ",le=\"";
+			if(b < T_metrics::latency_buckets) out << (T_metrics::latency_bucket_us[b] / 1e6);
+			else out << "+Inf";
+			out << "\"} " << cumulative << "\n";
+		}
+		out << "portmapping_connect_latency_seconds_sum{" << labels << "} " << (snapshots[i].latency_sum_us_ / 1e6) << "\n";
+		out << "portmapping_connect_latency_seconds_count{" << labels << "} " << cumulative << "\n";
+	}
+
+	// remote servers: load and health of their endpoints
+	out << "# HELP portmapping_backend_active_connections Active connections to the remote server\n";
+	out << "# TYPE portmapping_backend_active_connections gauge\n";
+	for(auto &server : servers_)
+		for(auto &backend : server->backends().current().backends_)
+			out << "portmapping_backend_active_connections{" << mapping_labels(*server) << ",backend=\"" << escape_label(backend->name_) << "\"} " << 
+				backend->active_connections_.load(std::memory_order_relaxed) << "\n";
+
+	const int64_t now_ms = T_endpoint_table::now_ms();
+	out << "# HELP portmapping_endpoint_healthy Whether endpoint of the remote server isn't in backoff after connect failures\n";
+	out << "# TYPE portmapping_endpoint_healthy gauge\n";
+	std::ostringstream latencies;
+	latencies << "# HELP portmapping_endpoint_connect_latency_seconds Average connect latency to endpoint of the remote server\n";
+	latencies << "# TYPE portmapping_endpoint_connect_latency_seconds gauge\n";
+	for(auto &server : servers_)
+		for(auto &backend : server->backends().current().backends_) {
+			const T_endpoint_table::T_endpoints_ptr endpoints = backend->endpoints_.endpoints();
+			for(auto &endpoint : *endpoints) {
+				std::ostringstream address;
+				address << endpoint->endpoint_;
+				std::ostringstream labels;
+				labels << mapping_labels(*server) << ",backend=\"" << escape_label(backend->name_) << 
+					"\",endpoint=\"" << escape_label(address.str()) << "\"";
+				out << "portmapping_endpoint_healthy{" << labels.str() << "} " << 
+					(endpoint->down_until_ms_.load(std::memory_order_relaxed) <= now_ms ? 1 : 0) << "\n";
+				latencies << "portmapping_endpoint_connect_latency_seconds{" << labels.str() << "} " << 
+					(endpoint->connect_latency_us_.load(std::memory_order_relaxed) / 1e6) << "\n";
+			}
+		}
+	out << latencies.str();
+
+	// memory pools, which are shared by all port mappings
+	out << "# HELP portmapping_connection_slots Allocated slots of memory pools for connections\n";
+	out << "# TYPE portmapping_connection_slots gauge\n";
+	out << "portmapping_connection_slots " << connection_slabs_.allocated_slots() << "\n";
+	out << "# HELP portmapping_buffer_pool_bytes Memory of buffers for data allocated by the buffer pool\n";
+	out << "# TYPE portmapping_buffer_pool_bytes gauge\n";
+	out << "portmapping_buffer_pool_bytes " << T_buffer_pool::instance().allocated_bytes() << "\n";
+	out << "# HELP portmapping_handler_overflow_total Handlers, which didn't fit to the arena of connection\n";
+	out << "# TYPE portmapping_handler_overflow_total counter\n";
+	out << "portmapping_handler_overflow_total{source=\"cache\"} " << T_handler_overflow::cache_allocations() << "\n";
+	out << "portmapping_handler_overflow_total{source=\"heap\"} " << T_handler_overflow::heap_allocations() << "\n";
+}
+// ----------------------------------------------------------------------------
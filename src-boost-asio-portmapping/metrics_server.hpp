@@ -0,0 +1,75 @@
+/**
+ * @file   metrics_server.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief HTTP endpoint with metrics of all port mappings in Prometheus text format
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef METRICS_SERVER_HPP
+#define METRICS_SERVER_HPP
+// ----------------------------------------------------------------------------
+#include "server.hpp"
+// ----------------------------------------------------------------------------
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+namespace bs = boost::system;
+// ----------------------------------------------------------------------------
+#include <vector>
+#include <string>
+#include <ostream>
+// ----------------------------------------------------------------------------
+
+///
+/// Local HTTP server: on any request returns counters of port mappings, health of their remote servers
+/// and memory of pools in Prometheus text format, and closes connection
+///
+class T_metrics_server : private boost::noncopyable {
+public:
+	enum { max_request_size = 4096 };       ///< request is read only until the end of headers or this size
+
+	///
+	/// Start listener
+	///
+	/// @param io_service io_service, in which requests are processed
+	/// @param local_endpoint address:port to listen on
+	/// @param servers port mappings, metrics of which are returned
+	/// @param connection_slabs memory pools for connections
+	///
+	T_metrics_server(ba::io_service& io_service, const ba::ip::tcp::endpoint& local_endpoint,
+					 const std::vector<T_server*>& servers, T_connection_slabs& connection_slabs);
+
+	/// Write all metrics in Prometheus text format
+	void write(std::ostream& out) const;
+
+	/// Listening socket
+	inline ba::ip::tcp::acceptor& acceptor() { return acceptor_; }
+
+private:
+	struct T_request;
+	typedef boost::shared_ptr<T_request> T_request_ptr;
+
+	/// Start accept of next request
+	void start_accept();
+
+	/// Run when new connection is accepted
+	void handle_accept(T_request_ptr request, const bs::error_code& e);
+
+	/// Run when part of request is read: read next part, or write response after the end of headers
+	void handle_read(T_request_ptr request, const bs::error_code& err, const size_t len);
+
+	/// Run when response is written
+	void handle_write(T_request_ptr request, const bs::error_code& err);
+
+	ba::io_service& io_service_;                    ///< io_service, in which requests are processed
+	ba::ip::tcp::acceptor acceptor_;                ///< listener
+	const std::vector<T_server*> servers_;          ///< port mappings
+	T_connection_slabs& connection_slabs_;          ///< memory pools for connections
+};
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // METRICS_SERVER_HPP
@@ -0,0 +1,99 @@
+/**
+ * @file   pacer.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Scheduler of deferred reads of connections for bandwidth shaping
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "pacer.hpp"
+
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <chrono>
+// ----------------------------------------------------------------------------
+
+///
+/// Create pacer
+///
+/// @param io_service io_service, in which deferred tasks are resumed
+///
+T_pacer::T_pacer(ba::io_service& io_service)
+	: processed_tick_(now_us() / tick_us), deferred_(0), timer_started_(false), tick_timer_(io_service)
+{
+	for(auto &slot : slots_) slot = NULL;
+}
+// ----------------------------------------------------------------------------
+
+/// Current time of steady clock in us
+int64_t T_pacer::now_us() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Defer task
+///
+/// @param task task
+/// @param resume_at_us time of resume (steady clock, us)
+///
+void T_pacer::defer(T_task& task, const int64_t resume_at_us) {
+	int64_t tick = (resume_at_us + tick_us - 1) / tick_us;
+	boost::lock_guard<boost::mutex> lock(mutex_);
+	if(deferred_ == 0) processed_tick_ = now_us() / tick_us - 1;	// all slots are empty: skip ticks without timer
+	if(tick <= processed_tick_) tick = processed_tick_ + 1;
+	if(tick - processed_tick_ >= wheel_size) tick = processed_tick_ + wheel_size - 1;	// read is charged again after resume
+
+	T_task *&slot = slots_[tick % wheel_size];
+	task.next_ = slot;
+	slot = &task;
+	++deferred_;
+	if(!timer_started_) start_tick_timer();
+}
+// ----------------------------------------------------------------------------
+
+/// Start wait of the next tick
+void T_pacer::start_tick_timer() {
+	timer_started_ = true;
+	tick_timer_.expires_from_now(boost::posix_time::microseconds(static_cast<long>(tick_us)));
+	tick_timer_.async_wait(boost::bind(&T_pacer::handle_tick, this, ba::placeholders::error));
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Run every tick_us while there are deferred tasks: resume tasks of all passed slots (many, if the io_service was busy)
+///
+/// @param err
+///
+void T_pacer::handle_tick(const bs::error_code& err) {
+	if(err == ba::error::operation_aborted) return;
+	T_task *resumed = NULL;
+	{
+		const int64_t now_tick = now_us() / tick_us;
+		boost::lock_guard<boost::mutex> lock(mutex_);
+		const int64_t last_tick = (now_tick - processed_tick_ > wheel_size) ? processed_tick_ + wheel_size : now_tick;
+		for(int64_t tick = processed_tick_ + 1; tick <= last_tick; ++tick) {
+			T_task *&slot = slots_[tick % wheel_size];
+			while(slot != NULL) {
+				T_task& task = *slot;
+				slot = task.next_;
+				task.next_ = resumed;
+				resumed = &task;
+				--deferred_;
+			}
+		}
+		if(now_tick > processed_tick_) processed_tick_ = now_tick;
+		if(deferred_ != 0) start_tick_timer();
+		else timer_started_ = false;
+	}
+	// tasks can be deferred again from on_resume()
+	while(resumed != NULL) {
+		T_task& task = *resumed;
+		resumed = task.next_;
+		task.next_ = NULL;
+		task.on_resume();
+	}
+}
+// ----------------------------------------------------------------------------
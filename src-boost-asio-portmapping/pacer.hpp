@@ -0,0 +1,82 @@
+/**
+ * @file   pacer.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Scheduler of deferred reads of connections for bandwidth shaping
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef PACER_HPP
+#define PACER_HPP
+// ----------------------------------------------------------------------------
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+namespace bs = boost::system;
+// ----------------------------------------------------------------------------
+#include <cstdint>
+// ----------------------------------------------------------------------------
+
+///
+/// Scheduler of deferred reads: one per io_service of executors, so there isn't timer per connection.
+/// Tasks are intrusive (no memory allocation) and are put to the ring of wheel_size slots of tick_us each,
+/// one deadline_timer runs only while there are deferred tasks, and tasks are resumed outside of the mutex.
+///
+class T_pacer : private boost::noncopyable {
+public:
+	enum { tick_us = 1000 };                ///< resolution of deferral
+	enum { wheel_size = 1024 };             ///< number of slots: max deferral is about 1 sec, longer deferrals are cut to it
+
+	/// Base class for objects, which are deferred
+	class T_task {
+	public:
+		/// Run by the pacer in its io_service, when time of deferral is reached
+		virtual void on_resume() = 0;
+
+	protected:
+		T_task() : next_(NULL) {}
+		~T_task() {}
+
+	private:
+		friend class T_pacer;
+		T_task *next_;                      ///< next task in the slot
+	};
+
+	///
+	/// Create pacer
+	///
+	/// @param io_service io_service, in which deferred tasks are resumed
+	///
+	T_pacer(ba::io_service& io_service);
+
+	///
+	/// Defer task: it must not be deferred already
+	///
+	/// @param task task
+	/// @param resume_at_us time of resume (steady clock, us), if it is already passed - task is resumed on the next tick
+	///
+	void defer(T_task& task, const int64_t resume_at_us);
+
+	/// Current time of steady clock in us
+	static int64_t now_us();
+
+private:
+	/// Run every tick_us while there are deferred tasks: resume tasks of all passed slots
+	void handle_tick(const bs::error_code& err);
+
+	/// Start wait of the next tick, mutex_ must be locked
+	void start_tick_timer();
+
+	T_task *slots_[wheel_size];             ///< heads of lists of tasks in slots
+	int64_t processed_tick_;                ///< the last tick, tasks of which are resumed
+	size_t deferred_;                       ///< number of deferred tasks
+	bool timer_started_;                    ///< whether tick_timer_ is waiting
+	boost::mutex mutex_;                    ///< mutex for slots (in shared mode of executors the pacer is used by many threads)
+	ba::deadline_timer tick_timer_;         ///< timer of ticks
+};
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // PACER_HPP
@@ -8,131 +8,534 @@
  */
 // ----------------------------------------------------------------------------
 #include "server.hpp"
+#include "cpu_topology.hpp"
 
 #include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 
-#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <cstdlib>
+// ----------------------------------------------------------------------------
+#ifdef PORTMAPPING_ACCEPT4
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+// ----------------------------------------------------------------------------
+#if defined(__linux__) && defined(SO_REUSEPORT)
+	#define PORTMAPPING_REUSEPORT	///< kernel balances connections between many listening sockets on the same port
+	/// socket option to allow many listening sockets bound to the same address:port
+	typedef ba::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> T_reuse_port;
+#endif
+// ----------------------------------------------------------------------------
+
+/// 
+/// Create memory pools
+/// 
+/// @param executors thread pool of executors, one pool per its io_service
+/// @param connections_prealloc number of connections, memory for which is allocated at start (for all pools)
+/// @param connections_max hard cap of simultaneous connections (for all pools)
+///
+T_connection_slabs::T_connection_slabs(const T_executors& executors, size_t connections_prealloc, size_t connections_max)
+{
+	const size_t shards = executors.size();
+	for(size_t i = 0; i < shards; ++i)
+		slabs_.emplace_back(new T_connection_slab((connections_prealloc + shards - 1) / shards, 
+												  (connections_max + shards - 1) / shards, executors.node(i)));
+}
+// ----------------------------------------------------------------------------
+
+/// Number of slots in allocated slabs of all pools
+size_t T_connection_slabs::allocated_slots() const {
+	size_t slots = 0;
+	for(auto &i : slabs_) slots += i->allocated_slots();
+	return slots;
+}
 // ----------------------------------------------------------------------------
 
 /// 
 /// Initialize all needed data
 /// 
-/// @param io_service reference to io_service
-/// @param thread_num_acceptors number of threads in thread pool for acceptors
-/// @param thread_num_executors number of threads in thread pool for executors
-/// @param remote_port port to port mapping on
-/// @param remote_address address to port mapping on
-/// @param local_port port to listen on, by default - 10001
-/// @param local_interface_address local interface address to listen on
-///
-T_server::T_server(ba::io_service& io_service_acceptors, ba::io_service& io_service_executors, 
-				   unsigned int thread_num_acceptors, unsigned int thread_num_executors, 
-				   unsigned int remote_port, std::string remote_address,
-				   unsigned int local_port, std::string local_interface_address)
+/// @param io_service_acceptors reference to io_service of acceptors
+/// @param executors reference to thread pool of executors, in which connections will work
+/// @param connection_slabs reference to memory pools for connections
+/// @param overload_guard reference to budgets of process, which are shared by all port mappings
+/// @param thread_num_acceptors number of threads in thread pool for acceptors (number of simultaneous accept operations)
+/// @param mapping settings of port mapping: local and remote addresses, relay mode, balance policy...
+///
+T_server::T_server(ba::io_service& io_service_acceptors, T_executors& executors, T_connection_slabs& connection_slabs,
+				   T_overload_guard& overload_guard, unsigned int thread_num_acceptors, const T_mapping_config& mapping)
 	: io_service_acceptors_(io_service_acceptors),
-	  io_service_executors_(io_service_executors),
+	  executors_(executors),
+	  connection_slabs_(connection_slabs),
 	  work_acceptors_(io_service_acceptors_),
-	  work_executors_(io_service_executors_),
-	  local_endpoint_(local_interface_address.empty()?	
-				(ba::ip::tcp::endpoint(ba::ip::tcp::v4(), local_port)): // INADDR_ANY for v4 (in6addr_any if the fix to v6)
-				ba::ip::tcp::endpoint(ba::ip::address().from_string(local_interface_address), local_port) ),   // specified ip address
-	  acceptor_(io_service_acceptors_, local_endpoint_)                 // By default set option to reuse the address (i.e. SO_REUSEADDR)
+	  name_(!mapping.name_.empty() ? mapping.name_ : 
+			mapping.local_interface_address_ + ":" + boost::lexical_cast<std::string>(mapping.local_port_)),
+	  local_endpoint_(mapping.local_interface_address_.empty()?	
+				(ba::ip::tcp::endpoint(ba::ip::tcp::v4(), mapping.local_port_)): // INADDR_ANY for v4 (in6addr_any if the fix to v6)
+				ba::ip::tcp::endpoint(ba::ip::address().from_string(mapping.local_interface_address_), mapping.local_port_) ),   // specified ip address
+	  next_shard_(0),
+	  accepting_(true),
+	  backends_(io_service_acceptors_, mapping.remote_address_, mapping.remote_port_, 
+				mapping.balance_policy_, mapping.dns_refresh_seconds_),	// resolve remote address:port of servers
+	  relay_mode_(mapping.relay_mode_),
+	  timeouts_(mapping.timeouts_),
+	  socket_options_(mapping.socket_options_),
+	  listen_backlog_(mapping.listen_backlog_),
+	  admission_(overload_guard, mapping.admission_),
+	  bandwidth_(mapping.bandwidth_),
+	  metrics_(name_)
 {
-	// Resolve remote address:port of server
-	boost::asio::ip::tcp::resolver resolver(io_service_executors_);
-	ba::ip::tcp::resolver::query query(remote_address, boost::lexical_cast<std::string>(remote_port) );
-	remote_endpoint_it_ = resolver.resolve(query);
-
-	std::clog << "Remote resolved endpoints for: " << remote_address << std::endl;
-	unsigned remote_number = 0;
-	for(auto it = remote_endpoint_it_; it != ba::ip::tcp::resolver::iterator(); ++it, ++remote_number)
-		std::clog << remote_number << ": " << it->endpoint() << std::endl;
-	std::clog << std::endl;
-
-	const ba::ip::tcp::endpoint remote_endpoint_ = *remote_endpoint_it_;
-	std::clog << "Start with remote: " << remote_endpoint_ << std::endl;
-	std::clog << "Start listener: " << local_endpoint_ << std::endl << std::endl;
-
-	// create threads in pool for executors
-	for(size_t i = 0; i < thread_num_executors; ++i)
-		thr_grp_executors_.emplace_back(boost::bind(&boost::asio::io_service::run, &io_service_executors_));
-
-	// create threads in pool and start acceptors
-	for(size_t i = 0; i < thread_num_acceptors; ++i) {
-		// create threads in pool
-		if(i != 0)	// one main thread already in pool from: int main() { ... io_service_acceptors.run(); ... }
-			thr_grp_acceptors_.emplace_back(boost::bind(&boost::asio::io_service::run, &io_service_acceptors_));
-
-		// create memory pool for objects of connections	
-		T_memory_pool_ptr memory_pool_ptr(new T_memory_pool, T_memory_pool_deleter() );
-		
-		// create next connection, that will accepted next
-		T_connection * const memory_pool_raw_ptr = reinterpret_cast<T_connection *>( memory_pool_ptr.get() );
-		T_connection * const new_connection_raw_ptr = T_connection::create(memory_pool_raw_ptr, 0, io_service_executors_);
-		
-		// start another acceptor in async mode
-		acceptor_.async_accept(new_connection_raw_ptr->socket(),
-								new_connection_raw_ptr->server_bind(
-										   boost::bind(&T_server::handle_accept, this, 
-													   boost::move(memory_pool_ptr),   // doesn't copy and doesn't use the atomic counter with memory barrier
-													   0,
-													   ba::placeholders::error)) );
+	PORTMAPPING_LOG(log_info, "Port mapping: " << name_);
+	for(auto &i : backends_.current().backends_)
+		PORTMAPPING_LOG(log_info, "Start with remote: " << (*i->endpoints_.endpoints())[0]->endpoint_);
+	if(backends_.current().backends_.size() > 1)
+		PORTMAPPING_LOG(log_info, "Balance policy: " << T_backend_pool::policy_name(backends_.policy()));
+	if(mapping.protocol_ == protocol_udp) {
+		// datagrams are relayed by the executors, there are no acceptors and connections
+		PORTMAPPING_LOG(log_info, "Protocol: udp, start listener: " << local_endpoint_);
+		udp_.reset(new T_udp_mapping(executors_, ba::ip::udp::endpoint(local_endpoint_.address(), local_endpoint_.port()),
+									 backends_, metrics_, mapping.udp_));
+		return;
+	}
+	if(mapping.upstream_prewarm_ > 0) {
+		backends_.start_upstream_pools(io_service_acceptors_, executors_, mapping.upstream_prewarm_, mapping.upstream_max_idle_seconds_,
+									   socket_options_);
+		PORTMAPPING_LOG(log_info, "Pre-established connections: " << mapping.upstream_prewarm_ << " to each remote for each executor");
+	}
+	PORTMAPPING_LOG(log_info, "Start listener: " << local_endpoint_);
+#ifdef PORTMAPPING_SPLICE
+	PORTMAPPING_LOG(log_info, "Relay mode: " << ((relay_mode_ == relay_splice) ? "splice" : 
+		(relay_mode_ == relay_uring && executors_.get_uring(0) != NULL) ? "uring" : "buffered"));
+#else
+	PORTMAPPING_LOG(log_info, "Relay mode: buffered");
+#endif
+	PORTMAPPING_LOG(log_info, "Timeouts (sec, 0 - disabled): connect " << timeouts_.connect_seconds_ << ", idle " << timeouts_.idle_seconds_ << 
+		", lifetime " << timeouts_.lifetime_seconds_);
+	PORTMAPPING_LOG(log_info, "Socket options: " << socket_options_ << ", listen queue " << listen_backlog_);
+	PORTMAPPING_LOG(log_info, "Limits (0 - unlimited): connections " << mapping.admission_.max_connections_ << 
+		", per client IP " << mapping.admission_.max_connections_per_ip_ << 
+		", accept rate " << mapping.admission_.accept_rate_ << "/sec with burst " << mapping.admission_.accept_burst_);
+	PORTMAPPING_LOG(log_info, "Bandwidth (bytes/sec each direction, 0 - unlimited): connection " << mapping.bandwidth_.connection_rate_ << 
+		", client IP " << mapping.bandwidth_.client_ip_rate_ << ", mapping " << mapping.bandwidth_.mapping_rate_ << 
+		" with burst " << mapping.bandwidth_.burst_bytes_);
+#if defined(__linux__)
+	// the kernel silently truncates the listen queue, and on overflow SYN of new connections are dropped
+	int somaxconn = 0;
+	std::ifstream("/proc/sys/net/core/somaxconn") >> somaxconn;
+	if(somaxconn > 0 && listen_backlog_ > somaxconn)
+		PORTMAPPING_LOG(log_warning, "Listen queue " << listen_backlog_ << " is truncated to net.core.somaxconn = " << somaxconn);
+#endif
+
+#ifdef PORTMAPPING_REUSEPORT
+	if(executors_.sharded()) {
+		PORTMAPPING_LOG(log_info, "Executors: sharded, " << executors_.size() << " listeners with SO_REUSEPORT");
+
+		// each shard has own listening socket and own io_service, in which all its connections work
+		const size_t shards = executors_.size();
+		for(size_t i = 0; i < shards; ++i) {
+			acceptors_io_services_.push_back(&executors_.get_io_service(i));
+			acceptors_.emplace_back(new ba::ip::tcp::acceptor(executors_.get_io_service(i)));
+			listen(*acceptors_.back(), true);
+
+			// start acceptor in async mode
+			start_accept(i);
+		}
+		steer_by_cpu();
+		return;
 	}
+#endif
+	PORTMAPPING_LOG(log_info, "Executors: " << (executors_.sharded()?"sharded":"shared") << ", " << 
+		thread_num_acceptors << " acceptors on one listener");
+
+	acceptors_io_services_.push_back(&io_service_acceptors_);
+	acceptors_.emplace_back(new ba::ip::tcp::acceptor(io_service_acceptors_));
+	listen(*acceptors_.back(), false);
+
+	// start acceptors: one accept operation per thread of acceptors
+	for(size_t i = 0; i < thread_num_acceptors; ++i)
+		start_accept(0);
 }
 // ----------------------------------------------------------------------------
 
 /// 
-/// Stop io_services and
-/// wait for all executing threads
+/// Stop resolvers of remote servers and io_services,
+/// so handlers of this server aren't executed after its destruction
+/// (threads of acceptors are joined by their owner)
 /// 
 ///
 T_server::~T_server() {
+	backends_.stop();
 	io_service_acceptors_.stop();
-	io_service_executors_.stop();
-	for(auto &i : thr_grp_acceptors_) i.join();
-	for(auto &i : thr_grp_executors_) i.join();
+	executors_.stop();
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Replace the list of remote servers by one from new settings of this port mapping,
+/// established connections aren't dropped
+/// 
+/// @param mapping new settings of port mapping (only remote_address_ and remote_port_ are used)
+///
+void T_server::reload_backends(const T_mapping_config& mapping) {
+	const size_t added = backends_.reload(mapping.remote_address_, mapping.remote_port_);
+	std::ostringstream names;
+	for(auto &i : backends_.current().backends_) names << " " << i->name_;
+	PORTMAPPING_LOG(log_info, "Port mapping " << name_ << ": reloaded remotes (" << added << " new):" << names.str());
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Stop accept of new connections and close listening sockets, established connections go on:
+/// each acceptor is closed in its io_service, and pending accept operations are aborted
+/// 
+///
+void T_server::stop_accept() {
+	if(!accepting_.exchange(false)) return;
+	if(udp_) udp_->stop();
+	for(size_t i = 0; i < acceptors_.size(); ++i) {
+		ba::ip::tcp::acceptor *const acceptor = acceptors_[i].get();
+		acceptors_io_services_[i]->post([acceptor]() {
+			bs::error_code ec;
+			acceptor->close(ec);
+		});
+	}
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Open, bind and listen acceptor with the listen queue of listen_backlog_,
+/// or adopt listening socket inherited from the previous process
+/// 
+/// @param acceptor acceptor, which isn't opened yet
+/// @param reuse_port true - many listening sockets on the same port (SO_REUSEPORT)
+///
+void T_server::listen(ba::ip::tcp::acceptor& acceptor, const bool reuse_port) {
+#ifdef PORTMAPPING_HANDOFF
+	const int inherited_fd = take_inherited_listener(local_endpoint_);
+	if(inherited_fd >= 0) {
+		acceptor.assign(local_endpoint_.protocol(), inherited_fd);
+		acceptor.listen(listen_backlog_);	// the same socket with the listen queue of new settings
+		acceptor.non_blocking(true);
+		PORTMAPPING_LOG(log_info, "Adopted inherited listener: " << local_endpoint_ << " fd " << inherited_fd);
+		return;
+	}
+#endif
+	acceptor.open(local_endpoint_.protocol());
+	// By default set option to reuse the address (i.e. SO_REUSEADDR)
+	acceptor.set_option(ba::ip::tcp::acceptor::reuse_address(true));
+#ifdef PORTMAPPING_REUSEPORT
+	if(reuse_port) acceptor.set_option(T_reuse_port(true));
+#endif
+	acceptor.bind(local_endpoint_);
+	acceptor.listen(listen_backlog_);
+#ifdef PORTMAPPING_ACCEPT4
+	acceptor.non_blocking(true);	// accept4() returns EAGAIN, when the listen queue is empty
+#endif
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Steer new connections to the listener of shard, which executor runs on the CPU, that received their SYN
+/// from NIC (by RSS queue and its interrupt), or else on the same NUMA node: data of connection 
+/// aren't moved between caches of CPUs and between nodes
+///
+void T_server::steer_by_cpu() {
+	if(acceptors_.size() < 2) return;
+	std::vector<unsigned int> cpus;
+	for(size_t i = 0; i < acceptors_.size(); ++i) {
+		if(executors_.cpu(i) < 0) return;	// executors aren't pinned
+		cpus.push_back(static_cast<unsigned int>(executors_.cpu(i)));
+	}
+	if(steer_reuseport_by_cpu(static_cast<int>(acceptors_[0]->native_handle()), cpus))
+		PORTMAPPING_LOG(log_info, "Listeners: connections are steered to executors by CPU of receive");
+	else
+		PORTMAPPING_LOG(log_info, "Listeners: connections are balanced by hash (several executors on one CPU, or kernel < 4.5)");
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Index of io_service of executors, in which will work next connection accepted by acceptor i_acceptor
+/// 
+/// @param i_acceptor index of acceptor
+/// 
+/// @return index of io_service
+///
+size_t T_server::next_executor(const size_t i_acceptor) {
+	if(!executors_.sharded()) return 0;
+#ifdef PORTMAPPING_REUSEPORT
+	return i_acceptor;	// acceptor of shard works in the io_service of this shard
+#else
+	// one listener: connections are distributed by round robin, and each of them lives on one shard
+	return next_shard_.fetch_add(1, std::memory_order_relaxed) % executors_.size();
+#endif
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Start accept operation of next connection from the memory pool of executor, in which it will work
+/// 
+/// @param i_acceptor index of acceptor
+///
+void T_server::start_accept(size_t i_acceptor) {
+	if(!accepting_.load(std::memory_order_relaxed)) return;	// draining: the acceptor is closed
+
+	// overload, limit of connections of port mapping or accept rate: connections wait in the listen queue
+	const unsigned int delay_ms = admission_.accept_delay_ms();
+	if(delay_ms != 0) {
+		metrics_.add(T_metrics::accept_pauses);
+		retry_accept(i_acceptor, delay_ms);
+		return;
+	}
+
+	// take memory for next connection, that will accepted
+	const size_t i_executor = next_executor(i_acceptor);
+	T_connection_slab& connection_slab = connection_slabs_[i_executor];
+	void *const memory = connection_slab.allocate();
+	if(memory == NULL) {
+		// the limit of connections has been reached - try again later, when some of connections will be closed
+		retry_accept(i_acceptor, accept_retry_ms);
+		return;
+	}
+	T_connection * const new_connection_raw_ptr = T_connection::create(connection_slab, memory, executors_.get_io_service(i_executor), 
+																		  executors_.get_timing_wheel(i_executor), executors_.get_pacer(i_executor), 
+																		  executors_.get_uring(i_executor));
+
+	// start new accept operation		
+	acceptors_[i_acceptor]->async_accept(new_connection_raw_ptr->socket(),
+							new_connection_raw_ptr->arena_bind(
+									   boost::bind(&T_server::handle_accept, this, 
+												   new_connection_raw_ptr,
+												   i_acceptor,
+												   i_executor,
+												   ba::placeholders::error)) );
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Start accept operation of acceptor after delay, while connections wait in the listen queue
+/// 
+/// @param i_acceptor index of acceptor
+/// @param delay_ms delay in ms
+///
+void T_server::retry_accept(const size_t i_acceptor, const unsigned int delay_ms) {
+	boost::shared_ptr<ba::deadline_timer> retry_timer(new ba::deadline_timer(*acceptors_io_services_[i_acceptor],
+		boost::posix_time::milliseconds(static_cast<long>(delay_ms))));
+	retry_timer->async_wait([this, i_acceptor, retry_timer](const boost::system::error_code& e) {
+		if(e != ba::error::operation_aborted) start_accept(i_acceptor);
+	});
 }
 // ----------------------------------------------------------------------------
 
 /// 
 /// Run when new connection is accepted
 /// 
-/// @param memory_pool_ptr shared pointer to the allocated memory poll for connections
-/// @param i_connect index of current connection in memory pool 
+/// @param new_connection pointer to connection, which socket has been accepted
+/// @param i_acceptor index of acceptor, which accepted this connection
+/// @param i_executor index of io_service of executors, in which the connection works (and memory pool of which it uses)
 /// @param e reference to error object
 ///
-void T_server::handle_accept( T_memory_pool_ptr memory_pool_ptr, size_t i_connect, const boost::system::error_code& e) {
+void T_server::handle_accept(T_connection *const new_connection, size_t i_acceptor, size_t i_executor, const boost::system::error_code& e) {
 	if (!e) {
-		// get pointer of current connection
-		T_connection * const current_memory_pool_raw_ptr = reinterpret_cast<T_connection *>( memory_pool_ptr.get() );
-		T_connection * const current_connection_raw_ptr = &(current_memory_pool_raw_ptr[i_connect]);
-		T_connection::T_shared_this current_connection_ptr(memory_pool_ptr, current_connection_raw_ptr );
-
-		// schedule new task to thread pool
-		current_connection_raw_ptr->run(boost::move(current_connection_ptr), remote_endpoint_it_);	// sync launch of short-task: run()
-		
-		// increment index of connections
-		++i_connect;	
-		
-		// if the limit of connections in the memory pool have been reached, then create a new memory pool
-		if(i_connect == connections_in_memory_pool) {
-			i_connect = 0;
-			memory_pool_ptr.reset(new T_memory_pool, T_memory_pool_deleter() );
+		start_connection(new_connection, i_executor);
+#ifdef PORTMAPPING_ACCEPT4
+		accept_backlog(i_acceptor);
+#endif
+	} else {
+		connection_slabs_[i_executor].destroy(new_connection);
+		if(e == ba::error::operation_aborted || !accepting_.load(std::memory_order_relaxed)) return;	// acceptor is closed
+		metrics_.add(T_metrics::accept_errors);
+	}
+
+	// create next connection, that will accepted, and start new accept operation
+	start_accept(i_acceptor);
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Check limits of connections for accepted connection, select remote server and start its connect:
+/// connection over the limit of port mapping or of its client IP is closed at once
+/// 
+/// @param new_connection pointer to connection, which socket has been accepted
+/// @param i_executor index of io_service of executors, in which the connection works (and memory pool of which it uses)
+///
+void T_server::start_connection(T_connection *const new_connection, size_t i_executor) {
+	// address of client is needed only for limits per client IP and for consistent hashing
+	bs::error_code ec;
+	const ba::ip::address client_address = 
+		(admission_.limits_client_ip() || bandwidth_.limits_client_ip() || backends_.policy() == balance_client_ip_hash) ? 
+		new_connection->socket().remote_endpoint(ec).address() : ba::ip::address();
+	T_admission_ticket admission_ticket;
+	if(!admission_.admit(client_address, admission_ticket)) {
+		metrics_.add(T_metrics::connections_rejected);
+		connection_slabs_[i_executor].destroy(new_connection);	// socket is closed by destructor
+		return;
+	}
+
+	// select remote server
+	T_backend& backend = backends_.select(client_address);
+	metrics_.add(T_metrics::accepts);
+
+	// schedule new task to thread pool
+	// the connection returns its slot to the pool itself, when it's closed
+	new_connection->run(backend, metrics_, admission_ticket, bandwidth_.shaper(client_address), 
+						socket_options_, relay_mode_, timeouts_);	// sync launch of short-task: run()
+}
+// ----------------------------------------------------------------------------
+
+#ifdef PORTMAPPING_ACCEPT4
+/// 
+/// Take the rest of the listen queue by non-blocking accept4() after accept of the first connection:
+/// epoll is edge-triggered, so one readiness event is enough for up to max_accept_batch connections.
+/// Connections are handed to each io_service of executors by one post() per batch, or are started at once,
+/// if the acceptor works in the same io_service (shard with SO_REUSEPORT).
+/// Batches are intrusive lists of connections on the stack, so accept storm doesn't allocate from the heap.
+/// 
+/// @param i_acceptor index of acceptor
+///
+void T_server::accept_backlog(const size_t i_acceptor) {
+	const int listen_fd = acceptors_[i_acceptor]->native_handle();
+	// batch of each io_service of executors, which got connections: index of executors, the first and the last connection
+	size_t batch_executors[max_accept_batch];
+	T_connection *batch_heads[max_accept_batch];
+	T_connection *batch_tails[max_accept_batch];
+	size_t batches = 0;
+	for(size_t i = 1; i < max_accept_batch; ++i) {
+		if(!accepting_.load(std::memory_order_relaxed)) break;	// draining: the acceptor is being closed
+		if(admission_.accept_delay_ms() != 0) break;	// overload or limits: the rest waits in the listen queue
+
+		const size_t i_executor = next_executor(i_acceptor);
+		T_connection_slab& connection_slab = connection_slabs_[i_executor];
+		void *const memory = connection_slab.allocate();
+		if(memory == NULL) break;	// the limit of connections: the rest waits in the listen queue for async_accept()
+
+		const int fd = ::accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0) {
+			const int error = errno;
+			connection_slab.deallocate(memory);
+			if(error == EINTR || error == ECONNABORTED) continue;	// client has reset connection, which is in the queue
+			if(error != EAGAIN && error != EWOULDBLOCK) metrics_.add(T_metrics::accept_errors);
+			break;	// the queue is empty, or accept fails (EMFILE...) - it is repeated by async_accept()
 		}
 
-		// create next connection, that will accepted
-		T_connection * const new_memory_pool_raw_ptr = reinterpret_cast<T_connection *>( memory_pool_ptr.get() );
-		T_connection * const new_connection_raw_ptr = T_connection::create(new_memory_pool_raw_ptr, i_connect, io_service_executors_);
-
-		// start new accept operation		
-		acceptor_.async_accept(new_connection_raw_ptr->socket(),
-								new_connection_raw_ptr->server_bind(
-										   boost::bind(&T_server::handle_accept, this, 
-													   boost::move(memory_pool_ptr),   // doesn't copy and doesn't use the atomic counter with memory barrier
-													   i_connect,
-													   ba::placeholders::error)) );
+		T_connection *const new_connection = T_connection::create(connection_slab, memory, executors_.get_io_service(i_executor), 
+																  executors_.get_timing_wheel(i_executor), executors_.get_pacer(i_executor), 
+																  executors_.get_uring(i_executor));
+		bs::error_code ec;
+		new_connection->socket().assign(local_endpoint_.protocol(), fd, ec);
+		if(ec) {
+			::close(fd);
+			connection_slab.destroy(new_connection);
+			metrics_.add(T_metrics::accept_errors);
+			continue;
+		}
+		size_t i_batch = 0;
+		while(i_batch < batches && batch_executors[i_batch] != i_executor) ++i_batch;
+		new_connection->next_accepted() = NULL;
+		if(i_batch == batches) {
+			batch_executors[batches] = i_executor;
+			batch_heads[batches++] = new_connection;
+		} else
+			batch_tails[i_batch]->next_accepted() = new_connection;
+		batch_tails[i_batch] = new_connection;
+	}
+
+	for(size_t i_batch = 0; i_batch < batches; ++i_batch) {
+		const size_t i_executor = batch_executors[i_batch];
+		metrics_.add(T_metrics::accept_batches);
+		ba::io_service& io_service = executors_.get_io_service(i_executor);
+		if(&io_service == acceptors_io_services_[i_acceptor])
+			run_accepted(i_executor, batch_heads[i_batch]);
+		else
+			io_service.post(boost::bind(&T_server::run_accepted, this, i_executor, batch_heads[i_batch]));
+	}
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Start connections of batch in io_service of executors
+/// 
+/// @param i_executor index of io_service of executors, in which the connections work (and memory pool of which they use)
+/// @param batch the first of connections, which sockets have been accepted, the next ones are linked by next_accepted()
+///
+void T_server::run_accepted(const size_t i_executor, T_connection *const batch) {
+	for(T_connection *new_connection = batch; new_connection != NULL; ) {
+		T_connection *const next = new_connection->next_accepted();	// the connection can be destroyed by start
+		start_connection(new_connection, i_executor);
+		new_connection = next;
+	}
+}
+// ----------------------------------------------------------------------------
+#endif
+
+#ifdef PORTMAPPING_HANDOFF
+/// Environment variable, by which listening sockets are passed to the new process: "address:port=fd,fd;address:port=fd..."
+const char *const T_server::listen_fds_env = "PORTMAPPING_LISTEN_FDS";
+
+/// Inherited listening sockets by local endpoint "address:port", which aren't adopted yet (only at start in main thread)
+static std::map<std::string, std::vector<int> >& inherited_listeners() {
+	static std::map<std::string, std::vector<int> > listeners;
+	static bool parsed = false;
+	if(parsed) return listeners;
+	parsed = true;
+
+	const char *const value = std::getenv(T_server::listen_fds_env);
+	if(value == NULL) return listeners;
+	std::istringstream items(value);
+	std::string item;
+	while(std::getline(items, item, ';')) {
+		const size_t equal = item.rfind('=');
+		if(equal == std::string::npos) continue;
+		std::istringstream fds(item.substr(equal + 1));
+		std::string fd;
+		while(std::getline(fds, fd, ','))
+			if(!fd.empty()) listeners[item.substr(0, equal)].push_back(boost::lexical_cast<int>(fd));
 	}
+	return listeners;
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Take inherited listening socket for the local endpoint
+/// 
+/// @param endpoint local endpoint of listener
+/// 
+/// @return file descriptor, or -1 if there isn't any
+///
+int T_server::take_inherited_listener(const ba::ip::tcp::endpoint& endpoint) {
+	std::ostringstream name;
+	name << endpoint;
+	std::vector<int>& fds = inherited_listeners()[name.str()];
+	if(fds.empty()) return -1;
+	const int fd = fds.back();
+	fds.pop_back();
+	return fd;
 }
 // ----------------------------------------------------------------------------
 
+/// Close inherited listening sockets, which weren't adopted by any listener
+void T_server::close_inherited_listeners() {
+	for(auto &i : inherited_listeners()) {
+		for(auto fd : i.second) {
+			PORTMAPPING_LOG(log_info, "Close inherited listener, which isn't used: " << i.first << " fd " << fd);
+			::close(fd);
+		}
+		i.second.clear();
+	}
+	::unsetenv(listen_fds_env);
+}
+// ----------------------------------------------------------------------------
+
+/// Listening sockets of this port mapping in format of listen_fds_env: "address:port=fd,fd"
+std::string T_server::listen_fds() {
+	if(udp_) return std::string();	// the new process binds the same port with SO_REUSEPORT
+	std::ostringstream fds;
+	fds << local_endpoint_ << "=";
+	for(size_t i = 0; i < acceptors_.size(); ++i)
+		fds << (i ? "," : "") << acceptors_[i]->native_handle();
+	return fds.str();
+}
+// ----------------------------------------------------------------------------
+#endif
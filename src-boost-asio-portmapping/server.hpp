@@ -11,61 +11,156 @@
 #define SERVER_HPP
 // ----------------------------------------------------------------------------
 #include "connection.hpp"
+#include "executors.hpp"
+#include "slab_pool.hpp"
+#include "config.hpp"
+#include "metrics.hpp"
+#include "admission.hpp"
+#include "bandwidth.hpp"
+#include "udp_mapping.hpp"
 
 // ----------------------------------------------------------------------------
 
 #include <boost/noncopyable.hpp>
-#include <boost/aligned_storage.hpp>
 #include <boost/shared_ptr.hpp>
-#include <boost/thread/thread.hpp>
 #include <boost/asio.hpp>
 namespace ba = boost::asio;
 // ----------------------------------------------------------------------------
 
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <string>
 
+// ----------------------------------------------------------------------------
+#if defined(__linux__)
+	#define PORTMAPPING_ACCEPT4	///< the rest of the listen queue is taken after each accept by non-blocking accept4() at once
+	#define PORTMAPPING_HANDOFF	///< listening sockets are inherited by the new process through exec(), so restart doesn't refuse connections
+#endif
 // ----------------------------------------------------------------------------
 
 ///
-/// Port mapping server class
-/// 
+/// Memory pools for connections of all port mappings: one per io_service of executors,
+/// so in sharded mode memory of connection is taken from the pool of its shard
+///
+class T_connection_slabs : private boost::noncopyable {
+public:
+	/// 
+	/// Create memory pools
+	/// 
+	/// @param executors thread pool of executors, one pool per its io_service
+	/// @param connections_prealloc number of connections, memory for which is allocated at start (for all pools)
+	/// @param connections_max hard cap of simultaneous connections (for all pools)
+	///
+	T_connection_slabs(const T_executors& executors, size_t connections_prealloc, size_t connections_max);
+
+	/// Memory pool for connections, which work in io_service of executors with index i_executor
+	inline T_connection_slab& operator[](const size_t i_executor) { return *slabs_[i_executor]; }
+
+	/// Number of slots in allocated slabs of all pools
+	size_t allocated_slots() const;
+
+private:
+	std::vector<std::unique_ptr<T_connection_slab> > slabs_;	///< memory pools (one per io_service of executors)
+};
+// ----------------------------------------------------------------------------
+
+///
+/// Port mapping server class: one listener and its remote servers.
+/// Many servers can share one thread pool of acceptors, executors and memory pools of connections.
 ///
 class T_server : private boost::noncopyable {
-	enum { connections_in_memory_pool = 10 };   ///< maximum connections in memory pool
+	enum { accept_retry_ms = 10 };              ///< delay before next accept, if the memory pool of connections is full
+	enum { max_accept_batch = 64 };             ///< max number of connections taken from the listen queue per one readiness event
 public:
-	T_server(ba::io_service& io_service_acceptors, ba::io_service& io_service_executors, 
-			   unsigned int thread_num_acceptors, unsigned int thread_num_executors, 
-			   unsigned int remote_port, std::string remote_address,
-			   unsigned int local_port = 10001, std::string local_interface_address = "");
+	T_server(ba::io_service& io_service_acceptors, T_executors& executors, T_connection_slabs& connection_slabs,
+			   T_overload_guard& overload_guard, unsigned int thread_num_acceptors, const T_mapping_config& mapping);
 	~T_server();
-	
-	// constexpr and the types for memory pool of objects of connections
-	typedef boost::aligned_storage<sizeof(T_connection) * connections_in_memory_pool> T_memory_pool; ///< type of memory pool	
-	typedef boost::shared_ptr<T_memory_pool> T_memory_pool_ptr;   ///< type of pointer of memory pool 
-
-	/// call to destructors of each of connections in memory pool (uses as shared pointer deleter)
-	struct T_memory_pool_deleter {
-		void operator()(T_memory_pool *const ptr) { 
-			//std::cout << "DELETER!!! \n";
-			for(size_t i = 0; i < connections_in_memory_pool; ++i) 
-				reinterpret_cast<T_connection *>(ptr)[i].~T_connection(); // only call to destructor
-			delete ptr;
-		}
-	};
+
+	/// Name of port mapping (or address:port of listener, if it isn't named)
+	inline const std::string& name() const { return name_; }
+
+	/// Counters of this port mapping
+	inline const T_metrics& metrics() const { return metrics_; }
+
+	/// Remote servers of this port mapping
+	inline T_backend_pool& backends() { return backends_; }
+
+	/// 
+	/// Replace the list of remote servers by one from new settings of this port mapping,
+	/// established connections aren't dropped
+	/// 
+	/// @param mapping new settings of port mapping (only remote_address_ and remote_port_ are used)
+	///
+	void reload_backends(const T_mapping_config& mapping);
+
+	/// Stop accept of new connections and close listening sockets, established connections go on
+	void stop_accept();
+
+#ifdef PORTMAPPING_HANDOFF
+	/// Environment variable, by which listening sockets are passed to the new process: "address:port=fd,fd;address:port=fd..."
+	static const char *const listen_fds_env;
+
+	/// Listening sockets of this port mapping in format of listen_fds_env: "address:port=fd,fd", empty for UDP
+	std::string listen_fds();
+
+	/// Take inherited listening socket for the local endpoint, or -1 if there isn't any
+	static int take_inherited_listener(const ba::ip::tcp::endpoint& endpoint);
+
+	/// Close inherited listening sockets, which weren't adopted by any listener
+	static void close_inherited_listeners();
+#endif
 
 private:
 	/// Run when new connection is accepted
-	void handle_accept(T_memory_pool_ptr memory_pool_ptr, size_t i_connect, const boost::system::error_code& e);
+	void handle_accept(T_connection *const new_connection, size_t i_acceptor, size_t i_executor, const boost::system::error_code& e);
+
+	/// Start accept operation of next connection from the memory pool of executor, in which it will work
+	void start_accept(size_t i_acceptor);
+
+	/// Start accept operation of acceptor i_acceptor after delay_ms, while connections wait in the listen queue
+	void retry_accept(size_t i_acceptor, unsigned int delay_ms);
+
+	/// Check limits of connections for accepted connection, select remote server and start its connect
+	void start_connection(T_connection *const new_connection, size_t i_executor);
+
+#ifdef PORTMAPPING_ACCEPT4
+	/// Take the rest of the listen queue by non-blocking accept4() and hand connections to executors in batches
+	void accept_backlog(size_t i_acceptor);
+
+	/// Start connections of batch (list by next_accepted()) in io_service of executors with index i_executor
+	void run_accepted(size_t i_executor, T_connection *const batch);
+#endif
+
+	/// Open, bind and listen acceptor with the listen queue of listen_backlog_, or adopt inherited listening socket
+	void listen(ba::ip::tcp::acceptor& acceptor, bool reuse_port);
+
+
+	/// Index of io_service of executors, in which will work next connection accepted by acceptor i_acceptor
+	size_t next_executor(size_t i_acceptor);
+
+	/// Steer new connections to the listener of shard, which executor runs on the CPU (or NUMA node), that received them
+	void steer_by_cpu();
 	
 	ba::io_service& io_service_acceptors_;  ///< reference to io_service
-	ba::io_service& io_service_executors_;  ///< reference to io_service
+	T_executors& executors_;                ///< reference to thread pool of executors
+	T_connection_slabs& connection_slabs_;  ///< reference to memory pools for connections
 	ba::io_service::work work_acceptors_;   ///< object to inform the io_service_acceptors_ when it has work to do
-	ba::io_service::work work_executors_;   ///< object to inform the io_service_executors_ when it has work to do
-	std::vector<boost::thread> thr_grp_acceptors_;  ///< thread pool object for acceptors
-	std::vector<boost::thread> thr_grp_executors_;  ///< thread pool object for executors
+	const std::string name_;                ///< name of port mapping
 	const ba::ip::tcp::endpoint local_endpoint_;    ///< object, that points to the connection endpoint of local interface
-	ba::ip::tcp::acceptor acceptor_;                ///< object, that accepts new connections
-	ba::ip::tcp::resolver::iterator remote_endpoint_it_;   ///< object, that points to the connection endpoint of remote server
+	std::vector<std::unique_ptr<ba::ip::tcp::acceptor> > acceptors_;	///< objects, that accept new connections (one per shard with SO_REUSEPORT)
+	std::vector<ba::io_service*> acceptors_io_services_;    ///< io_services, in which acceptors work
+	std::atomic<size_t> next_shard_;                ///< round robin index of shard for the next connection (sharded mode without SO_REUSEPORT)
+	std::atomic<bool> accepting_;                   ///< false - accept is stopped (draining), listening sockets are closed
+	T_backend_pool backends_;                       ///< remote servers, re-resolved in background, with their health
+	const T_relay_mode relay_mode_;                 ///< relay engine for accepted connections
+	const T_connection_timeouts timeouts_;          ///< timeouts of accepted connections
+	const T_socket_options socket_options_;         ///< options of client and server sockets of accepted connections
+	const int listen_backlog_;                      ///< max length of the listen queue
+	T_admission admission_;                         ///< overload protection: pause of accept, limits of connections and accept rate
+	T_bandwidth bandwidth_;                         ///< limits of bandwidth of connections, client IPs and this port mapping
+	T_metrics metrics_;                             ///< counters of this port mapping
+	std::unique_ptr<T_udp_mapping> udp_;            ///< sessions of UDP port mapping, instead of acceptors
 };
 // ----------------------------------------------------------------------------
 
@@ -0,0 +1,181 @@
+/**
+ * @file   slab_pool.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Recycling slab pool of objects with lock-free free list.
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef SLAB_POOL_HPP
+#define SLAB_POOL_HPP
+// ----------------------------------------------------------------------------
+#include "cpu_topology.hpp"
+// ----------------------------------------------------------------------------
+#include <boost/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+// ----------------------------------------------------------------------------
+#include <atomic>
+#include <vector>
+#include <new>
+#include <cstdint>
+// ----------------------------------------------------------------------------
+
+/// Pool of memory slots for objects of type T.
+/// Memory is allocated by fixed-size slabs of slab_size slots, and never more than max_slots.
+/// Each slot is returned to the lock-free free list (Treiber stack with ABA-tag)
+/// individually, when its object is destroyed, and is reused by the next allocate().
+/// Objects manage their lifetime themselves (intrusive counter) and are returned by destroy(),
+/// so in steady-state allocate() doesn't allocate heap memory.
+template<typename T, size_t slab_size = 64>
+class T_slab_pool
+	: private boost::noncopyable
+{
+	/// Slot: object and index of next free slot
+	struct T_slot {
+		boost::aligned_storage<sizeof(T), boost::alignment_of<T>::value> object_;
+		std::atomic<uint32_t> next_;          ///< index+1 of next free slot, 0 - end of list
+		uint32_t index_;                      ///< index of this slot
+	};
+
+public:
+	///
+	/// Create pool and preallocate slabs
+	///
+	/// @param prealloc_slots number of slots, that are allocated at once (rounded up to slab_size)
+	/// @param max_slots hard cap of slots, allocate() returns NULL if all of them are in use
+	/// @param node NUMA node of memory of slabs, -1 - any node (slabs from the heap)
+	///
+	T_slab_pool(size_t prealloc_slots, size_t max_slots, int node = -1)
+		: node_(node),
+		  max_slots_(max_slots < prealloc_slots ? prealloc_slots : max_slots),
+		  slabs_((max_slots_ + slab_size - 1) / slab_size),
+		  allocated_slots_(0),
+		  free_head_(0)
+	{
+		for(auto &i : slabs_) i.store(NULL, std::memory_order_relaxed);
+		boost::lock_guard<boost::mutex> lock(grow_mutex_);
+		while(allocated_slots_.load(std::memory_order_relaxed) < prealloc_slots && grow())
+			;
+	}
+
+	/// Free slabs, if all objects are destroyed (else leave them to handlers, which may be destroyed later)
+	~T_slab_pool()
+	{
+		size_t free_slots = 0;
+		for(uint64_t head = free_head_.load(std::memory_order_acquire) & index_mask; head != 0; ++free_slots)
+			head = get_slot(static_cast<uint32_t>(head - 1)).next_.load(std::memory_order_relaxed);
+		if(free_slots != allocated_slots_.load(std::memory_order_acquire)) return;
+		for(auto &i : slabs_)
+			if(T_slot *const slab = i.load(std::memory_order_relaxed)) deallocate_on_node(slab, sizeof(T_slot) * slab_size, node_);
+	}
+
+	///
+	/// Take memory for one object from the free list, or allocate new slab if free list is empty
+	///
+	/// @return pointer to uninitialized memory for T, or NULL if max_slots are in use
+	///
+	void* allocate()
+	{
+		if(T_slot *const slot = pop()) return slot->object_.address();
+
+		boost::lock_guard<boost::mutex> lock(grow_mutex_);
+		do {
+			if(T_slot *const slot = pop()) return slot->object_.address();
+		} while(grow());
+		return NULL;
+	}
+
+	///
+	/// Return memory of the object to the free list
+	///
+	/// @param pointer memory returned by allocate()
+	///
+	void deallocate(void *const pointer)
+	{
+		push(slot_of(pointer));
+	}
+
+	///
+	/// Destroy object created in memory from allocate() and return memory to the free list
+	///
+	/// @param object pointer to object
+	///
+	void destroy(T *const object)
+	{
+		object->~T();
+		deallocate(object);
+	}
+
+	/// Number of slots in allocated slabs
+	size_t allocated_slots() const { return allocated_slots_.load(std::memory_order_relaxed); }
+
+	/// Hard cap of slots
+	size_t max_slots() const { return max_slots_; }
+
+private:
+	static const uint64_t index_mask = 0xffffffffULL;   ///< low 32 bits of free_head_ - index+1 of slot, high 32 bits - ABA-tag
+
+	/// Slot by its index
+	T_slot& get_slot(const uint32_t index) const {
+		return slabs_[index / slab_size].load(std::memory_order_acquire)[index % slab_size];
+	}
+
+	/// Slot by pointer to its object (object is the first member of the slot)
+	static T_slot* slot_of(void *const pointer) {
+		return reinterpret_cast<T_slot*>(pointer);
+	}
+
+	/// Pop slot from the free list, NULL if it is empty
+	T_slot* pop() {
+		uint64_t head = free_head_.load(std::memory_order_acquire);
+		while((head & index_mask) != 0) {
+			T_slot& slot = get_slot(static_cast<uint32_t>((head & index_mask) - 1));
+			const uint64_t new_head = (((head >> 32) + 1) << 32) | slot.next_.load(std::memory_order_relaxed);
+			if(free_head_.compare_exchange_weak(head, new_head, std::memory_order_acquire, std::memory_order_acquire))
+				return &slot;
+		}
+		return NULL;
+	}
+
+	/// Push slot to the free list
+	void push(T_slot *const slot) {
+		uint64_t head = free_head_.load(std::memory_order_relaxed);
+		uint64_t new_head;
+		do {
+			slot->next_.store(static_cast<uint32_t>(head & index_mask), std::memory_order_relaxed);
+			new_head = (((head >> 32) + 1) << 32) | (slot->index_ + 1);
+		} while(!free_head_.compare_exchange_weak(head, new_head, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	/// Allocate next slab and push its slots to the free list, grow_mutex_ must be locked
+	bool grow() {
+		const size_t first = allocated_slots_.load(std::memory_order_relaxed);
+		if(first >= max_slots_) return false;
+		T_slot *const slab = static_cast<T_slot*>(allocate_on_node(sizeof(T_slot) * slab_size, node_));
+		for(size_t i = 0; i < slab_size; ++i) {
+			new (&slab[i]) T_slot;
+			slab[i].index_ = static_cast<uint32_t>(first + i);
+		}
+		slabs_[first / slab_size].store(slab, std::memory_order_release);
+
+		const size_t count = (max_slots_ - first < slab_size) ? (max_slots_ - first) : slab_size;
+		allocated_slots_.store(first + count, std::memory_order_release);
+		for(size_t i = count; i > 0; --i) push(&slab[i - 1]);
+		return true;
+	}
+
+	const int node_;                              ///< NUMA node of slabs, -1 - any
+	const size_t max_slots_;                      ///< hard cap of slots
+	std::vector<std::atomic<T_slot*> > slabs_;    ///< pointers to slabs, fixed size - max_slots_/slab_size
+	std::atomic<size_t> allocated_slots_;         ///< number of slots in allocated slabs
+	std::atomic<uint64_t> free_head_;             ///< head of free list: ABA-tag << 32 | (index+1)
+	boost::mutex grow_mutex_;                     ///< mutex only for allocation of new slab
+};
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // SLAB_POOL_HPP
@@ -0,0 +1,101 @@
+/**
+ * @file   socket_options.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Options of TCP sockets of port mapping: profiles and their overrides
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "socket_options.hpp"
+
+#include <ostream>
+#include <stdexcept>
+// ----------------------------------------------------------------------------
+#if defined(__linux__)
+	#include <netinet/tcp.h>
+	#define PORTMAPPING_TCP_LINUX_OPTIONS	///< TCP_QUICKACK, TCP_KEEPIDLE, TCP_KEEPINTVL, TCP_KEEPCNT
+	typedef ba::detail::socket_option::boolean<IPPROTO_TCP, TCP_QUICKACK> T_quick_ack;
+	typedef ba::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPIDLE> T_keep_alive_idle;
+	typedef ba::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPINTVL> T_keep_alive_interval;
+	typedef ba::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPCNT> T_keep_alive_count;
+#endif
+#if defined(__linux__) && defined(SO_BUSY_POLL)
+	#define PORTMAPPING_BUSY_POLL	///< SO_BUSY_POLL: read without data polls the queue of NIC instead of waiting for interrupt
+	typedef ba::detail::socket_option::integer<SOL_SOCKET, SO_BUSY_POLL> T_busy_poll;
+#endif
+// ----------------------------------------------------------------------------
+
+/// Profile "default": TCP_NODELAY (relay forwards data at once), other options - of OS
+T_socket_options::T_socket_options()
+	: profile_("default"), no_delay_(true), receive_buffer_(0), send_buffer_(0), quick_ack_(false),
+	  keep_alive_(false), keep_alive_idle_(0), keep_alive_interval_(0), keep_alive_count_(0), busy_poll_(0)
+{}
+// ----------------------------------------------------------------------------
+
+///
+/// Options of profile
+///
+/// @param name os, default, latency (the same as default), throughput or keepalive
+///
+/// @return options
+///
+T_socket_options T_socket_options::profile(const std::string& name) {
+	T_socket_options options;
+	options.profile_ = name;
+	if(name == "default") return options;
+	if(name == "os") {
+		options.no_delay_ = false;
+		return options;
+	}
+	// TCP_QUICKACK isn't sticky: Linux returns to delayed ACK by itself, and re-arm of it after each read 
+	// would cost a syscall per read, so latency relies only on TCP_NODELAY (the same as default)
+	if(name == "latency") return options;
+	if(name == "throughput") {
+		options.receive_buffer_ = options.send_buffer_ = 4 * 1024 * 1024;
+		return options;
+	}
+	if(name == "keepalive") {
+		options.keep_alive_ = true;
+		options.keep_alive_idle_ = 60;
+		options.keep_alive_interval_ = 10;
+		options.keep_alive_count_ = 6;
+		return options;
+	}
+	throw std::runtime_error("Unknown socket profile: " + name + " (use os, default, latency, throughput or keepalive)");
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Set options on the opened socket
+///
+/// @param socket socket
+///
+void T_socket_options::apply(ba::ip::tcp::socket& socket) const {
+	bs::error_code ec;	// option, which isn't supported, doesn't prevent work of connection
+	if(no_delay_) socket.set_option(ba::ip::tcp::no_delay(true), ec);
+	if(receive_buffer_ > 0) socket.set_option(ba::socket_base::receive_buffer_size(receive_buffer_), ec);
+	if(send_buffer_ > 0) socket.set_option(ba::socket_base::send_buffer_size(send_buffer_), ec);
+	if(keep_alive_) socket.set_option(ba::socket_base::keep_alive(true), ec);
+#ifdef PORTMAPPING_TCP_LINUX_OPTIONS
+	if(quick_ack_) socket.set_option(T_quick_ack(true), ec);
+	if(keep_alive_ && keep_alive_idle_ > 0) socket.set_option(T_keep_alive_idle(keep_alive_idle_), ec);
+	if(keep_alive_ && keep_alive_interval_ > 0) socket.set_option(T_keep_alive_interval(keep_alive_interval_), ec);
+	if(keep_alive_ && keep_alive_count_ > 0) socket.set_option(T_keep_alive_count(keep_alive_count_), ec);
+#endif
+#ifdef PORTMAPPING_BUSY_POLL
+	if(busy_poll_ > 0) socket.set_option(T_busy_poll(busy_poll_), ec);
+#endif
+}
+// ----------------------------------------------------------------------------
+
+/// Output options as: profile (nodelay, rcvbuf ...)
+std::ostream& operator<<(std::ostream& out, const T_socket_options& options) {
+	out << options.profile_ << " (nodelay " << options.no_delay_ << ", rcvbuf " << options.receive_buffer_ <<
+		", sndbuf " << options.send_buffer_ << ", quickack " << options.quick_ack_ << ", keepalive " << options.keep_alive_;
+	if(options.keep_alive_)
+		out << " " << options.keep_alive_idle_ << "/" << options.keep_alive_interval_ << "/" << options.keep_alive_count_;
+	if(options.busy_poll_ > 0) out << ", busypoll " << options.busy_poll_;
+	return out << ")";
+}
+// ----------------------------------------------------------------------------
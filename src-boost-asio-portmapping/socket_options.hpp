@@ -0,0 +1,62 @@
+/**
+ * @file   socket_options.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Options of TCP sockets of port mapping: profiles and their overrides
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef SOCKET_OPTIONS_HPP
+#define SOCKET_OPTIONS_HPP
+// ----------------------------------------------------------------------------
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+namespace bs = boost::system;
+// ----------------------------------------------------------------------------
+#include <string>
+// ----------------------------------------------------------------------------
+
+///
+/// Options of TCP socket, which are set on the client socket after accept and on the server socket before connect.
+/// Options, which aren't supported by OS, are skipped.
+///
+struct T_socket_options {
+	/// Profile "default": TCP_NODELAY (relay forwards data at once), other options - of OS
+	T_socket_options();
+
+	///
+	/// Options of profile
+	///
+	/// @param name os - don't set anything, default and latency - TCP_NODELAY,
+	/// throughput - TCP_NODELAY and 4 MB buffers of socket, keepalive - TCP_NODELAY and keepalive 60/10/6
+	///
+	/// @return options
+	///
+	static T_socket_options profile(const std::string& name);
+
+	///
+	/// Set options on the opened socket
+	///
+	/// @param socket socket
+	///
+	void apply(ba::ip::tcp::socket& socket) const;
+
+	std::string profile_;           ///< name of profile, these options are based on
+	bool no_delay_;                 ///< TCP_NODELAY: disable Nagle algorithm
+	int receive_buffer_;            ///< SO_RCVBUF, bytes, 0 - of OS
+	int send_buffer_;               ///< SO_SNDBUF, bytes, 0 - of OS
+	bool quick_ack_;                ///< TCP_QUICKACK: disable delayed ACK only at start of connection, Linux isn't keeping it (only Linux)
+	bool keep_alive_;               ///< SO_KEEPALIVE
+	int keep_alive_idle_;           ///< TCP_KEEPIDLE, seconds before the first probe, 0 - of OS (Linux)
+	int keep_alive_interval_;       ///< TCP_KEEPINTVL, seconds between probes, 0 - of OS (Linux)
+	int keep_alive_count_;          ///< TCP_KEEPCNT, probes before close, 0 - of OS (Linux)
+	int busy_poll_;                 ///< SO_BUSY_POLL, microseconds of busy poll of NIC queue by read without data, 0 - of OS (Linux, above net.core.busy_read needs CAP_NET_ADMIN)
+};
+
+/// Output options as: profile (nodelay, rcvbuf ...)
+std::ostream& operator<<(std::ostream& out, const T_socket_options& options);
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // SOCKET_OPTIONS_HPP
@@ -0,0 +1,153 @@
+/**
+ * @file   timing_wheel.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Hierarchical timing wheel for timeouts of connections
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "timing_wheel.hpp"
+
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <chrono>
+// ----------------------------------------------------------------------------
+
+///
+/// Create wheel and start its ticks
+///
+/// @param io_service io_service, in which the wheel is advanced and timers are expired
+///
+T_timing_wheel::T_timing_wheel(ba::io_service& io_service)
+	: now_(0), start_ms_(now_ms()), tick_timer_(io_service)
+{
+	for(auto &level : slots_)
+		for(auto &slot : level) slot = NULL;
+	start_tick_timer();
+}
+// ----------------------------------------------------------------------------
+
+/// Milliseconds of steady clock
+int64_t T_timing_wheel::now_ms() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Schedule timer (or re-schedule, if it's already scheduled)
+///
+/// @param timer timer
+/// @param expiry tick of expiry, if it is already passed - timer will expire on the next tick
+///
+void T_timing_wheel::schedule(T_timer& timer, const uint64_t expiry) {
+	boost::lock_guard<boost::mutex> lock(mutex_);
+	if(timer.pprev_ != NULL) unlink(timer);
+	link(timer, expiry, now_.load(std::memory_order_relaxed) + 1);
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Cancel timer, if it's scheduled
+///
+/// @param timer timer
+///
+void T_timing_wheel::cancel(T_timer& timer) {
+	boost::lock_guard<boost::mutex> lock(mutex_);
+	if(timer.pprev_ != NULL) unlink(timer);
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Add timer to the slot by its expiry
+///
+/// @param timer timer
+/// @param expiry tick of expiry
+/// @param base the first tick, which isn't yet processed
+///
+void T_timing_wheel::link(T_timer& timer, uint64_t expiry, const uint64_t base) {
+	if(expiry < base) expiry = base;
+	// level is selected by distance to the expiry, slot - by bits of the expiry of this level
+	const uint64_t max_delta = (uint64_t(1) << (wheel_bits * levels)) - 1;
+	if(expiry - base > max_delta) expiry = base + max_delta;	// timer will be re-scheduled by on_timer()
+	size_t level = 0;
+	while(expiry - base >= (uint64_t(1) << (wheel_bits * (level + 1)))) ++level;
+	T_timer *&slot = slots_[level][(expiry >> (wheel_bits * level)) & (wheel_size - 1)];
+
+	timer.expiry_ = expiry;
+	timer.next_ = slot;
+	timer.pprev_ = &slot;
+	if(slot != NULL) slot->pprev_ = &timer.next_;
+	slot = &timer;
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Remove timer from its slot
+///
+/// @param timer timer
+///
+void T_timing_wheel::unlink(T_timer& timer) {
+	*timer.pprev_ = timer.next_;
+	if(timer.next_ != NULL) timer.next_->pprev_ = timer.pprev_;
+	timer.next_ = NULL;
+	timer.pprev_ = NULL;
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Advance the wheel by one tick: cascade upper levels and expire timers of the current slot
+///
+void T_timing_wheel::advance() {
+	const uint64_t tick = now_.load(std::memory_order_relaxed) + 1;
+
+	// when the lower level is wrapped, timers of the current slot of the upper level are moved down
+	for(size_t level = 1; level < levels; ++level) {
+		if(((tick >> (wheel_bits * (level - 1))) & (wheel_size - 1)) != 0) break;
+		T_timer *list = slots_[level][(tick >> (wheel_bits * level)) & (wheel_size - 1)];
+		slots_[level][(tick >> (wheel_bits * level)) & (wheel_size - 1)] = NULL;
+		while(list != NULL) {
+			T_timer& timer = *list;
+			list = timer.next_;
+			link(timer, timer.expiry_, tick);
+		}
+	}
+
+	// expire timers of the current slot: each of them can be scheduled again by the result of on_timer()
+	T_timer *list = slots_[0][tick & (wheel_size - 1)];
+	slots_[0][tick & (wheel_size - 1)] = NULL;
+	now_.store(tick, std::memory_order_relaxed);
+	while(list != NULL) {
+		T_timer& timer = *list;
+		list = timer.next_;
+		timer.next_ = NULL;
+		timer.pprev_ = NULL;
+		const uint64_t next_expiry = timer.on_timer(tick);
+		if(next_expiry != 0) link(timer, next_expiry, tick + 1);
+	}
+}
+// ----------------------------------------------------------------------------
+
+/// Start wait of the next tick
+void T_timing_wheel::start_tick_timer() {
+	tick_timer_.expires_from_now(boost::posix_time::milliseconds(static_cast<long>(tick_ms)));
+	tick_timer_.async_wait(boost::bind(&T_timing_wheel::handle_tick, this, ba::placeholders::error));
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Run every tick_ms: advance the wheel to the current time (by many ticks, if the io_service was busy)
+///
+/// @param err
+///
+void T_timing_wheel::handle_tick(const bs::error_code& err) {
+	if(err == ba::error::operation_aborted) return;
+	{
+		const uint64_t target = static_cast<uint64_t>((now_ms() - start_ms_) / tick_ms);
+		boost::lock_guard<boost::mutex> lock(mutex_);
+		while(now_.load(std::memory_order_relaxed) < target) advance();
+	}
+	start_tick_timer();
+}
+// ----------------------------------------------------------------------------
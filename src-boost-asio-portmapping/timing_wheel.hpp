@@ -0,0 +1,112 @@
+/**
+ * @file   timing_wheel.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Hierarchical timing wheel for timeouts of connections
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef TIMING_WHEEL_HPP
+#define TIMING_WHEEL_HPP
+// ----------------------------------------------------------------------------
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+namespace bs = boost::system;
+// ----------------------------------------------------------------------------
+#include <atomic>
+#include <cstdint>
+// ----------------------------------------------------------------------------
+
+///
+/// Hierarchical timing wheel: levels of wheel_size slots, each slot of level L covers wheel_size^L ticks.
+/// Timers are intrusive (no memory allocation), schedule() and cancel() are O(1),
+/// and timers of upper levels are cascaded to lower levels when the wheel reaches their slot.
+/// Only one deadline_timer per wheel, that advances it every tick_ms.
+///
+class T_timing_wheel : private boost::noncopyable {
+public:
+	enum { tick_ms = 100 };                 ///< resolution of timeouts
+	enum { wheel_bits = 6 };                ///< log2 of number of slots in one level
+	enum { wheel_size = 1 << wheel_bits };  ///< number of slots in one level
+	enum { levels = 4 };                    ///< number of levels: wheel covers wheel_size^levels ticks (19 days)
+
+	/// Base class for objects, which are scheduled in the wheel
+	class T_timer {
+	public:
+		///
+		/// Run by the wheel when tick of expiry is reached (mutex of the wheel is locked: don't call the wheel from it)
+		///
+		/// @param now current tick
+		///
+		/// @return tick of next expiry, or 0 - don't schedule again
+		///
+		virtual uint64_t on_timer(const uint64_t now) = 0;
+
+	protected:
+		T_timer() : next_(NULL), pprev_(NULL), expiry_(0) {}
+		~T_timer() {}
+
+	private:
+		friend class T_timing_wheel;
+		T_timer *next_;                     ///< next timer in the slot
+		T_timer **pprev_;                   ///< pointer to the pointer to this timer in the slot, NULL if it isn't scheduled
+		uint64_t expiry_;                   ///< tick of expiry
+	};
+
+	///
+	/// Create wheel and start its ticks (they are stopped with the io_service)
+	///
+	/// @param io_service io_service, in which the wheel is advanced and timers are expired
+	///
+	T_timing_wheel(ba::io_service& io_service);
+
+	/// Current tick of the wheel, it's cheap enough to read on each I/O operation
+	inline uint64_t now() const { return now_.load(std::memory_order_relaxed); }
+
+	/// Number of ticks in seconds
+	static inline uint64_t ticks(const unsigned int seconds) { return uint64_t(seconds) * (1000 / tick_ms); }
+
+	///
+	/// Schedule timer (or re-schedule, if it's already scheduled)
+	///
+	/// @param timer timer
+	/// @param expiry tick of expiry, if it is already passed - timer will expire on the next tick
+	///
+	void schedule(T_timer& timer, const uint64_t expiry);
+
+	/// Cancel timer, if it's scheduled: after return on_timer() of it isn't running and will not run
+	void cancel(T_timer& timer);
+
+private:
+	/// Start wait of the next tick
+	void start_tick_timer();
+
+	/// Run every tick_ms: advance the wheel to the current time
+	void handle_tick(const bs::error_code& err);
+
+	/// Advance the wheel by one tick: cascade upper levels and expire timers of the current slot, mutex_ must be locked
+	void advance();
+
+	/// Add timer to the slot by its expiry, mutex_ must be locked
+	/// @param base the first tick, which isn't yet processed
+	void link(T_timer& timer, uint64_t expiry, const uint64_t base);
+
+	/// Remove timer from its slot, mutex_ must be locked
+	static void unlink(T_timer& timer);
+
+	/// Milliseconds of steady clock
+	static int64_t now_ms();
+
+	T_timer *slots_[levels][wheel_size];    ///< heads of lists of timers in slots
+	std::atomic<uint64_t> now_;             ///< the last processed tick
+	const int64_t start_ms_;                ///< time of tick 0
+	boost::mutex mutex_;                    ///< mutex for slots (in shared mode of executors the wheel is used by many threads)
+	ba::deadline_timer tick_timer_;         ///< timer of ticks
+};
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // TIMING_WHEEL_HPP
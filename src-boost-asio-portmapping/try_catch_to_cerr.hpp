@@ -11,38 +11,37 @@
 #define TRY_CATCH_TO_CERR_HPP
 // ----------------------------------------------------------------------------
 #include "seh_exception.hpp"
+#include "log.hpp"
 #include <boost/system/system_error.hpp>
+namespace bs = boost::system;
 // ----------------------------------------------------------------------------
-#ifndef __FUNCTION__
-	#define __FUNCTION__
-#endif
 
-/// macro to determine the location of catching an exception
-#define THROW_PLACE std::string("(") + __FILE__ + ":" + std::to_string(__LINE__) + ": " + __DATE__ + " " + __TIME__ + ", " + __FUNCTION__ +  ")\n\t"
+/// macro to determine the location of catching an exception: pointers to literals, without formatting of string
+#define THROW_PLACE SOURCE_LOCATION
 // ----------------------------------------------------------------------------
 
-/// try/catch and then output to std::cerr exception message .what()
+/// try/catch and then output to the log (std::cerr) exception message .what()
 /// 
-/// @param throw_place string with filename, its datetime, line number in file and function name which call this try_catch_to_cerr() function
+/// @param throw_place filename, line number in file and function name which call this try_catch_to_cerr() function
 /// @param func function that will launch in try/catch
 /// 
 /// @return true if no exceptions, false if catched an exception
 ///
 template<typename T_func>
-inline bool try_catch_to_cerr(const std::string& throw_place, T_func func) {
+inline bool try_catch_to_cerr(const T_source_location& throw_place, T_func func) {
 	try {
 		func();
 	} catch(const seh::T_seh_exception& e) {
-		std::cerr << "T_seh_exception: " << e.what() << "\n ->throw place: " << throw_place << std::endl;
+		PORTMAPPING_LOG_AT(log_error, throw_place, "T_seh_exception: " << e.what());
 		return false;
 	} catch(const bs::system_error& e) {
-		std::cerr << "Boost system_error exception: " << e.what() << "\n ->throw place: " << throw_place << std::endl;
+		PORTMAPPING_LOG_AT(log_error, throw_place, "Boost system_error exception: " << e.what());
 		return false;
 	} catch(const std::exception &e) {
-		std::cerr << "Exception: " << e.what() << "\n ->throw place: " << throw_place << std::endl;
+		PORTMAPPING_LOG_AT(log_error, throw_place, "Exception: " << e.what());
 		return false;
 	} catch(...) {
-		std::cerr << "Unknown exception!" << "\n ->throw place: " << throw_place << std::endl;
+		PORTMAPPING_LOG_AT(log_error, throw_place, "Unknown exception!");
 		return false;
 	}	
 	return true;
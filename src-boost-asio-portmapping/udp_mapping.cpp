@@ -0,0 +1,493 @@
+/**
+ * @file   udp_mapping.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief UDP port mapping: sessions of clients sharded by executors, batched receive and send
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "udp_mapping.hpp"
+#include "cpu_topology.hpp"
+#include "log.hpp"
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <cstring>
+// ----------------------------------------------------------------------------
+#ifdef PORTMAPPING_MMSG
+#include <sys/socket.h>
+#include <errno.h>
+#endif
+// ----------------------------------------------------------------------------
+#if defined(__linux__) && defined(SO_REUSEPORT)
+	#define PORTMAPPING_REUSEPORT	///< kernel balances clients between many sockets on the same port
+	/// socket option to allow many sockets bound to the same address:port
+	typedef ba::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> T_reuse_port;
+#endif
+// ----------------------------------------------------------------------------
+
+T_udp_session_table::T_udp_session_table()
+	: entries_(initial_capacity), mask_(initial_capacity - 1), size_(0)
+{
+	for(auto &i : entries_) i.hash_ = 0, i.session_ = NULL;
+}
+// ----------------------------------------------------------------------------
+
+/// Hash of address of client
+uint64_t T_udp_session_table::hash(const ba::ip::udp::endpoint& client) {
+	uint64_t h = client.port();
+	if(client.address().is_v4()) {
+		h ^= uint64_t(client.address().to_v4().to_ulong()) << 16;
+	} else {
+		const ba::ip::address_v6::bytes_type bytes = client.address().to_v6().to_bytes();
+		uint64_t high, low;
+		std::memcpy(&high, &bytes[0], sizeof(high));
+		std::memcpy(&low, &bytes[8], sizeof(low));
+		h ^= high ^ (low * 0x9E3779B97F4A7C15ULL);
+	}
+	// finalizer of splitmix64: all bits of address affect low bits, which select position
+	h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+	return h ^ (h >> 31);
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Session of client
+///
+/// @param client address of client
+/// @param hash hash of address
+///
+/// @return session, or NULL if there isn't it
+///
+T_udp_session* T_udp_session_table::find(const ba::ip::udp::endpoint& client, const uint64_t hash) const {
+	for(size_t i = hash & mask_; entries_[i].session_ != NULL; i = (i + 1) & mask_)
+		if(entries_[i].hash_ == hash && entries_[i].session_->client_ == client) return entries_[i].session_;
+	return NULL;
+}
+// ----------------------------------------------------------------------------
+
+/// Add session, which isn't in the table: the table is doubled, when it's half full
+void T_udp_session_table::insert(T_udp_session *const session) {
+	if((size_ + 1) * 2 > entries_.size()) {
+		std::vector<T_entry> old(entries_.size() * 2);
+		old.swap(entries_);
+		for(auto &i : entries_) i.hash_ = 0, i.session_ = NULL;
+		mask_ = entries_.size() - 1;
+		for(auto &i : old) if(i.session_ != NULL) place(i);
+	}
+	T_entry entry;
+	entry.hash_ = session->hash_;
+	entry.session_ = session;
+	place(entry);
+	++size_;
+}
+
+/// Put entry to the first free position of its probe sequence
+void T_udp_session_table::place(const T_entry& entry) {
+	size_t i = entry.hash_ & mask_;
+	while(entries_[i].session_ != NULL) i = (i + 1) & mask_;
+	entries_[i] = entry;
+}
+// ----------------------------------------------------------------------------
+
+/// Remove session, if it's in the table
+void T_udp_session_table::remove(T_udp_session *const session) {
+	for(size_t i = session->hash_ & mask_; entries_[i].session_ != NULL; i = (i + 1) & mask_)
+		if(entries_[i].session_ == session) {
+			remove_at(i);
+			return;
+		}
+}
+
+///
+/// Remove entry at position and shift back next entries of the same probe sequences:
+/// entry can fill the hole, if its home position isn't between the hole and itself (cyclically)
+///
+/// @param i position of entry
+///
+void T_udp_session_table::remove_at(size_t i) {
+	size_t hole = i;
+	for(size_t j = (i + 1) & mask_; entries_[j].session_ != NULL; j = (j + 1) & mask_) {
+		const size_t home = entries_[j].hash_ & mask_;
+		if(((j - home) & mask_) >= ((j - hole) & mask_)) {
+			entries_[hole] = entries_[j];
+			hole = j;
+		}
+	}
+	entries_[hole].hash_ = 0;
+	entries_[hole].session_ = NULL;
+	--size_;
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Open sockets of shards and start receive
+///
+/// @param executors thread pool of executors, in which shards work
+/// @param local_endpoint address and port to receive datagrams of clients
+/// @param backends remote servers of port mapping
+/// @param metrics counters of port mapping (sessions are counted as connections)
+/// @param settings timeout and limit of sessions
+///
+T_udp_mapping::T_udp_mapping(T_executors& executors, const ba::ip::udp::endpoint& local_endpoint, T_backend_pool& backends,
+							 T_metrics& metrics, const T_udp_settings& settings)
+	: backends_(backends), metrics_(metrics), settings_(settings)
+{
+#ifdef PORTMAPPING_REUSEPORT
+	const size_t shards = executors.sharded() ? executors.size() : std::max<size_t>(executors.threads(), 1);
+#else
+	const size_t shards = 1;	// one socket: all sessions in one shard
+#endif
+	for(size_t i = 0; i < shards; ++i) {
+		const size_t i_executor = executors.sharded() ? i : 0;
+		shards_.emplace_back(new T_shard(executors.get_io_service(i_executor), (settings_.max_sessions_ + shards - 1) / shards,
+										 executors.node(i_executor)));
+		T_shard& shard = *shards_.back();
+		shard.socket_.open(local_endpoint.protocol());
+		shard.socket_.set_option(ba::socket_base::reuse_address(true));
+#ifdef PORTMAPPING_REUSEPORT
+		// also the new process after handoff binds the same port, while this one is draining
+		shard.socket_.set_option(T_reuse_port(true));
+#endif
+		shard.socket_.bind(local_endpoint);
+		shard.socket_.non_blocking(true);
+	}
+#ifdef PORTMAPPING_REUSEPORT
+	// in sharded mode datagrams go to the shard, which executor runs on the CPU (or NUMA node), that received them
+	std::vector<unsigned int> cpus;
+	for(size_t i = 0; i < shards_.size() && executors.sharded() && executors.cpu(i) >= 0; ++i)
+		cpus.push_back(static_cast<unsigned int>(executors.cpu(i)));
+	if(cpus.size() == shards_.size() && shards_.size() > 1)
+		steer_reuseport_by_cpu(static_cast<int>(shards_[0]->socket_.native_handle()), cpus);
+#endif
+	for(auto &i : shards_) {
+		start_receive(*i);
+		start_expiry_timer(*i);
+	}
+	PORTMAPPING_LOG(log_info, "UDP: " << shards_.size() << " shards, session timeout " << settings_.session_timeout_seconds_ <<
+		" sec, max sessions " << settings_.max_sessions_);
+}
+// ----------------------------------------------------------------------------
+
+/// Destroy sessions, io_services of executors are already stopped
+T_udp_mapping::~T_udp_mapping() {
+	for(auto &i : shards_) {
+		T_shard& shard = *i;
+		shard.table_.remove_if([](T_udp_session&) { return true; },
+			[this, &shard](T_udp_session *const session) { destroy_session(shard, session); });
+	}
+}
+// ----------------------------------------------------------------------------
+
+/// Close sockets of clients and all sessions, each shard in its io_service
+void T_udp_mapping::stop() {
+	for(auto &i : shards_)
+		i->strand_.post(boost::bind(&T_udp_mapping::stop_shard, this, boost::ref(*i)));
+}
+
+/// Close sockets of shard in its strand
+void T_udp_mapping::stop_shard(T_shard& shard) {
+	if(shard.stopped_) return;
+	shard.stopped_ = true;
+	bs::error_code ec;
+	shard.socket_.close(ec);
+	shard.expiry_timer_.cancel(ec);
+	shard.table_.remove_if([](T_udp_session&) { return true; }, &T_udp_mapping::close_session);
+}
+// ----------------------------------------------------------------------------
+
+/// Start wait of datagrams of clients
+void T_udp_mapping::start_receive(T_shard& shard) {
+	shard.socket_.async_receive(ba::null_buffers(),
+		shard.strand_.wrap(boost::bind(&T_udp_mapping::handle_receive, this, boost::ref(shard), ba::placeholders::error)) );
+}
+
+///
+/// Receive batches of datagrams of clients, find or create their sessions and send datagrams to remote servers:
+/// datagrams of one session, which are consecutive in the batch, are sent by one call
+///
+/// @param shard shard
+/// @param err
+///
+void T_udp_mapping::handle_receive(T_shard& shard, const bs::error_code& err) {
+	if(shard.stopped_ || err == ba::error::operation_aborted) return;
+	T_batch& batch = shard.batch_;
+	T_udp_session *sessions[max_batch];
+	for(size_t round = 0; round < batches_per_event; ++round) {
+		bs::error_code ec;
+		const size_t count = receive_batch(shard.socket_, batch, true, ec);
+		size_t dropped = 0;
+		for(size_t i = 0; i < count; ++i) {
+			sessions[i] = NULL;
+			if(batch.truncated_[i]) {
+				++dropped;
+				continue;
+			}
+			const uint64_t hash = T_udp_session_table::hash(batch.sources_[i]);
+			T_udp_session *session = shard.table_.find(batch.sources_[i], hash);
+			if(session == NULL) session = create_session(shard, batch.sources_[i], hash);
+			if(session == NULL) {
+				++dropped;	// the limit of sessions, or there isn't healthy remote server
+				continue;
+			}
+			session->last_active_ = shard.now_;
+			metrics_.add(T_metrics::bytes_client_to_server, batch.lengths_[i]);
+			sessions[i] = session;
+		}
+		for(size_t first = 0; first < count; ) {
+			size_t end = first + 1;
+			while(end < count && sessions[end] == sessions[first]) ++end;
+			if(sessions[first] != NULL)
+				dropped += (end - first) - send_batch(sessions[first]->socket_, batch, first, end - first, NULL);
+			first = end;
+		}
+		if(dropped != 0) metrics_.add(T_metrics::udp_datagrams_dropped, dropped);
+		if(count < max_batch) {
+			start_receive(shard);	// the socket is drained
+			return;
+		}
+	}
+	// there can be more datagrams: other shards and sessions go first
+	shard.strand_.post(boost::bind(&T_udp_mapping::handle_receive, this, boost::ref(shard), bs::error_code()));
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Create session for client: select remote server and connect socket to it
+///
+/// @param shard shard of client
+/// @param client address of client
+/// @param hash hash of address
+///
+/// @return session, or NULL if the limit of sessions is reached or there isn't available remote server
+///
+T_udp_session* T_udp_mapping::create_session(T_shard& shard, const ba::ip::udp::endpoint& client, const uint64_t hash) {
+	void *const memory = shard.sessions_.allocate();
+	if(memory == NULL) return NULL;
+
+	T_backend& backend = backends_.select(client.address());
+	const T_endpoint_table::T_endpoints_ptr endpoints = backend.endpoints_.endpoints();
+	const int i_endpoint = T_endpoint_table::select(*endpoints, 0);
+	if(i_endpoint < 0) {
+		shard.sessions_.deallocate(memory);
+		return NULL;
+	}
+	const ba::ip::tcp::endpoint& remote = (*endpoints)[i_endpoint]->endpoint_;
+	const ba::ip::udp::endpoint server(remote.address(), remote.port());
+
+	T_udp_session *const session = new (memory) T_udp_session(shard.io_service_, client, hash, backend);
+	bs::error_code ec;
+	session->socket_.open(server.protocol(), ec);
+	if(!ec) session->socket_.non_blocking(true, ec);
+	if(!ec) session->socket_.connect(server, ec);	// replies only of this server are received
+	if(ec) {
+		shard.sessions_.destroy(session);
+		return NULL;
+	}
+	session->last_active_ = shard.now_;
+	shard.table_.insert(session);
+	backend.active_connections_.fetch_add(1, std::memory_order_relaxed);
+	metrics_.add(T_metrics::connections_opened);
+	PORTMAPPING_LOG(log_trace, "UDP session " << client << " -> " << server);
+	start_session_receive(shard, *session);
+	return session;
+}
+// ----------------------------------------------------------------------------
+
+/// Start wait of replies of remote server of session
+void T_udp_mapping::start_session_receive(T_shard& shard, T_udp_session& session) {
+	session.socket_.async_receive(ba::null_buffers(),
+		shard.strand_.wrap(boost::bind(&T_udp_mapping::handle_session_receive, this, boost::ref(shard), &session, ba::placeholders::error)) );
+}
+
+///
+/// Receive batches of replies of remote server and send them to the client by the socket of shard.
+/// Session has always one pending handler: wait or posted continuation, which destroys it after close
+///
+/// @param shard shard of session
+/// @param session session
+/// @param err
+///
+void T_udp_mapping::handle_session_receive(T_shard& shard, T_udp_session *const session, const bs::error_code& err) {
+	if(!session->socket_.is_open()) {
+		destroy_session(shard, session);	// closed by idle timeout or stop
+		return;
+	}
+	if(err) {
+		shard.table_.remove(session);
+		metrics_.add(T_metrics::relay_errors);
+		destroy_session(shard, session);
+		return;
+	}
+	T_batch& batch = shard.batch_;
+	for(size_t round = 0; round < batches_per_event; ++round) {
+		bs::error_code ec;	// e.g. ECONNREFUSED by ICMP of the server: the session waits for next datagrams
+		const size_t count = receive_batch(session->socket_, batch, false, ec);
+		size_t dropped = 0;
+		for(size_t first = 0; first < count; ) {
+			if(batch.truncated_[first]) {
+				++dropped, ++first;
+				continue;
+			}
+			size_t end = first + 1, bytes = batch.lengths_[first];
+			while(end < count && !batch.truncated_[end]) bytes += batch.lengths_[end++];
+			metrics_.add(T_metrics::bytes_server_to_client, bytes);
+			dropped += (end - first) - send_batch(shard.socket_, batch, first, end - first, &session->client_);
+			first = end;
+		}
+		if(dropped != 0) metrics_.add(T_metrics::udp_datagrams_dropped, dropped);
+		if(count != 0) session->last_active_ = shard.now_;
+		if(count < max_batch) {
+			start_session_receive(shard, *session);
+			return;
+		}
+	}
+	shard.strand_.post(boost::bind(&T_udp_mapping::handle_session_receive, this, boost::ref(shard), session, bs::error_code()));
+}
+// ----------------------------------------------------------------------------
+
+/// Close socket of session, it's destroyed by its pending handler
+void T_udp_mapping::close_session(T_udp_session *const session) {
+	bs::error_code ec;
+	session->socket_.close(ec);
+}
+
+/// Destroy session, which isn't in the table and hasn't pending handler
+void T_udp_mapping::destroy_session(T_shard& shard, T_udp_session *const session) {
+	session->backend_.active_connections_.fetch_sub(1, std::memory_order_relaxed);
+	metrics_.add(T_metrics::connections_closed);
+	shard.sessions_.destroy(session);
+}
+// ----------------------------------------------------------------------------
+
+/// Start timer of shard
+void T_udp_mapping::start_expiry_timer(T_shard& shard) {
+	shard.expiry_timer_.expires_from_now(boost::posix_time::seconds(static_cast<long>(expiry_check_seconds)));
+	shard.expiry_timer_.async_wait(
+		shard.strand_.wrap(boost::bind(&T_udp_mapping::handle_expiry_timer, this, boost::ref(shard), ba::placeholders::error)) );
+}
+
+///
+/// Advance clock of shard and close sessions without datagrams for session timeout
+///
+/// @param shard shard
+/// @param err
+///
+void T_udp_mapping::handle_expiry_timer(T_shard& shard, const bs::error_code& err) {
+	if(err || shard.stopped_) return;
+	shard.now_ += expiry_check_seconds;
+	if(shard.table_.size() != 0) {
+		const uint32_t now = shard.now_, timeout = settings_.session_timeout_seconds_;
+		T_metrics& metrics = metrics_;
+		shard.table_.remove_if([now, timeout](T_udp_session& session) { return now - session.last_active_ >= timeout; },
+			[&metrics](T_udp_session *const session) {
+				metrics.add(T_metrics::idle_timeouts);
+				close_session(session);
+			});
+	}
+	start_expiry_timer(shard);
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Receive up to max_batch datagrams from non-blocking socket
+///
+/// @param socket socket
+/// @param batch datagrams
+/// @param sources true - store senders of datagrams
+/// @param ec error, would_block if there are no datagrams
+///
+/// @return number of datagrams
+///
+size_t T_udp_mapping::receive_batch(ba::ip::udp::socket& socket, T_batch& batch, const bool sources, bs::error_code& ec) {
+#ifdef PORTMAPPING_MMSG
+	struct mmsghdr messages[max_batch];
+	struct iovec iovecs[max_batch];
+	std::memset(messages, 0, sizeof(messages));
+	for(size_t i = 0; i < max_batch; ++i) {
+		iovecs[i].iov_base = batch.buffers_[i];
+		iovecs[i].iov_len = max_datagram;
+		messages[i].msg_hdr.msg_iov = &iovecs[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+		if(sources) {
+			// addresses are written directly to endpoints
+			messages[i].msg_hdr.msg_name = batch.sources_[i].data();
+			messages[i].msg_hdr.msg_namelen = static_cast<socklen_t>(batch.sources_[i].capacity());
+		}
+	}
+	const int count = ::recvmmsg(socket.native_handle(), messages, max_batch, MSG_DONTWAIT, NULL);
+	if(count < 0) {
+		ec = bs::error_code(errno, bs::system_category());
+		return 0;
+	}
+	for(int i = 0; i < count; ++i) {
+		batch.lengths_[i] = messages[i].msg_len;
+		batch.truncated_[i] = (messages[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+		if(sources) batch.sources_[i].resize(messages[i].msg_hdr.msg_namelen);
+	}
+	return static_cast<size_t>(count);
+#else
+	size_t count = 0;
+	while(count < max_batch) {
+		const ba::mutable_buffers_1 buffer(batch.buffers_[count], max_datagram);
+		const size_t len = sources ? socket.receive_from(buffer, batch.sources_[count], 0, ec) : socket.receive(buffer, 0, ec);
+		batch.truncated_[count] = (ec == ba::error::message_size);
+		if(ec && !batch.truncated_[count]) break;
+		batch.lengths_[count++] = len;
+	}
+	if(count != 0) ec = bs::error_code();
+	return count;
+#endif
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Send datagrams of batch from non-blocking socket, datagrams which don't fit to the socket buffer are dropped
+///
+/// @param socket socket
+/// @param batch datagrams
+/// @param first index of the first datagram
+/// @param count number of datagrams
+/// @param destination receiver, or NULL if the socket is connected
+///
+/// @return number of sent datagrams
+///
+size_t T_udp_mapping::send_batch(ba::ip::udp::socket& socket, T_batch& batch, const size_t first, const size_t count,
+								 const ba::ip::udp::endpoint *const destination) {
+#ifdef PORTMAPPING_MMSG
+	struct mmsghdr messages[max_batch];
+	struct iovec iovecs[max_batch];
+	std::memset(messages, 0, sizeof(messages));
+	for(size_t i = 0; i < count; ++i) {
+		iovecs[i].iov_base = batch.buffers_[first + i];
+		iovecs[i].iov_len = batch.lengths_[first + i];
+		messages[i].msg_hdr.msg_iov = &iovecs[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+		if(destination != NULL) {
+			messages[i].msg_hdr.msg_name = const_cast<void*>(static_cast<const void*>(destination->data()));
+			messages[i].msg_hdr.msg_namelen = static_cast<socklen_t>(destination->size());
+		}
+	}
+	size_t sent = 0;
+	while(sent < count) {
+		const int result = ::sendmmsg(socket.native_handle(), messages + sent, static_cast<unsigned int>(count - sent), MSG_DONTWAIT);
+		if(result > 0) sent += result;
+		else if(result == 0 || errno != EINTR) break;	// the socket buffer is full, or error of the first datagram
+	}
+	return sent;
+#else
+	size_t sent = 0;
+	for(size_t i = first; i < first + count; ++i) {
+		bs::error_code ec;
+		const ba::const_buffers_1 buffer(batch.buffers_[i], batch.lengths_[i]);
+		if(destination != NULL) socket.send_to(buffer, *destination, 0, ec);
+		else socket.send(buffer, 0, ec);
+		if(!ec) ++sent;
+	}
+	return sent;
+#endif
+}
+// ----------------------------------------------------------------------------
@@ -0,0 +1,251 @@
+/**
+ * @file   udp_mapping.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief UDP port mapping: sessions of clients sharded by executors, batched receive and send
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef UDP_MAPPING_HPP
+#define UDP_MAPPING_HPP
+// ----------------------------------------------------------------------------
+#include "executors.hpp"
+#include "backend_pool.hpp"
+#include "metrics.hpp"
+#include "slab_pool.hpp"
+// ----------------------------------------------------------------------------
+#include <boost/noncopyable.hpp>
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+namespace bs = boost::system;
+// ----------------------------------------------------------------------------
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+// ----------------------------------------------------------------------------
+#if defined(__linux__)
+	#define PORTMAPPING_MMSG	///< datagrams are received and sent by batches: recvmmsg()/sendmmsg()
+#endif
+// ----------------------------------------------------------------------------
+
+/// Settings of sessions of UDP port mapping
+struct T_udp_settings {
+	T_udp_settings() : session_timeout_seconds_(60), max_sessions_(65536) {}
+
+	unsigned int session_timeout_seconds_;  ///< session without datagrams in both directions is closed after it
+	size_t max_sessions_;                   ///< max sessions of port mapping (divided between shards), datagrams of new clients over it are dropped
+};
+// ----------------------------------------------------------------------------
+
+/// Session of one client address: own socket connected to the remote server, from which replies are read
+struct T_udp_session : private boost::noncopyable {
+	T_udp_session(ba::io_service& io_service, const ba::ip::udp::endpoint& client, const uint64_t hash, T_backend& backend)
+		: socket_(io_service), client_(client), hash_(hash), backend_(backend), last_active_(0) {}
+
+	ba::ip::udp::socket socket_;            ///< socket connected to the remote server
+	const ba::ip::udp::endpoint client_;    ///< address of client
+	const uint64_t hash_;                   ///< hash of client_ in the table of sessions
+	T_backend& backend_;                    ///< remote server of this session
+	uint32_t last_active_;                  ///< time of the last datagram in any direction, seconds of the shard clock
+};
+// ----------------------------------------------------------------------------
+
+///
+/// Table of sessions by address of client: open addressing with linear probing in one array
+/// of (hash, pointer) pairs, 4 per cache line, so lookup touches the session only when its hash matches.
+/// Removal shifts the next entries back (without tombstones), so probe sequences stay short.
+/// Capacity is a power of 2, it's doubled when the table is half full.
+///
+class T_udp_session_table : private boost::noncopyable {
+public:
+	enum { initial_capacity = 1024 };       ///< entries of empty table
+
+	T_udp_session_table();
+
+	/// Hash of address of client
+	static uint64_t hash(const ba::ip::udp::endpoint& client);
+
+	/// Session of client, or NULL
+	T_udp_session* find(const ba::ip::udp::endpoint& client, const uint64_t hash) const;
+
+	/// Add session, which isn't in the table
+	void insert(T_udp_session *const session);
+
+	/// Remove session, if it's in the table
+	void remove(T_udp_session *const session);
+
+	///
+	/// Remove sessions, for which predicate returns true
+	///
+	/// @param expired predicate: bool(T_udp_session&)
+	/// @param removed called for each removed session: void(T_udp_session*)
+	///
+	template<typename T_predicate, typename T_removed>
+	void remove_if(T_predicate expired, T_removed removed) {
+		for(size_t i = 0; i < entries_.size(); ) {
+			T_udp_session *const session = entries_[i].session_;
+			if(session != NULL && expired(*session)) {
+				remove_at(i);
+				removed(session);
+				continue;	// the next entry can be shifted to this position
+			}
+			++i;
+		}
+	}
+
+	/// Number of sessions
+	inline size_t size() const { return size_; }
+
+private:
+	/// Entry of the table
+	struct T_entry {
+		uint64_t hash_;                     ///< hash of address of client
+		T_udp_session *session_;            ///< session, NULL - the entry is free
+	};
+
+	/// Remove entry at position and shift back next entries of the same probe sequences
+	void remove_at(size_t i);
+
+	/// Put entry to the first free position of its probe sequence
+	void place(const T_entry& entry);
+
+	std::vector<T_entry> entries_;          ///< entries, power of 2
+	size_t mask_;                           ///< size of entries_ - 1
+	size_t size_;                           ///< number of sessions
+};
+// ----------------------------------------------------------------------------
+
+///
+/// UDP port mapping: it uses the executors, remote servers and counters of its T_server.
+///
+/// Datagrams of clients are received by one socket per shard bound to the same port with SO_REUSEPORT,
+/// so the kernel hashes each client to one shard, and its session lives only there without locks.
+/// In sharded mode each executor's io_service has one shard, in shared mode there is one shard per thread
+/// of executors in the shared io_service. Handlers of shard are serialized by its strand.
+///
+/// On Linux datagrams are received by recvmmsg() up to max_batch at once, datagrams of one session
+/// in a batch are sent to the remote server by one sendmmsg(), and replies of session are sent to the client
+/// by one sendmmsg(). Sessions without datagrams in both directions are closed by timer of shard.
+///
+class T_udp_mapping : private boost::noncopyable {
+public:
+	enum { max_batch = 32 };                ///< max datagrams received or sent by one syscall
+	enum { max_datagram = 4096 };           ///< max size of datagram, bigger ones are dropped (DNS with EDNS, games)
+	enum { expiry_check_seconds = 1 };      ///< period of the clock of shard and of check of idle sessions
+	enum { batches_per_event = 4 };         ///< max batches received per one handler, then the handler is posted again
+
+	///
+	/// Open sockets of shards and start receive
+	///
+	/// @param executors thread pool of executors, in which shards work
+	/// @param local_endpoint address and port to receive datagrams of clients
+	/// @param backends remote servers of port mapping
+	/// @param metrics counters of port mapping (sessions are counted as connections)
+	/// @param settings timeout and limit of sessions
+	///
+	T_udp_mapping(T_executors& executors, const ba::ip::udp::endpoint& local_endpoint, T_backend_pool& backends,
+				  T_metrics& metrics, const T_udp_settings& settings);
+	~T_udp_mapping();
+
+	/// Close sockets of clients and all sessions, each shard in its io_service
+	void stop();
+
+	/// Number of shards
+	inline size_t shards() const { return shards_.size(); }
+
+private:
+	/// Memory pool of sessions of shard
+	typedef T_slab_pool<T_udp_session> T_session_slab;
+
+	/// Datagrams of one batch
+	struct T_batch {
+		char buffers_[max_batch][max_datagram];         ///< data
+		size_t lengths_[max_batch];                     ///< length of each datagram
+		ba::ip::udp::endpoint sources_[max_batch];      ///< senders (only for the socket of clients)
+		bool truncated_[max_batch];                     ///< datagram is bigger than max_datagram
+	};
+
+	/// Sessions of clients, which are hashed to one socket
+	struct T_shard : private boost::noncopyable {
+		T_shard(ba::io_service& io_service, size_t max_sessions, int node)
+			: io_service_(io_service), strand_(io_service), socket_(io_service), expiry_timer_(io_service),
+			  sessions_(0, max_sessions, node), now_(0), stopped_(false) {}
+
+		ba::io_service& io_service_;            ///< io_service of executors, in which the shard works
+		ba::io_service::strand strand_;         ///< serializes handlers of shard in shared mode
+		ba::ip::udp::socket socket_;            ///< socket, to which clients send datagrams
+		ba::deadline_timer expiry_timer_;       ///< clock of shard and check of idle sessions
+		T_udp_session_table table_;             ///< sessions by address of client
+		T_session_slab sessions_;               ///< memory of sessions, max_sessions
+		uint32_t now_;                          ///< seconds since start of shard
+		bool stopped_;                          ///< sockets are closed
+		T_batch batch_;                         ///< datagrams of the current handler
+	};
+
+	/// Start wait of datagrams of clients
+	void start_receive(T_shard& shard);
+
+	/// Receive batch of datagrams of clients, find or create their sessions and send datagrams to remote servers
+	void handle_receive(T_shard& shard, const bs::error_code& err);
+
+	/// Create session for client: select remote server and connect socket to it
+	T_udp_session* create_session(T_shard& shard, const ba::ip::udp::endpoint& client, uint64_t hash);
+
+	/// Start wait of replies of remote server of session
+	void start_session_receive(T_shard& shard, T_udp_session& session);
+
+	/// Receive batch of replies of remote server and send them to the client
+	void handle_session_receive(T_shard& shard, T_udp_session *const session, const bs::error_code& err);
+
+	/// Close socket of session, it's destroyed by its pending handler
+	static void close_session(T_udp_session *const session);
+
+	/// Destroy session, which isn't in the table and hasn't pending handler
+	void destroy_session(T_shard& shard, T_udp_session *const session);
+
+	/// Start timer of shard
+	void start_expiry_timer(T_shard& shard);
+
+	/// Advance clock of shard and close idle sessions
+	void handle_expiry_timer(T_shard& shard, const bs::error_code& err);
+
+	/// Close sockets of shard in its strand
+	void stop_shard(T_shard& shard);
+
+	///
+	/// Receive up to max_batch datagrams from non-blocking socket
+	///
+	/// @param socket socket
+	/// @param batch datagrams
+	/// @param sources true - store senders of datagrams
+	/// @param ec error, would_block if there are no datagrams
+	///
+	/// @return number of datagrams
+	///
+	static size_t receive_batch(ba::ip::udp::socket& socket, T_batch& batch, bool sources, bs::error_code& ec);
+
+	///
+	/// Send datagrams of batch from non-blocking socket, datagrams which don't fit to the socket buffer are dropped
+	///
+	/// @param socket socket
+	/// @param batch datagrams
+	/// @param first index of the first datagram
+	/// @param count number of datagrams
+	/// @param destination receiver, or NULL if the socket is connected
+	///
+	/// @return number of sent datagrams
+	///
+	static size_t send_batch(ba::ip::udp::socket& socket, T_batch& batch, size_t first, size_t count,
+							 const ba::ip::udp::endpoint *const destination);
+
+	T_backend_pool& backends_;              ///< remote servers of port mapping
+	T_metrics& metrics_;                    ///< counters of port mapping
+	const T_udp_settings settings_;         ///< timeout and limit of sessions
+	std::vector<std::unique_ptr<T_shard> > shards_;     ///< shards
+};
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // UDP_MAPPING_HPP
@@ -0,0 +1,209 @@
+/**
+ * @file   upstream_pool.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Pool of pre-established connections to the remote server
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "upstream_pool.hpp"
+
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+// ----------------------------------------------------------------------------
+
+/// 
+/// Create sockets and start connect of them
+/// 
+/// @param io_service io_service, in which the timer of maintenance works
+/// @param executors thread pool of executors, for each io_service of which pool has own sockets
+/// @param endpoints endpoints of remote server
+/// @param target_size number of pre-established sockets for each io_service of executors
+/// @param max_idle_seconds max time of idle pre-established socket, then it is reconnected, 0 - unlimited
+/// @param socket_options options of server sockets, which are set before connect
+///
+T_upstream_pool::T_upstream_pool(ba::io_service& io_service, T_executors& executors, T_endpoint_table& endpoints, 
+								 size_t target_size, unsigned int max_idle_seconds, const T_socket_options& socket_options)
+	: endpoints_(endpoints), max_idle_seconds_(max_idle_seconds), socket_options_(socket_options), maintenance_timer_(io_service), stopped_(false)
+{
+	for(size_t i = 0; i < executors.size(); ++i) {
+		pools_.emplace_back(new T_executor_pool);
+		T_executor_pool& pool = *pools_.back();
+		pool.io_service_ = &executors.get_io_service(i);
+		for(size_t k = 0; k < target_size; ++k)
+			pool.slots_.emplace_back(new T_slot(*pool.io_service_));
+	}
+	for(size_t i = 0; i < pools_.size(); ++i) {
+		boost::lock_guard<boost::mutex> lock(pools_[i]->mutex_);
+		for(size_t k = 0; k < target_size; ++k) start_connect(i, k);
+	}
+	start_maintenance_timer();
+}
+// ----------------------------------------------------------------------------
+
+/// Stop refill and close pre-established sockets (sockets, which are connecting, are closed when connect is completed)
+void T_upstream_pool::stop() {
+	stopped_.store(true, std::memory_order_relaxed);
+	bs::error_code ec;
+	maintenance_timer_.cancel(ec);
+	for(auto &pool : pools_) {
+		boost::lock_guard<boost::mutex> lock(pool->mutex_);
+		for(auto &slot : pool->slots_) {
+			if(slot->state_ != slot_ready) continue;
+			slot->socket_.close(ec);
+			slot->state_ = slot_empty;
+		}
+	}
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Take pre-established socket from the pool of io_service
+/// 
+/// @param io_service io_service of executors, in which socket works
+/// @param socket socket of connection, to which pre-established socket will be moved
+/// 
+/// @return true if socket has been taken, false if the pool is empty
+///
+bool T_upstream_pool::take(ba::io_service& io_service, ba::ip::tcp::socket& socket) {
+	for(size_t i = 0; i < pools_.size(); ++i) {
+		T_executor_pool& pool = *pools_[i];
+		if(pool.io_service_ != &io_service) continue;
+
+		boost::lock_guard<boost::mutex> lock(pool.mutex_);
+		for(size_t k = 0; k < pool.slots_.size(); ++k) {
+			T_slot& slot = *pool.slots_[k];
+			if(slot.state_ != slot_ready) continue;
+			slot.state_ = slot_empty;
+			if(alive(slot.socket_)) {
+				socket = std::move(slot.socket_);	// the same io_service: the socket is only re-owned
+				slot.socket_ = ba::ip::tcp::socket(*pool.io_service_);	// moved-from socket has no executor
+				start_connect(i, k);	// refill at once
+				return true;
+			}
+			bs::error_code ec;
+			slot.socket_.close(ec);
+			start_connect(i, k);
+		}
+		return false;
+	}
+	return false;
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Start connect of the empty slot, mutex of pool must be locked
+/// 
+/// @param i_pool index of pool of io_service
+/// @param i_slot index of slot
+///
+void T_upstream_pool::start_connect(const size_t i_pool, const size_t i_slot) {
+	T_slot& slot = *pools_[i_pool]->slots_[i_slot];
+	if(stopped_.load(std::memory_order_relaxed) || slot.state_ != slot_empty) return;
+
+	slot.endpoints_ = endpoints_.endpoints();
+	slot.i_endpoint_ = T_endpoint_table::select(*slot.endpoints_, 0);
+	if(slot.i_endpoint_ < 0) {
+		slot.endpoints_.reset();
+		return;
+	}
+	// the best endpoint is unhealthy: try again by maintenance timer, after its backoff
+	if((*slot.endpoints_)[slot.i_endpoint_]->down_until_ms_.load(std::memory_order_relaxed) > T_endpoint_table::now_ms()) {
+		slot.endpoints_.reset();
+		return;
+	}
+	// options are set before connect: buffers of socket define window scale of handshake
+	const ba::ip::tcp::endpoint& endpoint = (*slot.endpoints_)[slot.i_endpoint_]->endpoint_;
+	bs::error_code ec;
+	if(slot.socket_.open(endpoint.protocol(), ec)) {
+		slot.endpoints_.reset();	// e.g. limit of descriptors: try again by maintenance timer
+		return;
+	}
+	socket_options_.apply(slot.socket_);
+	slot.state_ = slot_connecting;
+	slot.connect_start_us_ = T_endpoint_table::now_us();
+	slot.socket_.async_connect(endpoint,
+		boost::bind(&T_upstream_pool::handle_connect, this, i_pool, i_slot, ba::placeholders::error));
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Run when connect of the slot is completed
+/// 
+/// @param i_pool index of pool of io_service
+/// @param i_slot index of slot
+/// @param err 
+///
+void T_upstream_pool::handle_connect(const size_t i_pool, const size_t i_slot, const bs::error_code& err) {
+	T_executor_pool& pool = *pools_[i_pool];
+	boost::lock_guard<boost::mutex> lock(pool.mutex_);
+	T_slot& slot = *pool.slots_[i_slot];
+	T_endpoint_table::T_endpoint& endpoint = *(*slot.endpoints_)[slot.i_endpoint_];
+	slot.endpoints_.reset();
+
+	bs::error_code ec;
+	if(!err && !slot.socket_.non_blocking(true, ec)) {
+		T_endpoint_table::report_success(endpoint, static_cast<unsigned int>(T_endpoint_table::now_us() - slot.connect_start_us_));
+		if(stopped_.load(std::memory_order_relaxed)) {
+			slot.socket_.close(ec);	// the pool is stopped during connect
+			slot.state_ = slot_empty;
+			return;
+		}
+		slot.state_ = slot_ready;
+		slot.ready_ms_ = T_endpoint_table::now_ms();
+	} else {
+		if(err != ba::error::operation_aborted) T_endpoint_table::report_failure(endpoint);
+		slot.socket_.close(ec);
+		slot.state_ = slot_empty;	// reconnect by maintenance timer
+	}
+}
+// ----------------------------------------------------------------------------
+
+/// Start timer of maintenance
+void T_upstream_pool::start_maintenance_timer() {
+	maintenance_timer_.expires_from_now(boost::posix_time::milliseconds(static_cast<long>(maintenance_ms)));
+	maintenance_timer_.async_wait(boost::bind(&T_upstream_pool::handle_maintenance_timer, this, ba::placeholders::error));
+}
+
+/// 
+/// Close closed by remote server (and too long idle) sockets, and start connect of empty slots
+/// 
+/// @param err 
+///
+void T_upstream_pool::handle_maintenance_timer(const bs::error_code& err) {
+	if(err || stopped_.load(std::memory_order_relaxed)) return;
+	const int64_t now = T_endpoint_table::now_ms();
+	for(size_t i = 0; i < pools_.size(); ++i) {
+		T_executor_pool& pool = *pools_[i];
+		boost::lock_guard<boost::mutex> lock(pool.mutex_);
+		for(size_t k = 0; k < pool.slots_.size(); ++k) {
+			T_slot& slot = *pool.slots_[k];
+			if(slot.state_ == slot_ready && (!alive(slot.socket_) || 
+				(max_idle_seconds_ != 0 && now - slot.ready_ms_ > int64_t(max_idle_seconds_) * 1000))) {
+				bs::error_code ec;
+				slot.socket_.close(ec);
+				slot.state_ = slot_empty;
+			}
+			start_connect(i, k);
+		}
+	}
+	start_maintenance_timer();
+}
+// ----------------------------------------------------------------------------
+
+/// 
+/// Whether the ready socket is still open by remote server:
+/// peek of one byte would block - open, data - open (server speaks first), eof or error - closed
+/// 
+/// @param socket socket in non-blocking mode
+/// 
+/// @return true if socket is open
+///
+bool T_upstream_pool::alive(ba::ip::tcp::socket& socket) {
+	char byte;
+	bs::error_code ec;
+	const size_t len = socket.receive(ba::buffer(&byte, 1), ba::socket_base::message_peek, ec);
+	return len > 0 || ec == ba::error::would_block || ec == ba::error::try_again;
+}
+// ----------------------------------------------------------------------------
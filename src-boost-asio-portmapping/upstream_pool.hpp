@@ -0,0 +1,113 @@
+/**
+ * @file   upstream_pool.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Pool of pre-established connections to the remote server
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef UPSTREAM_POOL_HPP
+#define UPSTREAM_POOL_HPP
+// ----------------------------------------------------------------------------
+#include "endpoint_table.hpp"
+#include "executors.hpp"
+#include "socket_options.hpp"
+// ----------------------------------------------------------------------------
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+namespace bs = boost::system;
+// ----------------------------------------------------------------------------
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <cstdint>
+// ----------------------------------------------------------------------------
+
+///
+/// Pool of sockets connected in advance to the remote server, for each io_service of executors.
+/// Accepted connection adopts the socket from the pool of its io_service instantly, 
+/// instead of waiting for TCP handshake with remote server.
+/// The pool is refilled in background up to target size, and sockets closed by remote server
+/// (or idle longer than the limit, if it is set) are replaced by new ones.
+///
+class T_upstream_pool : private boost::noncopyable {
+public:
+	enum { maintenance_ms = 1000 };         ///< period of check of idle sockets and of refill after failures
+
+	/// 
+	/// Create sockets and start connect of them
+	/// 
+	/// @param io_service io_service, in which the timer of maintenance works
+	/// @param executors thread pool of executors, for each io_service of which pool has own sockets
+	/// @param endpoints endpoints of remote server
+	/// @param target_size number of pre-established sockets for each io_service of executors
+	/// @param max_idle_seconds max time of idle pre-established socket, then it is reconnected, 0 - unlimited
+	/// @param socket_options options of server sockets, which are set before connect
+	///
+	T_upstream_pool(ba::io_service& io_service, T_executors& executors, T_endpoint_table& endpoints, size_t target_size,
+					unsigned int max_idle_seconds, const T_socket_options& socket_options);
+
+	/// Stop refill and close pre-established sockets
+	void stop();
+
+	/// 
+	/// Take pre-established socket from the pool of io_service
+	/// 
+	/// @param io_service io_service of executors, in which socket works
+	/// @param socket socket of connection, to which pre-established socket will be moved
+	/// 
+	/// @return true if socket has been taken, false if the pool is empty
+	///
+	bool take(ba::io_service& io_service, ba::ip::tcp::socket& socket);
+
+private:
+	enum T_state { slot_empty, slot_connecting, slot_ready };
+
+	/// Pre-established socket
+	struct T_slot : private boost::noncopyable {
+		explicit T_slot(ba::io_service& io_service) 
+			: socket_(io_service), state_(slot_empty), ready_ms_(0), i_endpoint_(-1), connect_start_us_(0) {}
+		ba::ip::tcp::socket socket_;        ///< socket connected to remote server
+		T_state state_;                     ///< state of slot
+		int64_t ready_ms_;                  ///< time, when socket has been connected (steady clock, ms)
+		T_endpoint_table::T_endpoints_ptr endpoints_;  ///< endpoints, while connect is in progress
+		int i_endpoint_;                    ///< index of endpoint, to which socket is connecting
+		int64_t connect_start_us_;          ///< time of start of connect (steady clock, us)
+	};
+
+	/// Sockets for one io_service of executors
+	struct T_executor_pool : private boost::noncopyable {
+		ba::io_service *io_service_;        ///< io_service of executors
+		boost::mutex mutex_;                ///< mutex for slots
+		std::vector<std::unique_ptr<T_slot> > slots_;  ///< pre-established sockets
+	};
+
+	/// Start connect of the empty slot, mutex of pool must be locked
+	void start_connect(const size_t i_pool, const size_t i_slot);
+
+	/// Run when connect of the slot is completed
+	void handle_connect(const size_t i_pool, const size_t i_slot, const bs::error_code& err);
+
+	/// Start timer of maintenance
+	void start_maintenance_timer();
+
+	/// Close closed by remote server (and too long idle) sockets, and start connect of empty slots
+	void handle_maintenance_timer(const bs::error_code& err);
+
+	/// Whether the ready socket is still open by remote server
+	static bool alive(ba::ip::tcp::socket& socket);
+
+	T_endpoint_table& endpoints_;           ///< endpoints of remote server
+	const unsigned int max_idle_seconds_;   ///< max time of idle pre-established socket, then it is reconnected, 0 - unlimited
+	const T_socket_options socket_options_; ///< options of server sockets, which are set before connect
+	ba::deadline_timer maintenance_timer_;  ///< timer of maintenance
+	std::vector<std::unique_ptr<T_executor_pool> > pools_;  ///< sockets for each io_service of executors
+	std::atomic<bool> stopped_;             ///< refill is stopped
+};
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // UPSTREAM_POOL_HPP
@@ -0,0 +1,345 @@
+/**
+ * @file   uring.cpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Ring of io_uring for the relay of connections (only Linux)
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#include "uring.hpp"
+
+#ifdef PORTMAPPING_URING
+#include "log.hpp"
+
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <algorithm>
+// ----------------------------------------------------------------------------
+
+/// Ring, completions of which are handled by current thread now: its submits are batched until the end of handler
+static thread_local T_uring *handling_ring = NULL;
+
+/// Atomic load of value, which is written by the kernel
+static inline unsigned int load_acquire(const unsigned int *const p) {
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+/// Atomic store of value, which is read by the kernel
+static inline void store_release(unsigned int *const p, const unsigned int value) {
+	__atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+/// Error of the last syscall
+static inline bs::system_error last_error(const char *const what) {
+	return bs::system_error(bs::error_code(errno, bs::system_category()), what);
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Create ring, register buffers and start wait of completions
+///
+/// @param io_service io_service of executors, in which completions are handled
+/// @param buffers number of provided buffers of buffer_size (rounded up to power of 2)
+///
+/// throws bs::system_error, if the kernel doesn't support io_uring or required features
+///
+T_uring::T_uring(ba::io_service& io_service, unsigned int buffers)
+	: io_service_(io_service), ring_fd_(-1), event_fd_(-1), event_descriptor_(io_service), ring_memory_(MAP_FAILED), ring_memory_size_(0),
+	  sqes_(NULL), sqes_size_(0), sq_tail_local_(0), buffers_(NULL), buffers_count_(1), buffer_ring_(NULL), buffer_tail_(0),
+	  fixed_buffers_(false)
+{
+	while(buffers_count_ < buffers && buffers_count_ < max_buffers) buffers_count_ <<= 1;
+	try {
+		io_uring_params params;
+		std::memset(&params, 0, sizeof(params));
+		ring_fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, static_cast<unsigned int>(sq_entries), &params));
+		if(ring_fd_ < 0) throw last_error("io_uring_setup");
+		// one mapping of both rings, completions aren't dropped on overflow, receive waits for data without worker threads
+		const unsigned int required_features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL;
+		if((params.features & required_features) != required_features)
+			throw bs::system_error(bs::error_code(ENOSYS, bs::system_category()), "io_uring features");
+
+		ring_memory_size_ = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned int),
+									 params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+		ring_memory_ = ::mmap(NULL, ring_memory_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+		if(ring_memory_ == MAP_FAILED) throw last_error("mmap of io_uring");
+		sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+		void *const sqes = ::mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+		if(sqes == MAP_FAILED) throw last_error("mmap of io_uring entries");
+		sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+		char *const ring = static_cast<char*>(ring_memory_);
+		sq_head_ = reinterpret_cast<unsigned int*>(ring + params.sq_off.head);
+		sq_tail_ = reinterpret_cast<unsigned int*>(ring + params.sq_off.tail);
+		sq_flags_ = reinterpret_cast<unsigned int*>(ring + params.sq_off.flags);
+		sq_array_ = reinterpret_cast<unsigned int*>(ring + params.sq_off.array);
+		sq_mask_ = *reinterpret_cast<unsigned int*>(ring + params.sq_off.ring_mask);
+		sq_tail_local_ = *sq_tail_;
+		cq_head_ = reinterpret_cast<unsigned int*>(ring + params.cq_off.head);
+		cq_tail_ = reinterpret_cast<unsigned int*>(ring + params.cq_off.tail);
+		cqes_ = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+		cq_mask_ = *reinterpret_cast<unsigned int*>(ring + params.cq_off.ring_mask);
+
+		// region of buffers and ring of provided buffers (page aligned)
+		void *const region = ::mmap(NULL, buffers_count_ * buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(region == MAP_FAILED) throw last_error("mmap of buffers");
+		buffers_ = static_cast<char*>(region);
+		void *const buffer_ring = ::mmap(NULL, buffers_count_ * sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(buffer_ring == MAP_FAILED) throw last_error("mmap of ring of buffers");
+		buffer_ring_ = static_cast<io_uring_buf*>(buffer_ring);
+
+		io_uring_buf_reg reg;
+		std::memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = reinterpret_cast<uintptr_t>(buffer_ring_);
+		reg.ring_entries = static_cast<uint32_t>(buffers_count_);
+		reg.bgid = 0;
+		if(::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) throw last_error("io_uring ring of buffers");
+		for(size_t i = 0; i < buffers_count_; ++i) release_buffer(static_cast<int>(i));
+
+		// fixed buffers are optional: registration can exceed RLIMIT_MEMLOCK, then data are written by send()
+		iovec region_iovec;
+		region_iovec.iov_base = buffers_;
+		region_iovec.iov_len = buffers_count_ * buffer_size;
+		fixed_buffers_ = (::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS, &region_iovec, 1) == 0);
+		if(!fixed_buffers_)
+			PORTMAPPING_LOG(log_warning, "io_uring: buffers aren't registered (" << std::strerror(errno) << "), writes without fixed buffers");
+
+		event_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(event_fd_ < 0) throw last_error("eventfd");
+		if(::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_EVENTFD, &event_fd_, 1) < 0) throw last_error("io_uring eventfd");
+		event_descriptor_.assign(event_fd_);
+	} catch(...) {
+		close();
+		throw;
+	}
+	start_wait();
+}
+// ----------------------------------------------------------------------------
+
+T_uring::~T_uring() {
+	close();
+}
+
+/// Close ring and free its memory
+void T_uring::close() {
+	bs::error_code ec;
+	if(event_descriptor_.is_open()) event_descriptor_.close(ec);	// closes event_fd_
+	else if(event_fd_ >= 0) ::close(event_fd_);
+	event_fd_ = -1;
+	if(ring_fd_ >= 0) ::close(ring_fd_);	// the kernel cancels operations, which are in progress
+	ring_fd_ = -1;
+	if(sqes_ != NULL) ::munmap(sqes_, sqes_size_);
+	sqes_ = NULL;
+	if(ring_memory_ != MAP_FAILED) ::munmap(ring_memory_, ring_memory_size_);
+	ring_memory_ = MAP_FAILED;
+	if(buffer_ring_ != NULL) ::munmap(buffer_ring_, buffers_count_ * sizeof(io_uring_buf));
+	buffer_ring_ = NULL;
+	if(buffers_ != NULL) ::munmap(buffers_, buffers_count_ * buffer_size);
+	buffers_ = NULL;
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Return provided buffer to the ring for next receives
+///
+/// @param index index of buffer
+///
+void T_uring::release_buffer(const int index) {
+	boost::lock_guard<boost::mutex> lock(mutex_);
+	io_uring_buf& entry = buffer_ring_[buffer_tail_ & (buffers_count_ - 1)];
+	entry.addr = reinterpret_cast<uintptr_t>(buffer(index));
+	entry.len = buffer_size;
+	entry.bid = static_cast<uint16_t>(index);
+	++buffer_tail_;
+	__atomic_store_n(&buffer_ring_[0].resv, buffer_tail_, __ATOMIC_RELEASE);	// tail of ring shares memory with the first entry
+}
+// ----------------------------------------------------------------------------
+
+///
+/// Receive from the socket to the provided buffer, which is taken when data arrive
+///
+/// @param operation owner of operation
+/// @param tag tag of completion
+/// @param fd socket
+///
+void T_uring::recv(T_operation& operation, const unsigned int tag, const int fd) {
+	boost::lock_guard<boost::mutex> lock(mutex_);
+	io_uring_sqe *const sqe = take_sqe();
+	if(sqe == NULL) {
+		fail(operation, tag, -EBUSY);
+		return;
+	}
+	prepare_recv(*sqe, fd);
+	sqe->user_data = user_data(operation, tag);
+	submit_prepared();
+}
+
+///
+/// Write data to the socket (from the registered region by fixed write)
+///
+/// @param operation owner of operation
+/// @param tag tag of completion
+/// @param fd socket
+/// @param data pointer to data in the provided buffer
+/// @param len length of data
+///
+void T_uring::write(T_operation& operation, const unsigned int tag, const int fd, const char *const data, const size_t len) {
+	boost::lock_guard<boost::mutex> lock(mutex_);
+	io_uring_sqe *const sqe = take_sqe();
+	if(sqe == NULL) {
+		fail(operation, tag, -EBUSY);
+		return;
+	}
+	prepare_write(*sqe, fd, data, len);
+	sqe->user_data = user_data(operation, tag);
+	submit_prepared();
+}
+
+///
+/// Write data to the socket and the next receive from other socket, which starts only after complete write
+/// (linked operations): on error or incomplete write the receive is completed with -ECANCELED
+///
+/// @param operation owner of both operations
+/// @param write_tag tag of completion of write
+/// @param write_fd socket, to which data are written
+/// @param data pointer to data in the provided buffer
+/// @param len length of data
+/// @param recv_tag tag of completion of receive
+/// @param recv_fd socket, from which data are received
+///
+void T_uring::write_then_recv(T_operation& operation, const unsigned int write_tag, const int write_fd, const char *const data,
+	const size_t len, const unsigned int recv_tag, const int recv_fd)
+{
+	boost::lock_guard<boost::mutex> lock(mutex_);
+	// linked entries must be adjacent in the queue: both of them are taken under one lock
+	io_uring_sqe *const write_sqe = take_sqe();
+	io_uring_sqe *const recv_sqe = (write_sqe != NULL) ? take_sqe() : NULL;
+	if(recv_sqe == NULL) {
+		if(write_sqe != NULL) {
+			// only write: the receive is failed as cancelled, so the owner continues as after incomplete write
+			prepare_write(*write_sqe, write_fd, data, len);
+			write_sqe->user_data = user_data(operation, write_tag);
+			submit_prepared();
+		} else {
+			fail(operation, write_tag, -EBUSY);
+		}
+		fail(operation, recv_tag, -ECANCELED);
+		return;
+	}
+	prepare_write(*write_sqe, write_fd, data, len);
+	write_sqe->user_data = user_data(operation, write_tag);
+	write_sqe->flags |= IOSQE_IO_LINK;
+	prepare_recv(*recv_sqe, recv_fd);
+	recv_sqe->user_data = user_data(operation, recv_tag);
+	submit_prepared();
+}
+// ----------------------------------------------------------------------------
+
+/// Take free entry of submission queue, mutex_ must be locked; NULL - queue is full
+io_uring_sqe* T_uring::take_sqe() {
+	if(sq_tail_local_ - load_acquire(sq_head_) > sq_mask_) {
+		enter(0);	// submit prepared entries to free the queue
+		if(sq_tail_local_ - load_acquire(sq_head_) > sq_mask_) return NULL;
+	}
+	const unsigned int index = sq_tail_local_ & sq_mask_;
+	io_uring_sqe *const sqe = &sqes_[index];
+	std::memset(sqe, 0, sizeof(*sqe));
+	sq_array_[index] = index;
+	++sq_tail_local_;
+	return sqe;
+}
+
+/// Fill entry of write
+void T_uring::prepare_write(io_uring_sqe& sqe, const int fd, const char *const data, const size_t len) {
+	sqe.fd = fd;
+	sqe.addr = reinterpret_cast<uintptr_t>(data);
+	sqe.len = static_cast<uint32_t>(len);
+	if(fixed_buffers_) {
+		sqe.opcode = IORING_OP_WRITE_FIXED;
+		sqe.buf_index = 0;	// the whole region is one registered buffer
+	} else {
+		sqe.opcode = IORING_OP_SEND;
+		sqe.msg_flags = MSG_NOSIGNAL;
+	}
+}
+
+/// Fill entry of receive
+void T_uring::prepare_recv(io_uring_sqe& sqe, const int fd) {
+	sqe.opcode = IORING_OP_RECV;
+	sqe.fd = fd;
+	sqe.len = buffer_size;
+	sqe.flags = IOSQE_BUFFER_SELECT;
+	sqe.buf_group = 0;
+}
+
+/// Submit prepared entries, if it isn't the handler of completions (it submits them at the end), mutex_ must be locked
+void T_uring::submit_prepared() {
+	if(handling_ring != this) enter(0);
+}
+
+/// Submit prepared entries to the kernel, mutex_ must be locked
+void T_uring::enter(const unsigned int flags) {
+	store_release(sq_tail_, sq_tail_local_);
+	const unsigned int to_submit = sq_tail_local_ - load_acquire(sq_head_);
+	if(to_submit == 0 && flags == 0) return;
+	while(::syscall(__NR_io_uring_enter, ring_fd_, to_submit, 0, flags, NULL, 0) < 0 && errno == EINTR) ;
+	// on EBUSY/EAGAIN entries stay in the queue and are submitted by the next enter()
+}
+
+/// Complete operation with error through io_service, if there isn't free entry of submission queue
+void T_uring::fail(T_operation& operation, const unsigned int tag, const int result) {
+	io_service_.post(boost::bind(&T_operation::on_complete, &operation, tag, result, -1));
+}
+// ----------------------------------------------------------------------------
+
+/// Wait of readiness of eventfd
+void T_uring::start_wait() {
+	event_descriptor_.async_read_some(ba::null_buffers(), boost::bind(&T_uring::handle_completions, this, ba::placeholders::error));
+}
+
+/// Handle completions after readiness of eventfd
+void T_uring::handle_completions(const bs::error_code& err) {
+	if(err == ba::error::operation_aborted) return;
+	uint64_t value;
+	while(::read(event_fd_, &value, sizeof(value)) < 0 && errno == EINTR) ;	// reset before completions: next ones signal again
+
+	handling_ring = this;
+	unsigned int head = *cq_head_;
+	const unsigned int tail = load_acquire(cq_tail_);
+	unsigned int handled = 0;
+	for(; head != tail && handled < max_completions; ++head, ++handled) {
+		const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+		const uint64_t data = cqe.user_data;
+		const int result = cqe.res;
+		const int buffer = (cqe.flags & IORING_CQE_F_BUFFER) ? static_cast<int>(cqe.flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+		store_release(cq_head_, head + 1);	// entry is copied: the kernel can reuse it
+		T_operation& operation = *reinterpret_cast<T_operation*>(static_cast<uintptr_t>(data & ~uint64_t(3)));
+		operation.on_complete(static_cast<unsigned int>(data & 3), result, buffer);
+	}
+	handling_ring = NULL;
+
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+		// completions, which haven't fit in the queue, are moved to it by enter with IORING_ENTER_GETEVENTS
+		const bool overflow = (load_acquire(sq_flags_) & IORING_SQ_CQ_OVERFLOW) != 0;
+		enter(overflow ? IORING_ENTER_GETEVENTS : 0);
+	}
+	if(head != load_acquire(cq_tail_)) {
+		// the rest of completions is handled after other handlers of io_service
+		io_service_.post(boost::bind(&T_uring::handle_completions, this, bs::error_code()));
+		return;
+	}
+	start_wait();
+}
+// ----------------------------------------------------------------------------
+#endif
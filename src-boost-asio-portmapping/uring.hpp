@@ -0,0 +1,189 @@
+/**
+ * @file   uring.hpp
+ * @author Alexey Bochkovskiy <alexeyab84@gmail.com>
+ *
+ * @brief Ring of io_uring for the relay of connections (only Linux)
+ *
+ *
+ */
+// ----------------------------------------------------------------------------
+#ifndef URING_HPP
+#define URING_HPP
+// ----------------------------------------------------------------------------
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+namespace bs = boost::system;
+// ----------------------------------------------------------------------------
+#include <cstdint>
+#include <cstddef>
+// ----------------------------------------------------------------------------
+#if defined(__linux__) && defined(__has_include)
+	#if __has_include(<linux/io_uring.h>)
+		#include <linux/io_uring.h>
+		#ifdef IORING_RECVSEND_POLL_FIRST	// headers of kernel >= 5.19: rings of provided buffers
+			#define PORTMAPPING_URING	///< relay through io_uring is available (support of kernel is checked at start)
+		#endif
+	#endif
+#endif
+// ----------------------------------------------------------------------------
+
+class T_uring;
+
+#ifdef PORTMAPPING_URING
+///
+/// Ring of io_uring of one io_service of executors, without liburing (only syscalls).
+///
+/// Completions are signalled by eventfd, which is waited by the reactor of io_service as any socket,
+/// so io_uring and Asio share threads of executors. Operations, which are prepared in the handler of completions,
+/// are submitted by one io_uring_enter() after all completions of this wakeup.
+///
+/// Buffers for data are one registered region (fixed buffers), which is also the ring of provided buffers:
+/// receive takes buffer only when data arrive, so idle connections don't hold any memory for data.
+///
+class T_uring : private boost::noncopyable {
+public:
+	enum { sq_entries = 1024 };             ///< size of submission queue (completion queue is 2 times bigger)
+	enum { buffer_size = 16384 };           ///< size of each provided buffer
+	enum { max_buffers = 32768 };           ///< max number of provided buffers (limit of kernel)
+	enum { max_completions = 256 };         ///< max completions per one wakeup, then return to the reactor
+
+	/// Owner of submitted operations, user_data of operation is pointer to it with tag in the low bits
+	class T_operation {
+	public:
+		///
+		/// Run in the io_service of the ring for each completion
+		///
+		/// @param tag tag of operation (0 - 3), that is passed at submit
+		/// @param result result of operation: bytes, or -errno
+		/// @param buffer index of provided buffer, which has been taken by receive, or -1
+		///
+		virtual void on_complete(const unsigned int tag, const int result, const int buffer) = 0;
+
+	protected:
+		~T_operation() {}
+	};
+
+	///
+	/// Create ring, register buffers and start wait of completions
+	///
+	/// @param io_service io_service of executors, in which completions are handled
+	/// @param buffers number of provided buffers of buffer_size (rounded up to power of 2)
+	///
+	/// throws bs::system_error, if the kernel doesn't support io_uring or required features
+	///
+	T_uring(ba::io_service& io_service, unsigned int buffers);
+	~T_uring();
+
+	/// Return pointer to data of provided buffer
+	inline char* buffer(const int index) const { return buffers_ + size_t(index) * buffer_size; }
+
+	///
+	/// Return provided buffer to the ring for next receives
+	///
+	/// @param index index of buffer
+	///
+	void release_buffer(const int index);
+
+	///
+	/// Receive from the socket to the provided buffer, which is taken when data arrive
+	///
+	/// @param operation owner of operation
+	/// @param tag tag of completion
+	/// @param fd socket
+	///
+	void recv(T_operation& operation, const unsigned int tag, const int fd);
+
+	///
+	/// Write data to the socket (from the registered region by fixed write)
+	///
+	/// @param operation owner of operation
+	/// @param tag tag of completion
+	/// @param fd socket
+	/// @param data pointer to data in the provided buffer
+	/// @param len length of data
+	///
+	void write(T_operation& operation, const unsigned int tag, const int fd, const char *const data, const size_t len);
+
+	///
+	/// Write data to the socket and the next receive from other socket, which starts only after complete write
+	/// (linked operations): on error or incomplete write the receive is completed with -ECANCELED
+	///
+	/// @param operation owner of both operations
+	/// @param write_tag tag of completion of write
+	/// @param write_fd socket, to which data are written
+	/// @param data pointer to data in the provided buffer
+	/// @param len length of data
+	/// @param recv_tag tag of completion of receive
+	/// @param recv_fd socket, from which data are received
+	///
+	void write_then_recv(T_operation& operation, const unsigned int write_tag, const int write_fd, const char *const data,
+		const size_t len, const unsigned int recv_tag, const int recv_fd);
+
+	/// Whether the region of buffers is registered for fixed writes
+	inline bool fixed_buffers() const { return fixed_buffers_; }
+
+private:
+	/// Close ring and free its memory
+	void close();
+
+	/// Wait of readiness of eventfd
+	void start_wait();
+
+	/// Handle completions after readiness of eventfd
+	void handle_completions(const bs::error_code& err);
+
+	/// Take free entry of submission queue, mutex_ must be locked; NULL - queue is full
+	io_uring_sqe* take_sqe();
+
+	/// Fill entry of write
+	void prepare_write(io_uring_sqe& sqe, const int fd, const char *const data, const size_t len);
+
+	/// Fill entry of receive
+	static void prepare_recv(io_uring_sqe& sqe, const int fd);
+
+	/// Submit prepared entries, if it isn't the handler of completions (it submits them at the end), mutex_ must be locked
+	void submit_prepared();
+
+	/// Submit prepared entries to the kernel, mutex_ must be locked
+	void enter(const unsigned int flags);
+
+	/// Complete operation with error through io_service, if there isn't free entry of submission queue
+	void fail(T_operation& operation, const unsigned int tag, const int result);
+
+	/// user_data of operation
+	static inline uint64_t user_data(T_operation& operation, const unsigned int tag) {
+		return reinterpret_cast<uintptr_t>(&operation) | tag;
+	}
+
+	ba::io_service& io_service_;            ///< io_service of executors
+	int ring_fd_;                           ///< file descriptor of io_uring
+	int event_fd_;                          ///< eventfd, which is signalled on each completion
+	ba::posix::stream_descriptor event_descriptor_;    ///< eventfd in the reactor of io_service
+	void *ring_memory_;                     ///< mapping of submission and completion rings
+	size_t ring_memory_size_;               ///< size of ring_memory_
+	io_uring_sqe *sqes_;                    ///< entries of submission queue
+	size_t sqes_size_;                      ///< size of mapping of sqes_
+	unsigned int *sq_head_;                 ///< head of submission queue (written by kernel)
+	unsigned int *sq_tail_;                 ///< tail of submission queue (written by us)
+	unsigned int *sq_flags_;                ///< flags of submission queue (overflow of completions)
+	unsigned int *sq_array_;                ///< indexes of entries in submission queue
+	unsigned int sq_mask_;                  ///< mask of indexes of submission queue
+	unsigned int sq_tail_local_;            ///< tail of prepared entries, which aren't visible to the kernel yet
+	unsigned int *cq_head_;                 ///< head of completion queue (written by us)
+	unsigned int *cq_tail_;                 ///< tail of completion queue (written by kernel)
+	io_uring_cqe *cqes_;                    ///< entries of completion queue
+	unsigned int cq_mask_;                  ///< mask of indexes of completion queue
+	char *buffers_;                         ///< region of provided buffers
+	size_t buffers_count_;                  ///< number of provided buffers
+	io_uring_buf *buffer_ring_;             ///< ring of provided buffers, tail of it is in resv of the first entry
+	uint16_t buffer_tail_;                  ///< tail of ring of provided buffers
+	bool fixed_buffers_;                    ///< whether region of buffers is registered (fixed writes), else writes by send()
+	boost::mutex mutex_;                    ///< mutex for submission queue and ring of buffers (in shared mode the ring is used by many threads)
+};
+#endif
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+#endif // URING_HPP